@@ -15,6 +15,7 @@
 #include "stm32l072xx.h"
 #include "hal_stubs.h"
 #include "mac_mirror.h"
+#include "eeprom-board.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -34,9 +35,6 @@
 #define ATCMD_RESP_NO_NET_JOINED    "AT_NO_NET_JOINED\r\n"
 #define ATCMD_RESP_JOINED           "ABC JOINED\r\n"  /* String at 0x08013349 */
 
-/* TDC Validation (from original firmware at 0x08013A7F) */
-#define TDC_MINIMUM_MS              4000
-
 /* ============================================================================
  * PRIVATE TYPES
  * ========================================================================== */
@@ -122,6 +120,7 @@ static ATCmdResult_t ATCmd_HandleMacStat(int argc, char *argv[]);
 static ATCmdResult_t ATCmd_HandleMacMirrorUp(int argc, char *argv[]);
 static ATCmdResult_t ATCmd_HandlePowerProfileUplink(int argc, char *argv[]);
 static ATCmdResult_t ATCmd_HandlePowerStat(int argc, char *argv[]);
+static ATCmdResult_t ATCmd_HandleEepromStat(int argc, char *argv[]);
 static ATCmdResult_t ATCmd_HandleConfirmedMode(int argc, char *argv[]);
 static ATCmdResult_t ATCmd_HandleConfirmedStatus(int argc, char *argv[]);
 static ATCmdResult_t ATCmd_HandleAppPort(int argc, char *argv[]);
@@ -230,6 +229,7 @@ static const ATCmdEntry_t g_ATCmdTable[] = {
     { "AT+MACUP", ATCmd_HandleMacMirrorUp, "Send MAC-mirror uplink" },
     { "AT+POWERUP", ATCmd_HandlePowerProfileUplink, "Send power profile uplink" },
     { "AT+POWERSTAT", ATCmd_HandlePowerStat, "Get battery percent and mV" },
+    { "AT+EESTAT", ATCmd_HandleEepromStat, "Get/Clear (=0) EEPROM write stats" },
 
     /* Time Synchronization */
     { "AT+TIMEREQ", ATCmd_HandleTimeRequest, "Request time synchronization" },
@@ -297,6 +297,8 @@ static bool ATCmd_HexStringToBytes(const char *hexStr, uint8_t *bytes, uint8_t l
 static void ATCmd_BytesToHexString(const uint8_t *bytes, uint8_t len, char *hexStr);
 static ATCmdResult_t ATCmd_ReturnError(void);
 static ATCmdResult_t ATCmd_ReturnParamError(void);
+static bool ATCmd_ParseUint(const char *str, uint32_t *value);
+static ATCmdResult_t ATCmd_HandleStorageValue(int argc, char *argv[], StorageKey_t key, const char *name);
 
 /* ============================================================================
  * PUBLIC FUNCTIONS
@@ -417,6 +419,49 @@ static ATCmdResult_t ATCmd_ReturnParamError(void)
     return ATCMD_ERROR;
 }
 
+/* Decimal only: no sign, no trailing characters */
+static bool ATCmd_ParseUint(const char *str, uint32_t *value)
+{
+    char *end = NULL;
+
+    if (str[0] < '0' || str[0] > '9')
+    {
+        return false;
+    }
+
+    unsigned long parsed = strtoul(str, &end, 10);
+    if (*end != '\0' || parsed > UINT32_MAX)
+    {
+        return false;
+    }
+    *value = (uint32_t)parsed;
+    return true;
+}
+
+/* Get/set of a numeric storage key; the key descriptor holds the range */
+static ATCmdResult_t ATCmd_HandleStorageValue(int argc, char *argv[], StorageKey_t key, const char *name)
+{
+    uint32_t value = 0;
+
+    if (argc == 1)
+    {
+        if (Storage_GetValue(key, &value) != STORAGE_OK)
+        {
+            return ATCmd_ReturnError();
+        }
+        ATCmd_SendFormattedResponse("+%s: %lu\r\n", name, (unsigned long)value);
+        return ATCMD_OK;
+    }
+    else if (argc == 2)
+    {
+        if (ATCmd_ParseUint(argv[1], &value) && Storage_SetValue(key, value) == STORAGE_OK)
+        {
+            return ATCMD_OK;
+        }
+    }
+    return ATCmd_ReturnParamError();
+}
+
 void ATCmd_UpdateRSSI(int16_t rssi)
 {
     s_LastRssi = rssi;
@@ -471,6 +516,7 @@ static ATCmdResult_t ATCmd_HandleVersion(int argc, char *argv[])
 static ATCmdResult_t ATCmd_HandleReset(int argc, char *argv[])
 {
     ATCmd_SendResponse("+RESET\r\n");
+    Storage_Flush();
     HAL_Delay(200);
     NVIC_SystemReset();
     return ATCMD_OK;
@@ -603,71 +649,17 @@ static ATCmdResult_t ATCmd_HandleJoin(int argc, char *argv[])
 
 static ATCmdResult_t ATCmd_HandleADR(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        ATCmd_SendFormattedResponse("+ADR: %d\r\n", storage.AdrEnabled);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        int value = atoi(argv[1]);
-        if (value == 0 || value == 1)
-        {
-            storage.AdrEnabled = value;
-            Storage_Save(&storage);
-            return ATCMD_OK;
-        }
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_ADR, "ADR");
 }
 
 static ATCmdResult_t ATCmd_HandleDataRate(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        ATCmd_SendFormattedResponse("+DR: %d\r\n", storage.DataRate);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        int value = atoi(argv[1]);
-        if (value >= 0 && value <= 5)
-        {
-            storage.DataRate = value;
-            Storage_Save(&storage);
-            return ATCMD_OK;
-        }
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_DR, "DR");
 }
 
 static ATCmdResult_t ATCmd_HandleTxPower(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        ATCmd_SendFormattedResponse("+TXP: %d\r\n", storage.TxPower);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        int value = atoi(argv[1]);
-        if (value >= 0 && value <= 10)
-        {
-            storage.TxPower = value;
-            Storage_Save(&storage);
-            return ATCMD_OK;
-        }
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_TXP, "TXP");
 }
 
 static ATCmdResult_t ATCmd_HandleTDC(int argc, char *argv[])
@@ -683,17 +675,13 @@ static ATCmdResult_t ATCmd_HandleTDC(int argc, char *argv[])
     }
     else if (argc == 2)
     {
-        /* SET */
-        uint32_t value = (uint32_t)atoi(argv[1]);
-
-        /* Validate minimum TDC (from original firmware) */
-        if (value < TDC_MINIMUM_MS)
+        /* SET: the storage key range holds the TDC minimum */
+        uint32_t value = 0;
+        if (!ATCmd_ParseUint(argv[1], &value) || Storage_SetValue(STORAGE_KEY_TDC, value) != STORAGE_OK)
         {
             return ATCmd_ReturnParamError();
         }
 
-        storage.TxDutyCycle = value;
-        Storage_Save(&storage);
         ATCmd_SendResponse(ATCMD_RESP_OK);
         return ATCMD_OK;
     }
@@ -703,111 +691,27 @@ static ATCmdResult_t ATCmd_HandleTDC(int argc, char *argv[])
 
 static ATCmdResult_t ATCmd_HandlePort(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        ATCmd_SendFormattedResponse("+PORT: %d\r\n", storage.AppPort);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        int value = atoi(argv[1]);
-        if (value >= 1 && value <= 223)
-        {
-            storage.AppPort = value;
-            Storage_Save(&storage);
-            return ATCMD_OK;
-        }
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_PORT, "PORT");
 }
 
 static ATCmdResult_t ATCmd_HandleConfirmed(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        ATCmd_SendFormattedResponse("+PNACKMD: %d\r\n", storage.ConfirmedMsg);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        int value = atoi(argv[1]);
-        if (value == 0 || value == 1)
-        {
-            storage.ConfirmedMsg = value;
-            Storage_Save(&storage);
-            return ATCMD_OK;
-        }
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_CONFIRMED, "PNACKMD");
 }
 
 static ATCmdResult_t ATCmd_HandleRX2DR(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        ATCmd_SendFormattedResponse("+RX2DR: %d\r\n", storage.Rx2DataRate);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        int value = atoi(argv[1]);
-        storage.Rx2DataRate = value;
-        Storage_Save(&storage);
-        return ATCMD_OK;
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_RX2DR, "RX2DR");
 }
 
 static ATCmdResult_t ATCmd_HandleRX2FQ(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        ATCmd_SendFormattedResponse("+RX2FQ: %lu\r\n", storage.Rx2Frequency);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        uint32_t value = atoi(argv[1]);
-        storage.Rx2Frequency = value;
-        Storage_Save(&storage);
-        return ATCMD_OK;
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_RX2FQ, "RX2FQ");
 }
 
 static ATCmdResult_t ATCmd_HandleFreqBand(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        ATCmd_SendFormattedResponse("+FREQBAND: %d\r\n", storage.FreqBand);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        int value = atoi(argv[1]);
-        if ((value == 1) || (value == 2))
-        {
-            storage.FreqBand = value;
-            Storage_Save(&storage);
-            return ATCMD_OK;
-        }
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_FREQBAND, "FREQBAND");
 }
 
 static ATCmdResult_t ATCmd_HandleBattery(int argc, char *argv[])
@@ -1098,90 +1002,22 @@ static ATCmdResult_t ATCmd_HandleNetworkJoinStatus(int argc, char *argv[])
 
 static ATCmdResult_t ATCmd_HandleRX1DL(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        /* GET */
-        ATCmd_SendFormattedResponse("+RX1DL: %lu\r\n", storage.Rx1Delay);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        /* SET */
-        uint32_t value = (uint32_t)atoi(argv[1]);
-        storage.Rx1Delay = value;
-        Storage_Save(&storage);
-        return ATCMD_OK;
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_RX1DL, "RX1DL");
 }
 
 static ATCmdResult_t ATCmd_HandleRX2DL(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        /* GET */
-        ATCmd_SendFormattedResponse("+RX2DL: %lu\r\n", storage.Rx2Delay);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        /* SET */
-        uint32_t value = (uint32_t)atoi(argv[1]);
-        storage.Rx2Delay = value;
-        Storage_Save(&storage);
-        return ATCMD_OK;
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_RX2DL, "RX2DL");
 }
 
 static ATCmdResult_t ATCmd_HandleJRX1DL(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        /* GET */
-        ATCmd_SendFormattedResponse("+JRX1DL: %lu\r\n", storage.JoinRx1Delay);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        /* SET */
-        uint32_t value = (uint32_t)atoi(argv[1]);
-        storage.JoinRx1Delay = value;
-        Storage_Save(&storage);
-        return ATCMD_OK;
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_JRX1DL, "JRX1DL");
 }
 
 static ATCmdResult_t ATCmd_HandleJRX2DL(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        /* GET */
-        ATCmd_SendFormattedResponse("+JRX2DL: %lu\r\n", storage.JoinRx2Delay);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        /* SET */
-        uint32_t value = (uint32_t)atoi(argv[1]);
-        storage.JoinRx2Delay = value;
-        Storage_Save(&storage);
-        return ATCMD_OK;
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_JRX2DL, "JRX2DL");
 }
 
 /* ============================================================================
@@ -1304,49 +1140,12 @@ static ATCmdResult_t ATCmd_HandleRecv(int argc, char *argv[])
 
 static ATCmdResult_t ATCmd_HandleRetry(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        /* GET */
-        ATCmd_SendFormattedResponse("+RETY: %d\r\n", storage.RetryCount);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        /* SET */
-        int value = atoi(argv[1]);
-        if (value >= 0 && value <= 15)  /* LoRaWAN spec allows up to 15 retries */
-        {
-            storage.RetryCount = (uint8_t)value;
-            Storage_Save(&storage);
-            return ATCMD_OK;
-        }
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_RETRY, "RETY");
 }
 
 static ATCmdResult_t ATCmd_HandleRetryDelay(int argc, char *argv[])
 {
-    StorageData_t storage;
-    Storage_Load(&storage);
-
-    if (argc == 1)
-    {
-        /* GET */
-        ATCmd_SendFormattedResponse("+DELAY: %lu\r\n", storage.RetryDelay);
-        return ATCMD_OK;
-    }
-    else if (argc == 2)
-    {
-        /* SET */
-        uint32_t value = (uint32_t)atoi(argv[1]);
-        storage.RetryDelay = value;
-        Storage_Save(&storage);
-        return ATCMD_OK;
-    }
-    return ATCmd_ReturnParamError();
+    return ATCmd_HandleStorageValue(argc, argv, STORAGE_KEY_RETRY_DELAY, "DELAY");
 }
 
 /* ============================================================================
@@ -1687,6 +1486,36 @@ static ATCmdResult_t ATCmd_HandlePowerStat(int argc, char *argv[])
     return ATCMD_OK;
 }
 
+/* Bytes and program cycles the storage layer wrote, its longest write in
+ * cycles, log compactions, and the longest interrupt-masked EEPROM cycle */
+static ATCmdResult_t ATCmd_HandleEepromStat(int argc, char *argv[])
+{
+    if (argc == 2 && strcmp(argv[1], "0") == 0)
+    {
+        Storage_ResetWriteStats();
+        EepromMcuResetIrqStats();
+        ATCmd_SendResponse(ATCMD_RESP_OK);
+        return ATCMD_OK;
+    }
+
+    if (argc != 1)
+    {
+        return ATCmd_ReturnParamError();
+    }
+
+    StorageWriteStats_t stats;
+    Storage_GetWriteStats(&stats);
+
+    ATCmd_SendFormattedResponse("+EESTAT:%luB,%lu,%lu,%lu,%luus\r\n",
+                                (unsigned long)stats.BytesWritten,
+                                (unsigned long)stats.ProgramCycles,
+                                (unsigned long)stats.MaxCyclesPerCall,
+                                (unsigned long)stats.Compactions,
+                                (unsigned long)EepromMcuGetMaxIrqOffUs());
+    ATCmd_SendResponse(ATCMD_RESP_OK);
+    return ATCMD_OK;
+}
+
 /* ============================================================================
  * TIME SYNCHRONIZATION HANDLERS
  * ========================================================================== */
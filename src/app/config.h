@@ -41,11 +41,16 @@ extern "C"
  * ========================================================================== */
 #define LORAWAN_DEFAULT_CLASS LORAWAN_DEVICE_CLASS_A
 #define LORAWAN_DEFAULT_ADR_STATE 1     /* 1 = ADR ON */
+#define LORAWAN_ADR_ACK_LIMIT 64        /* Uplinks without downlink before ADRACKReq */
+#define LORAWAN_ADR_ACK_DELAY 32        /* Further uplinks per backoff step */
 #define LORAWAN_DEFAULT_DATARATE 0      /* DR0 */
 #define LORAWAN_DEFAULT_TX_POWER 0      /* Max EIRP */
 #define LORAWAN_DEFAULT_CONFIRMED_MSG 0 /* 0 = unconfirmed */
 #define LORAWAN_DEFAULT_APP_PORT 2
 #define LORAWAN_DEFAULT_TDC 60000  /* 60 seconds in ms */
+#define LORAWAN_TDC_MINIMUM_MS 4000 /* From original firmware at 0x08013A7F */
+#define LORAWAN_TDC_MAXIMUM_MS 86400000UL /* 24 h: one timer spans at most 2^32 LPTIM ticks (36.4 h) */
+#define LORAWAN_TDC_SLACK_MS 5000UL /* Uplink may wait up to one sensor wake to share its wakeup */
 #define LORAWAN_DUTYCYCLE_ON false /* AU915 has no duty cycle */
 
 /* RX2 Configuration (AU915 standard) */
@@ -60,9 +65,22 @@ extern "C"
 #define LORAWAN_JOIN_RX1_DELAY 5000
 #define LORAWAN_JOIN_RX2_DELAY 6000
 
+/* RX window sizing: symbols the radio needs to lock on a preamble and the
+ * worst-case wakeup timing error (ms) the window must absorb on each side */
+#define LORAWAN_RX_MIN_SYMBOLS 6
+#define LORAWAN_RX_TIMER_ERROR_MS 10
+#define LORAWAN_RX_MAX_WINDOW_MS 3000 /* Safety net once a preamble is locked */
+
 /* Retry Configuration for Confirmed Messages */
 #define LORAWAN_DEFAULT_RETRY_COUNT 3
 #define LORAWAN_DEFAULT_RETRY_DELAY 1000 /* 1 second between retries */
+#define LORAWAN_RETRY_DR_STEPDOWN 1 /* 1 = step DR down every second attempt */
+
+/* OTAA session persistence: resume the stored session after a reset instead
+ * of rejoining. FCntUp is only journalled every STORAGE_FCNT_COMMIT_INTERVAL
+ * uplinks, so a resumed session skips that many counts. */
+#define LORAWAN_SESSION_RESTORE 1
+#define LORAWAN_FCNT_RESUME_GAP STORAGE_FCNT_COMMIT_INTERVAL
 
 /* ============================================================================
  * FLASH MEMORY CONFIGURATION
@@ -81,13 +99,31 @@ extern "C"
 
 /* EEPROM Emulation in Flash (internal EEPROM area, not main flash) */
 #define EEPROM_BASE_ADDRESS 0x08080000
-#define EEPROM_SIZE (4 * 1024)
+#define EEPROM_SIZE (6 * 1024) /* Banks 1 and 2 */
 #define EEPROM_PAGE_SIZE 64
 
-#define STORAGE_PRIMARY_OFFSET 0x0000 /* Primary at base + 0x0000 */
-#define STORAGE_BACKUP_OFFSET 0x0400  /* Backup at base + 0x0400 (1024 bytes) */
-#define STORAGE_PRIMARY_ADDRESS (EEPROM_BASE_ADDRESS + STORAGE_PRIMARY_OFFSET)
-#define STORAGE_BACKUP_ADDRESS (EEPROM_BASE_ADDRESS + STORAGE_BACKUP_OFFSET)
+/* Configuration block: two A/B slots, a save writes the older one under the
+ * next sequence number and the newest slot with a valid CRC is loaded */
+#define STORAGE_SLOT_A_OFFSET 0x0000 /* Slot A at base + 0x0000 (was primary) */
+#define STORAGE_SLOT_B_OFFSET 0x0400 /* Slot B at base + 0x0400 (was backup, 1024 bytes) */
+#define STORAGE_SLOT_A_ADDRESS (EEPROM_BASE_ADDRESS + STORAGE_SLOT_A_OFFSET)
+#define STORAGE_SLOT_B_ADDRESS (EEPROM_BASE_ADDRESS + STORAGE_SLOT_B_OFFSET)
+
+/* FCntUp journal: ring of 32-bit records, one appended every
+ * STORAGE_FCNT_COMMIT_INTERVAL uplinks instead of a block rewrite per uplink */
+#define STORAGE_FCNT_JOURNAL_OFFSET 0x0C00 /* Journal at base + 0x0C00 (1024 bytes) */
+#define STORAGE_FCNT_JOURNAL_SIZE 0x0400
+#define STORAGE_FCNT_JOURNAL_ADDRESS (EEPROM_BASE_ADDRESS + STORAGE_FCNT_JOURNAL_OFFSET)
+#define STORAGE_FCNT_COMMIT_INTERVAL 16
+
+/* Key/value log: two segments, one live and one compaction target */
+#define STORAGE_LOG_OFFSET 0x1000 /* Log at base + 0x1000 (2 x 1024 bytes) */
+#define STORAGE_LOG_SEGMENT_SIZE 0x0400
+#define STORAGE_LOG_ADDRESS (EEPROM_BASE_ADDRESS + STORAGE_LOG_OFFSET)
+
+/* Deferred EEPROM jobs only start with this much slack before the next
+ * timer deadline (RX window, retransmission, TX interval) */
+#define STORAGE_WRITE_GUARD_MS 10
 
 /* ============================================================================
  * POWER MANAGEMENT CONFIGURATION
@@ -95,6 +131,13 @@ extern "C"
 #define LOW_POWER_MODE_ENABLED 1
 #define TARGET_STOP_CURRENT_UA 20 /* Target: <20 µA in STOP mode */
 
+/* Power_Idle: shorter idle periods use SLEEP, since entering and leaving STOP
+ * costs more than it saves; STOP ends this much before the next deadline
+ * (regulator start-up and clock restore after the wake-up) */
+#define POWER_STOP_MIN_MS 10U
+#define POWER_STOP_WAKEUP_MS 4U
+#define POWER_IDLE_TRACE_DEPTH 16U /* Power_Idle decisions kept for Power_GetIdleTrace */
+
 /* Watchdog Configuration */
 #define WATCHDOG_ENABLED 1 /* Enable Independent Watchdog (IWDG) */
 
@@ -167,6 +210,12 @@ extern "C"
  */
 #define SENSOR_HOUSEKEEPING_INTERVAL_MS 15000UL
 
+/*!
+ * \brief Lateness the housekeeping timer tolerates (timer slack), so that
+ *        it fires in a sensor wake instead of a wakeup of its own
+ */
+#define SENSOR_HOUSEKEEPING_SLACK_MS SENSOR_WAKEUP_DEFAULT_MS
+
 /* ============================================================================
  * BATTERY MONITORING
  * ========================================================================== */
@@ -11,29 +11,88 @@
 #include "board.h"
 #include "hal_stubs.h"
 #include "mac_mirror.h"
+#include "timer.h"
 #include <stdio.h>
 
 static LoRaWANAppState_t g_AppStatus = LORAWAN_APP_STATE_IDLE;
 static LoRaWANContext_t g_LoRaCtx;
 static LoRaWANSession_t g_Session;
 static LoRaWANSettings_t g_Settings;
-static uint8_t g_RadioBuffer[256];
+static uint8_t g_RadioBuffer[LORAWAN_RADIO_BUFFER_SIZE];
 
 static void OnJoinSuccess(uint32_t devAddr);
 static void OnJoinFailure(void);
 static void OnTxComplete(LoRaWANStatus_t status);
 static void OnRxData(const uint8_t *buffer, uint8_t size, uint8_t port, int16_t rssi, int8_t snr);
+static uint8_t GetBatteryLevel(void);
 static void Downlink_SetTdc(uint32_t interval);
 static void Downlink_SetAdr(bool enabled);
 static void Downlink_SetDataRate(uint8_t dr);
 static void Downlink_SetTxPower(uint8_t txp);
 static bool Downlink_ProcessCalibration(const uint8_t *payload, uint8_t size);
+static bool StorageWriteGate(uint32_t durationMs);
+static void OnStorageChanged(StorageKey_t key);
 
 static const LoRaWANCallbacks_t g_Callbacks = {
     .OnJoinSuccess = OnJoinSuccess,
     .OnJoinFailure = OnJoinFailure,
     .OnTxComplete = OnTxComplete,
-    .OnRxData = OnRxData};
+    .OnRxData = OnRxData,
+    .GetBatteryLevel = GetBatteryLevel};
+
+/* Copies one configuration key into settings; false for keys that are not
+ * settings. Used at boot and again for every later change. */
+static bool LoRaWANApp_ApplySetting(LoRaWANSettings_t *settings, StorageKey_t key, const StorageData_t *storage)
+{
+    switch (key)
+    {
+    case STORAGE_KEY_ADR:
+        settings->AdrState = storage->AdrEnabled ? LORAWAN_ADR_ON : LORAWAN_ADR_OFF;
+        break;
+    case STORAGE_KEY_DR:
+        settings->DataRate = storage->DataRate;
+        break;
+    case STORAGE_KEY_TXP:
+        settings->TxPower = storage->TxPower;
+        break;
+    case STORAGE_KEY_RX2DR:
+        settings->Rx2DataRate = storage->Rx2DataRate;
+        break;
+    case STORAGE_KEY_RX2FQ:
+        settings->Rx2Frequency = storage->Rx2Frequency;
+        break;
+    case STORAGE_KEY_CONFIRMED:
+        settings->MsgType = storage->ConfirmedMsg ? LORAWAN_MSG_CONFIRMED : LORAWAN_MSG_UNCONFIRMED;
+        break;
+    case STORAGE_KEY_PORT:
+        settings->AppPort = storage->AppPort;
+        break;
+    case STORAGE_KEY_TDC:
+        settings->TxDutyCycleMs = storage->TxDutyCycle;
+        break;
+    case STORAGE_KEY_RX1DL:
+        settings->Rx1DelayMs = storage->Rx1Delay;
+        break;
+    case STORAGE_KEY_RX2DL:
+        settings->Rx2DelayMs = storage->Rx2Delay;
+        break;
+    case STORAGE_KEY_JRX1DL:
+        settings->JoinRx1DelayMs = storage->JoinRx1Delay;
+        break;
+    case STORAGE_KEY_JRX2DL:
+        settings->JoinRx2DelayMs = storage->JoinRx2Delay;
+        break;
+    case STORAGE_KEY_RETRY:
+        settings->RetryCount = storage->RetryCount;
+        break;
+    case STORAGE_KEY_RETRY_DELAY:
+        settings->RetryDelayMs = storage->RetryDelay;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
 
 static void LoRaWANApp_LoadSettings(const StorageData_t *storage)
 {
@@ -52,73 +111,64 @@ static void LoRaWANApp_LoadSettings(const StorageData_t *storage)
 
     g_Settings.Region = LORAWAN_REGION_AU915;
     g_Settings.DeviceClass = LORAWAN_DEVICE_CLASS_A;
-    g_Settings.AdrState = storage->AdrEnabled ? LORAWAN_ADR_ON : LORAWAN_ADR_OFF;
-    g_Settings.DataRate = storage->DataRate;
-    g_Settings.TxPower = storage->TxPower;
-    g_Settings.Rx2DataRate = storage->Rx2DataRate;
-    g_Settings.Rx2Frequency = storage->Rx2Frequency;
     g_Settings.SubBand = storage->FreqBand;
-    g_Settings.MsgType = storage->ConfirmedMsg ? LORAWAN_MSG_CONFIRMED : LORAWAN_MSG_UNCONFIRMED;
-    g_Settings.AppPort = storage->AppPort;
-    g_Settings.TxDutyCycleMs = storage->TxDutyCycle;
-    g_Settings.Rx1DelayMs = storage->Rx1Delay;
-    g_Settings.Rx2DelayMs = storage->Rx2Delay;
-    g_Settings.JoinRx1DelayMs = storage->JoinRx1Delay;
-    g_Settings.JoinRx2DelayMs = storage->JoinRx2Delay;
+    g_Settings.RetryDrStepDown = (LORAWAN_RETRY_DR_STEPDOWN != 0);
+    for (uint8_t key = 0; key < STORAGE_KEY_MAX; key++)
+    {
+        (void)LoRaWANApp_ApplySetting(&g_Settings, (StorageKey_t)key, storage);
+    }
 }
 
 bool LoRaWANApp_Init(void)
 {
-    StorageData_t storage;
-
-    StorageStatus_t loadStatus = Storage_Load(&storage);
-    if (loadStatus != STORAGE_OK)
+    /* Storage_Init already applied defaults if the EEPROM held nothing valid */
+    const StorageData_t *storage = Storage_Get();
+    if (storage == NULL)
     {
-        /* Storage_Load failed - use defaults */
-        DEBUG_PRINT("LoRaWAN: Storage_Load failed (status=%d), using defaults\r\n", loadStatus);
-        memset(&storage, 0, sizeof(storage));
-        storage.TxDutyCycle = LORAWAN_DEFAULT_TDC;
-        storage.AdrEnabled = (LORAWAN_DEFAULT_ADR_STATE != 0);
-        storage.DataRate = LORAWAN_DEFAULT_DATARATE;
-        storage.TxPower = LORAWAN_DEFAULT_TX_POWER;
-        storage.Rx2DataRate = LORAWAN_RX2_DATARATE;
-        storage.Rx2Frequency = LORAWAN_RX2_FREQUENCY;
-        storage.AppPort = LORAWAN_DEFAULT_APP_PORT;
+        DEBUG_PRINT("LoRaWAN: storage not initialized\r\n");
+        return false;
     }
 
-    LoRaWANApp_LoadSettings(&storage);
+    LoRaWANApp_LoadSettings(storage);
+
+    g_LoRaCtx.Session = &g_Session;
+    g_LoRaCtx.Settings = g_Settings;
+    g_LoRaCtx.Callbacks = g_Callbacks;
+    g_LoRaCtx.RadioBuffer = g_RadioBuffer;
+    g_LoRaCtx.RadioBufferSize = sizeof(g_RadioBuffer);
+
+    if (LoRaWAN_Init(&g_LoRaCtx) != LORAWAN_STATUS_SUCCESS)
+    {
+        return false;
+    }
+    Storage_SetWriteGate(StorageWriteGate);
+    (void)Storage_Subscribe(OnStorageChanged);
 
     /* ABP mode activation */
     if (g_Session.JoinMode == LORAWAN_JOIN_MODE_ABP)
     {
         /* ABP mode: activate session immediately if DevAddr is configured */
-        if (g_Session.DevAddr != 0)
+        if (LoRaWAN_ActivatePersonalization(&g_LoRaCtx) == LORAWAN_STATUS_SUCCESS)
         {
-            g_Session.Joined = true;
             DEBUG_PRINT("ABP mode activated, DevAddr=0x%08lX\r\n", (unsigned long)g_Session.DevAddr);
         }
         else
         {
-            g_Session.Joined = false;
             DEBUG_PRINT("ABP mode: DevAddr not configured\r\n");
         }
     }
-    else
-    {
-        /* OTAA mode: wait for join */
-        g_Session.Joined = false;
-    }
-
-    g_LoRaCtx.Session = &g_Session;
-    g_LoRaCtx.Settings = g_Settings;
-    g_LoRaCtx.Callbacks = g_Callbacks;
-    g_LoRaCtx.RadioBuffer = g_RadioBuffer;
-    g_LoRaCtx.RadioBufferSize = sizeof(g_RadioBuffer);
-
-    if (LoRaWAN_Init(&g_LoRaCtx) != LORAWAN_STATUS_SUCCESS)
+#if LORAWAN_SESSION_RESTORE
+    else if (storage->SessionValid != 0U)
     {
-        return false;
+        /* OTAA mode: resume the session of the last join, no Join Request */
+        if (LoRaWAN_RestoreSession(&g_LoRaCtx) == LORAWAN_STATUS_SUCCESS)
+        {
+            DEBUG_PRINT("OTAA session restored, DevAddr=0x%08lX FCntUp=%lu\r\n",
+                        (unsigned long)g_Session.DevAddr, (unsigned long)g_Session.FCntUp);
+        }
     }
+#endif
+    /* Otherwise OTAA: LoRaWAN_Init left the session unjoined, wait for join */
 
     g_AppStatus = g_Session.Joined ? LORAWAN_APP_STATE_JOINED : LORAWAN_APP_STATE_IDLE;
     return true;
@@ -126,6 +176,8 @@ bool LoRaWANApp_Init(void)
 
 bool LoRaWANApp_Join(void)
 {
+    /* A reset before the Join Accept must not resume the old session */
+    Storage_InvalidateSession();
     g_AppStatus = LORAWAN_APP_STATE_JOINING;
     return (LoRaWAN_RequestJoin(&g_LoRaCtx) == LORAWAN_STATUS_SUCCESS);
 }
@@ -142,6 +194,15 @@ bool LoRaWANApp_SendUplink(uint8_t *buffer, uint8_t size, uint8_t port, bool con
     return false;
 }
 
+/* Encoders write straight into the MAC's in-place FRMPayload slot */
+static void LoRaWANApp_InitPayload(UplinkPayload_t *payload)
+{
+    uint8_t maxSize = 0U;
+    payload->buffer = LoRaWAN_GetTxPayloadBuffer(&g_LoRaCtx, &maxSize);
+    payload->maxSize = maxSize;
+    payload->size = 0U;
+}
+
 static bool LoRaWANApp_SendEncoded(const UplinkPayload_t *payload)
 {
     if ((payload == NULL) || (payload->buffer == NULL) || (payload->size == 0U))
@@ -167,16 +228,13 @@ static bool LoRaWANApp_SendEncoded(const UplinkPayload_t *payload)
 
 bool LoRaWANApp_SendStatusUplink(void)
 {
-    uint8_t buffer[16];
-    UplinkPayload_t payload = {
-        .buffer = buffer,
-        .maxSize = (uint8_t)sizeof(buffer),
-        .size = 0U};
+    UplinkPayload_t payload;
+    LoRaWANApp_InitPayload(&payload);
     UplinkStatusContext_t ctx;
 
     ctx.adrEnabled = (g_Settings.AdrState == LORAWAN_ADR_ON) ? 1U : 0U;
-    ctx.dataRate = g_Settings.DataRate;
-    ctx.txPower = g_Settings.TxPower;
+    ctx.dataRate = g_LoRaCtx.Settings.DataRate;
+    ctx.txPower = g_LoRaCtx.Settings.TxPower;
     ctx.freqBand = g_Settings.SubBand;
     ctx.rssi = ATCmd_GetLastRSSI();
     ctx.snr = ATCmd_GetLastSNR();
@@ -193,11 +251,8 @@ bool LoRaWANApp_SendStatusUplink(void)
 
 bool LoRaWANApp_SendCalibrationUplink(const uint8_t *calData, uint8_t calSize)
 {
-    uint8_t buffer[64];
-    UplinkPayload_t payload = {
-        .buffer = buffer,
-        .maxSize = (uint8_t)sizeof(buffer),
-        .size = 0U};
+    UplinkPayload_t payload;
+    LoRaWANApp_InitPayload(&payload);
 
     if ((calData == NULL) || (calSize == 0U))
     {
@@ -217,11 +272,8 @@ bool LoRaWANApp_SendDebugUplink(uint8_t fwMajor,
                                 uint8_t fwPatch,
                                 uint8_t loraState)
 {
-    uint8_t buffer[16];
-    UplinkPayload_t payload = {
-        .buffer = buffer,
-        .maxSize = (uint8_t)sizeof(buffer),
-        .size = 0U};
+    UplinkPayload_t payload;
+    LoRaWANApp_InitPayload(&payload);
 
     if (!UplinkEncoder_EncodeDebug(fwMajor, fwMinor, fwPatch, loraState, &payload))
     {
@@ -233,11 +285,8 @@ bool LoRaWANApp_SendDebugUplink(uint8_t fwMajor,
 
 bool LoRaWANApp_SendSensorUplink(void)
 {
-    uint8_t buffer[32];
-    UplinkPayload_t payload = {
-        .buffer = buffer,
-        .maxSize = (uint8_t)sizeof(buffer),
-        .size = 0U};
+    UplinkPayload_t payload;
+    LoRaWANApp_InitPayload(&payload);
 
     if (!Sensor_IsInitialized())
     {
@@ -265,11 +314,8 @@ bool LoRaWANApp_SendSensorUplink(void)
 
 bool LoRaWANApp_SendSensorStatsUplink(void)
 {
-    uint8_t buffer[32];
-    UplinkPayload_t p = {
-        .buffer = buffer,
-        .maxSize = (uint8_t)sizeof(buffer),
-        .size = 0U};
+    UplinkPayload_t p;
+    LoRaWANApp_InitPayload(&p);
 
     UplinkSensorStatsContext_t ctx = {
         .batteryLevel = Sensor_GetBatteryLevel(),
@@ -294,16 +340,13 @@ bool LoRaWANApp_SendSensorStatsUplink(void)
 
 bool LoRaWANApp_SendStatusExUplink(void)
 {
-    uint8_t buffer[32];
-    UplinkPayload_t p = {
-        .buffer = buffer,
-        .maxSize = (uint8_t)sizeof(buffer),
-        .size = 0U};
+    UplinkPayload_t p;
+    LoRaWANApp_InitPayload(&p);
 
     UplinkStatusExContext_t ctx = {
         .adrEnabled = (g_Settings.AdrState == LORAWAN_ADR_ON) ? 1U : 0U,
-        .dataRate = g_Settings.DataRate,
-        .txPower = g_Settings.TxPower,
+        .dataRate = g_LoRaCtx.Settings.DataRate,
+        .txPower = g_LoRaCtx.Settings.TxPower,
         .freqBand = g_Settings.SubBand,
         .rssi = ATCmd_GetLastRSSI(),
         .snr = ATCmd_GetLastSNR(),
@@ -332,11 +375,8 @@ bool LoRaWANApp_SendMacMirrorUplink(void)
         return false;
     }
 
-    uint8_t buffer[32];
-    UplinkPayload_t payload = {
-        .buffer = buffer,
-        .maxSize = (uint8_t)sizeof(buffer),
-        .size = 0U};
+    UplinkPayload_t payload;
+    LoRaWANApp_InitPayload(&payload);
 
     UplinkMacMirrorContext_t ctx;
     memcpy(ctx.payload, frame.buffer, frame.size);
@@ -352,18 +392,15 @@ bool LoRaWANApp_SendMacMirrorUplink(void)
 
 bool LoRaWANApp_SendPowerProfileUplink(void)
 {
-    uint8_t buffer[16];
-    UplinkPayload_t payload = {
-        .buffer = buffer,
-        .maxSize = (uint8_t)sizeof(buffer),
-        .size = 0U};
+    UplinkPayload_t payload;
+    LoRaWANApp_InitPayload(&payload);
 
     UplinkPowerProfileContext_t ctx = {
         .batteryLevel = Sensor_GetBatteryLevel(),
         .batteryMv = BoardGetBatteryLevel(),
         .uptimeSec = HAL_GetTick() / 1000U,
         .sensorPowered = Sensor_IsPowered() ? 1U : 0U,
-        .dataRate = g_Settings.DataRate};
+        .dataRate = g_LoRaCtx.Settings.DataRate};
 
     if (!UplinkEncoder_EncodePowerProfile(&ctx, &payload))
     {
@@ -373,6 +410,11 @@ bool LoRaWANApp_SendPowerProfileUplink(void)
     return LoRaWANApp_SendEncoded(&payload);
 }
 
+uint8_t *LoRaWANApp_GetUplinkBuffer(uint8_t *maxSize)
+{
+    return LoRaWAN_GetTxPayloadBuffer(&g_LoRaCtx, maxSize);
+}
+
 void LoRaWANApp_Process(void)
 {
     LoRaWAN_Process(&g_LoRaCtx);
@@ -383,6 +425,11 @@ LoRaWANAppState_t LoRaWANApp_GetStatus(void)
     return g_AppStatus;
 }
 
+bool LoRaWANApp_IsBusy(void)
+{
+    return LoRaWAN_IsBusy(&g_LoRaCtx);
+}
+
 bool LoRaWANApp_IsJoined(void)
 {
     return g_Session.Joined;
@@ -416,33 +463,83 @@ static void OnTxComplete(LoRaWANStatus_t status)
     ATCmd_UpdateConfirmedStatus(status == LORAWAN_STATUS_SUCCESS ? 1 : 2);
 }
 
+/* Data EEPROM programming stalls the core, so keep it out of a TX/RX cycle
+ * and away from the next timer deadline (RX windows are timers too) */
+static bool StorageWriteGate(uint32_t durationMs)
+{
+    return !LoRaWAN_IsBusy(&g_LoRaCtx) && TimerGetTimeToNextEvent() > (durationMs + STORAGE_WRITE_GUARD_MS);
+}
+
+static uint8_t GetBatteryLevel(void)
+{
+    if (GetBoardPowerSource() == USB_POWER)
+    {
+        return 0U;
+    }
+
+    uint8_t level = BoardGetBatteryLevel();
+    return (level == 0U) ? 255U : level;
+}
+
+/* AT commands and downlinks both change the configuration through storage;
+ * apply it here so the stack never runs on a stale copy. Session keys, DevAddr,
+ * join mode and sub-band take effect at the next boot. */
+static void OnStorageChanged(StorageKey_t key)
+{
+    const StorageData_t *storage = Storage_Get();
+
+    switch (key)
+    {
+    case STORAGE_KEY_DEVEUI:
+        memcpy(g_Session.DevEui, storage->DevEui, sizeof(g_Session.DevEui));
+        break;
+    case STORAGE_KEY_APPEUI:
+        memcpy(g_Session.AppEui, storage->AppEui, sizeof(g_Session.AppEui));
+        break;
+    case STORAGE_KEY_APPKEY:
+        memcpy(g_Session.AppKey, storage->AppKey, sizeof(g_Session.AppKey));
+        break;
+    case STORAGE_KEY_DISABLE_FCNT:
+        g_Session.DisableFrameCounterCheck = (storage->DisableFrameCounterCheck != 0);
+        break;
+    default:
+        /* The stack owns its copy of the settings (ADR and MAC commands
+         * update it), so only the changed field is carried over */
+        if (LoRaWANApp_ApplySetting(&g_Settings, key, storage))
+        {
+            (void)LoRaWANApp_ApplySetting(&g_LoRaCtx.Settings, key, storage);
+        }
+        break;
+    }
+}
+
+/* Also applied when storage already held the value: ADR may have moved the
+ * stack's copy away from it, and no change is reported then */
+static void Downlink_SetSetting(StorageKey_t key, const uint8_t *value, uint32_t size)
+{
+    Storage_Write(key, value, size);
+    (void)LoRaWANApp_ApplySetting(&g_LoRaCtx.Settings, key, Storage_Get());
+}
+
 static void Downlink_SetTdc(uint32_t interval)
 {
-    Storage_Write(STORAGE_KEY_TDC, (const uint8_t *)&interval, sizeof(interval));
-    g_Settings.TxDutyCycleMs = interval;
-    g_LoRaCtx.Settings.TxDutyCycleMs = interval;
+    Downlink_SetSetting(STORAGE_KEY_TDC, (const uint8_t *)&interval, sizeof(interval));
 }
 
 static void Downlink_SetAdr(bool enabled)
 {
     uint8_t adr = enabled ? 1U : 0U;
-    Storage_Write(STORAGE_KEY_ADR, &adr, 1U);
-    g_Settings.AdrState = enabled ? LORAWAN_ADR_ON : LORAWAN_ADR_OFF;
-    g_LoRaCtx.Settings.AdrState = g_Settings.AdrState;
+    Downlink_SetSetting(STORAGE_KEY_ADR, &adr, 1U);
 }
 
 static void Downlink_SetDataRate(uint8_t dr)
 {
-    Storage_Write(STORAGE_KEY_DR, &dr, 1U);
-    g_Settings.DataRate = dr;
-    g_LoRaCtx.Settings.DataRate = dr;
+    Downlink_SetSetting(STORAGE_KEY_DR, &dr, 1U);
 }
 
 static void Downlink_SetTxPower(uint8_t txp)
 {
-    Storage_Write(STORAGE_KEY_TXP, &txp, 1U);
-    g_Settings.TxPower = txp;
-    g_LoRaCtx.Settings.TxPower = txp;
+    Downlink_SetSetting(STORAGE_KEY_TXP, &txp, 1U);
 }
 
 static bool Downlink_ProcessCalibration(const uint8_t *payload, uint8_t size)
@@ -474,9 +571,14 @@ static void OnRxData(const uint8_t *buffer, uint8_t size, uint8_t port, int16_t
         .setTxPower = Downlink_SetTxPower,
         .processCalibration = Downlink_ProcessCalibration};
 
-    if ((port == 0U) && (size > 0U))
+    if (port == 0U)
     {
-        MacMirror_StoreRx(buffer, size);
+        /* Port 0 carries MAC commands, not application opcodes */
+        if (size > 0U)
+        {
+            MacMirror_StoreRx(buffer, size);
+        }
+        return;
     }
 
     Downlink_Handle(buffer, size, &ctx, &actions);
@@ -57,6 +57,14 @@ extern "C"
      */
     bool LoRaWANApp_SendUplink(uint8_t *buffer, uint8_t size, uint8_t port, bool confirmed);
 
+    /*!
+     * \brief Returns the in-place FRMPayload slot of the radio buffer
+     * \param [out] maxSize Maximum payload size that fits the slot (may be NULL)
+     * \retval Buffer that LoRaWANApp_SendUplink accepts without copying, or
+     *         NULL while a confirmed uplink waiting for retransmission owns it
+     */
+    uint8_t *LoRaWANApp_GetUplinkBuffer(uint8_t *maxSize);
+
     /*!
      * \brief Sends a status uplink using the OEM formatter
      */
@@ -111,6 +119,12 @@ extern "C"
      */
     LoRaWANAppState_t LoRaWANApp_GetStatus(void);
 
+    /*!
+     * \brief Checks if the MAC is still busy with the previous uplink
+     * \retval true until TX, RX windows and any retransmissions are over
+     */
+    bool LoRaWANApp_IsBusy(void);
+
     /*!
      * \brief Checks if device is joined to network
      * \retval true if joined
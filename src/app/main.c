@@ -39,7 +39,6 @@ typedef enum
  * ========================================================================== */
 static AppState_t g_AppState = APP_STATE_BOOT;
 static TimerEvent_t g_TxTimer;
-static StorageData_t g_Config;
 static volatile bool g_TxTimerExpired = false;
 
 /* ============================================================================
@@ -53,6 +52,7 @@ extern Uart_t Uart2;
 static void OnTxTimerEvent(void *context);
 static void PrepareUplinkPayload(uint8_t *buffer, uint8_t *size);
 static void ProcessUartInput(void);
+static void OnStorageChanged(StorageKey_t key);
 
 /* ============================================================================
  * MAIN FUNCTION
@@ -91,19 +91,15 @@ int main(void)
     }
     else if (storageStatus == STORAGE_RESTORED_FROM_BACKUP)
     {
-        DEBUG_PRINT("WARNING: Primary storage corrupted, restored from backup\r\n");
+        DEBUG_PRINT("WARNING: Storage slot corrupted, restored from the other slot\r\n");
     }
     else
     {
         DEBUG_PRINT("INFO: Storage initialized successfully\r\n");
     }
 
-    /* Load configuration */
-    StorageStatus_t loadStatus = Storage_Load(&g_Config);
-    if (loadStatus != STORAGE_OK)
-    {
-        DEBUG_PRINT("WARNING: Storage_Load returned status %d, using current config\r\n", loadStatus);
-    }
+    /* Configuration is read in place from the storage cache */
+    const StorageData_t *config = Storage_Get();
 
     /* Initialize calibration module */
     if (!Calibration_Init())
@@ -139,7 +135,10 @@ int main(void)
 
     /* Initialize TX timer */
     TimerInit(&g_TxTimer, OnTxTimerEvent);
-    TimerSetValue(&g_TxTimer, g_Config.TxDutyCycle);
+    TimerSetValue(&g_TxTimer, config->TxDutyCycle);
+    TimerSetSlack(&g_TxTimer, LORAWAN_TDC_SLACK_MS);
+    TimerSetPeriodic(&g_TxTimer, true);
+    (void)Storage_Subscribe(OnStorageChanged);
 
     DEBUG_PRINT("Initialization complete\r\n");
 
@@ -152,14 +151,21 @@ int main(void)
     bool hasValidCredentials = false;
     for (int i = 0; i < 8; i++)
     {
-        if (g_Config.DevEui[i] != 0x00 || g_Config.AppEui[i] != 0x00)
+        if (config->DevEui[i] != 0x00 || config->AppEui[i] != 0x00)
         {
             hasValidCredentials = true;
             break;
         }
     }
 
-    if (hasValidCredentials)
+    if (LoRaWANApp_IsJoined())
+    {
+        /* ABP, or an OTAA session restored from storage */
+        DEBUG_PRINT("Session active, skipping join\r\n");
+        g_AppState = APP_STATE_IDLE;
+        TimerStart(&g_TxTimer);
+    }
+    else if (hasValidCredentials)
     {
         DEBUG_PRINT("Starting OTAA join...\r\n");
         LoRaWANApp_Join();
@@ -194,6 +200,9 @@ int main(void)
         /* Process LoRaWAN events */
         LoRaWANApp_Process();
 
+        /* Compact the storage log when it is getting full */
+        Storage_Process();
+
         /* State machine */
         switch (g_AppState)
         {
@@ -225,7 +234,7 @@ int main(void)
         case APP_STATE_IDLE:
         {
             /* Check if TX timer expired */
-            if (g_TxTimerExpired && LoRaWANApp_IsJoined())
+            if (g_TxTimerExpired && LoRaWANApp_IsJoined() && !LoRaWANApp_IsBusy())
             {
                 g_TxTimerExpired = false;
                 g_AppState = APP_STATE_UPLINK;
@@ -248,15 +257,15 @@ int main(void)
 
         case APP_STATE_UPLINK:
         {
-            /* Prepare and send uplink payload */
-            uint8_t buffer[LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
+            /* Prepare payload in place in the LoRaWAN radio buffer and send */
+            uint8_t *buffer = LoRaWANApp_GetUplinkBuffer(NULL);
             uint8_t size = 0;
 
             PrepareUplinkPayload(buffer, &size);
 
-            bool confirmed = (g_Config.ConfirmedMsg != 0);
+            bool confirmed = (config->ConfirmedMsg != 0);
 
-            if (LoRaWANApp_SendUplink(buffer, size, g_Config.AppPort, confirmed))
+            if (LoRaWANApp_SendUplink(buffer, size, config->AppPort, confirmed))
             {
                 DEBUG_PRINT("Uplink sent (%d bytes)\r\n", size);
             }
@@ -265,9 +274,6 @@ int main(void)
                 DEBUG_PRINT("Uplink failed\r\n");
             }
 
-            /* Restart TX timer */
-            TimerStart(&g_TxTimer);
-
             g_AppState = APP_STATE_IDLE;
             break;
         }
@@ -289,11 +295,9 @@ int main(void)
                 break;
             }
 
-            /* Calculate time until next event */
-            uint32_t sleepTime = g_Config.TxDutyCycle;
-
-            /* Enter STOP mode with RTC wake-up */
-            Power_EnterStopMode(sleepTime);
+            /* Sleep until the next timer deadline (TX, sensor, RX windows,
+             * retries) in the deepest mode the LPM vetoes allow */
+            Power_Idle();
 
             /* After wake-up, return to IDLE */
             g_AppState = APP_STATE_IDLE;
@@ -316,12 +320,27 @@ int main(void)
  * PRIVATE FUNCTIONS
  * ========================================================================== */
 
+/* Periodic: the next uplink is one TDC after this deadline, not after the
+ * uplink goes out */
 static void OnTxTimerEvent(void *context)
 {
-    TimerStop(&g_TxTimer);
     g_TxTimerExpired = true;
 }
 
+/* AT+TDC and the TDC downlink take effect without a reset */
+static void OnStorageChanged(StorageKey_t key)
+{
+    if (key == STORAGE_KEY_TDC)
+    {
+        bool running = TimerIsStarted(&g_TxTimer);
+        TimerSetValue(&g_TxTimer, Storage_Get()->TxDutyCycle);
+        if (running)
+        {
+            TimerStart(&g_TxTimer);
+        }
+    }
+}
+
 static void PrepareUplinkPayload(uint8_t *buffer, uint8_t *size)
 {
     uint8_t index = 0;
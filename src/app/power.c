@@ -4,7 +4,9 @@
  * \brief     Power management implementation
  *
  * \details   Implements ultra-low power modes for STM32L072CZ.
- *            Targets <20µA in STOP mode with RTC wake-up.
+ *            Targets <20µA in STOP mode with RTC wake-up. Power_Idle is the
+ *            tickless idle of the main loop: it sleeps until the next timer
+ *            deadline, and the timers themselves (LPTIM1) wake the MCU.
  */
 #include <stdio.h>
 #include "power.h"
@@ -13,6 +15,7 @@
 #include "board.h"
 #include "radio.h"
 #include "rtc-board.h"
+#include "timer.h"
 #include "lpm-board.h"
 #include "watchdog.h"
 #include "utilities.h"
@@ -23,15 +26,19 @@
  * ========================================================================== */
 static WakeupSource_t g_WakeupSource = WAKEUP_SOURCE_NONE;
 static bool g_PowerInitialized = false;
-static bool g_RtcWakeScheduled = false;
-static uint32_t g_WakeupTimeoutTicks = 0;
+static TimerEvent_t g_IdleWakeTimer;
+static volatile bool g_IdleWakeFired = false;
+static PowerIdleTrace_t g_IdleTrace[POWER_IDLE_TRACE_DEPTH];
+static uint8_t g_IdleTraceNext = 0;
+static uint8_t g_IdleTraceCount = 0;
 
 /* ============================================================================
  * PRIVATE FUNCTION PROTOTYPES
  * ========================================================================== */
 static void Power_EnableRtcClock(void);
-static void Power_ArmWakeupTimer(uint32_t wakeupTimeMs);
-static void Power_DisarmWakeupTimer(void);
+static PowerMode_t Power_SelectIdleMode(uint32_t nextEventMs, uint32_t *plannedMs);
+static void Power_OnIdleWakeTimer(void *context);
+static void Power_TraceIdle(const PowerIdleTrace_t *entry);
 
 /* ============================================================================
  * PUBLIC FUNCTIONS
@@ -47,6 +54,7 @@ bool Power_Init(void)
     /* Enable RTC domain and tick driver */
     Power_EnableRtcClock();
     RtcInit();
+    TimerInit(&g_IdleWakeTimer, Power_OnIdleWakeTimer);
 
     g_PowerInitialized = true;
     DEBUG_PRINT("Power management initialized\r\n");
@@ -54,116 +62,102 @@ bool Power_Init(void)
     return true;
 }
 
-WakeupSource_t Power_EnterStopMode(uint32_t wakeupTimeMs)
+WakeupSource_t Power_Idle(void)
 {
+    PowerIdleTrace_t entry;
+
     if (!g_PowerInitialized)
     {
         return WAKEUP_SOURCE_NONE;
     }
 
-    DEBUG_PRINT("Entering STOP mode for %u ms\r\n", (unsigned int)wakeupTimeMs);
+    /* The wake-up of the previous sleep is not a deadline of its own */
+    TimerStop(&g_IdleWakeTimer);
+    g_IdleWakeFired = false;
 
-    /* Reset wake-up bookkeeping */
     g_WakeupSource = WAKEUP_SOURCE_NONE;
+    entry.TimeMs = TimerGetCurrentTime();
+    entry.NextEventMs = TimerGetTimeToNextEvent();
+    entry.Mode = Power_SelectIdleMode(entry.NextEventMs, &entry.PlannedMs);
+    entry.SleptMs = 0U;
 
-    #if WATCHDOG_ENABLED
-    /* The IWDG continues running in STOP mode!
-     * If requested sleep time exceeds watchdog safe time,
-     * we must wake up periodically to refresh the watchdog.
-     */
-    uint32_t remainingTimeMs = wakeupTimeMs;
-    uint32_t maxStopTimeMs = Watchdog_GetMaxStopTime();
-
-    while (remainingTimeMs > 0U)
+    if (entry.Mode != POWER_MODE_RUN)
     {
-        uint32_t thisSleeepMs = (remainingTimeMs > maxStopTimeMs) ? maxStopTimeMs : remainingTimeMs;
+        /* The next timer wakes the MCU by itself; an earlier wake-up (clock
+         * restore lead, watchdog refresh) needs a timer of its own */
+        if (entry.PlannedMs < entry.NextEventMs)
+        {
+            TimerSetValue(&g_IdleWakeTimer, entry.PlannedMs);
+            TimerStart(&g_IdleWakeTimer);
+        }
 
-        /* Refresh watchdog before entering STOP */
+        #if WATCHDOG_ENABLED
         Watchdog_Refresh();
-
-        /* Disable peripherals to save power */
+        #endif
         Power_DisablePeripherals();
 
-        /* Put radio in sleep mode (only on first iteration) */
-        if (remainingTimeMs == wakeupTimeMs)
+        switch (entry.Mode)
         {
-            Power_RadioSleep();
+        case POWER_MODE_SLEEP:
+            LpmEnterSleepMode();
+            LpmExitSleepMode();
+            break;
+
+        case POWER_MODE_OFF:
+            LpmEnterOffMode();
+            LpmExitOffMode();
+            break;
+
+        default:
+            LpmEnterStopMode();
+            LpmExitStopMode();
+            break;
         }
+        entry.SleptMs = TimerGetCurrentTime() - entry.TimeMs;
 
-        /* Program wake-up timer */
-        Power_ArmWakeupTimer(thisSleeepMs);
-
-        /* Enter STOP mode */
-        LpmEnterStopMode();
-
-        /* Restore clocks after STOP */
-        LpmExitStopMode();
-
-        /* Refresh watchdog immediately after wake-up */
+        Power_EnablePeripherals();
+        #if WATCHDOG_ENABLED
         Watchdog_Refresh();
+        #endif
 
-        /* Evaluate wake-up cause */
-        if (g_RtcWakeScheduled)
+        if (entry.SleptMs >= entry.PlannedMs)
         {
-            uint32_t elapsed = RtcGetTimerElapsedTime();
-            if (elapsed >= g_WakeupTimeoutTicks)
+            g_WakeupSource = WAKEUP_SOURCE_RTC;
+        }
+
+        /* Woken early for the clocks: wait out the lead here, with the
+         * deadline's own timer firing during the wait, instead of going
+         * back to sleep for a few ms through another Power_Idle */
+        if (g_IdleWakeFired && (entry.NextEventMs - entry.PlannedMs) <= POWER_STOP_WAKEUP_MS)
+        {
+            uint32_t remainingMs = TimerGetTimeToNextEvent();
+            if (remainingMs <= POWER_STOP_WAKEUP_MS)
             {
-                g_WakeupSource = WAKEUP_SOURCE_RTC;
+                RtcDelayMs(remainingMs);
             }
         }
-
-        /* Clean up timer state */
-        Power_DisarmWakeupTimer();
-
-        /* Update remaining time */
-        remainingTimeMs = (remainingTimeMs > thisSleeepMs) ? (remainingTimeMs - thisSleeepMs) : 0U;
-
-        /* Re-enable peripherals for next iteration or final wake-up */
-        Power_EnablePeripherals();
     }
 
-    /* Wake radio only at final wake-up */
-    Power_RadioWakeup();
-
-    #else
-    /* Watchdog not enabled, use original single-shot sleep */
-
-    /* Disable peripherals to save power */
-    Power_DisablePeripherals();
-
-    /* Put radio in sleep mode */
-    Power_RadioSleep();
-
-    /* Program wake-up timer if requested */
-    Power_ArmWakeupTimer(wakeupTimeMs);
-
-    /* Enter STOP mode */
-    LpmEnterStopMode();
-
-    /* Restore clocks after STOP */
-    LpmExitStopMode();
+    Power_TraceIdle(&entry);
+    return g_WakeupSource;
+}
 
-    /* Evaluate wake-up cause */
-    if (g_RtcWakeScheduled)
+uint8_t Power_GetIdleTrace(PowerIdleTrace_t *trace, uint8_t maxEntries)
+{
+    if (trace == NULL)
     {
-        uint32_t elapsed = RtcGetTimerElapsedTime();
-        if (elapsed >= g_WakeupTimeoutTicks)
-        {
-            g_WakeupSource = WAKEUP_SOURCE_RTC;
-        }
+        return 0U;
     }
 
-    /* Clean up timer state */
-    Power_DisarmWakeupTimer();
-
-    /* Re-enable peripherals */
-    Power_EnablePeripherals();
-    Power_RadioWakeup();
-    #endif
-
-    DEBUG_PRINT("Woke up from STOP mode (source: %d)\r\n", g_WakeupSource);
+    uint8_t count = (g_IdleTraceCount < maxEntries) ? g_IdleTraceCount : maxEntries;
+    uint8_t index = (uint8_t)((g_IdleTraceNext + POWER_IDLE_TRACE_DEPTH - count) % POWER_IDLE_TRACE_DEPTH);
 
-    return g_WakeupSource;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        trace[i] = g_IdleTrace[index];
+        index = (uint8_t)((index + 1U) % POWER_IDLE_TRACE_DEPTH);
+    }
+    return count;
 }
 
 void Power_EnterSleepMode(void)
@@ -247,27 +241,68 @@ static void Power_EnableRtcClock(void)
     PWR->CR &= ~PWR_CR_DBP;
 }
 
-static void Power_ArmWakeupTimer(uint32_t wakeupTimeMs)
+static PowerMode_t Power_SelectIdleMode(uint32_t nextEventMs, uint32_t *plannedMs)
 {
-    if (wakeupTimeMs == 0U)
+    PowerMode_t mode;
+
+    *plannedMs = nextEventMs;
+    if (nextEventMs == 0U)
+    {
+        return POWER_MODE_RUN;
+    }
+
+    switch (LpmGetMode())
     {
-        g_RtcWakeScheduled = false;
-        g_WakeupTimeoutTicks = 0U;
-        return;
+    case LPM_SLEEP_MODE:
+        mode = POWER_MODE_SLEEP;
+        break;
+
+    case LPM_OFF_MODE:
+        /* Standby drops RAM and the timer queue: only with nothing pending */
+        mode = (nextEventMs == POWER_IDLE_FOREVER) ? POWER_MODE_OFF : POWER_MODE_STOP;
+        break;
+
+    default:
+        mode = POWER_MODE_STOP;
+        break;
     }
 
-    g_WakeupTimeoutTicks = RtcMs2Tick(wakeupTimeMs);
-    RtcSetTimerContext();
-    RtcStartAlarm(g_WakeupTimeoutTicks);
-    g_RtcWakeScheduled = true;
+    /* Entering and leaving STOP costs more than a short STOP saves */
+    if (mode == POWER_MODE_STOP && nextEventMs < POWER_STOP_MIN_MS)
+    {
+        mode = POWER_MODE_SLEEP;
+    }
+
+    /* Leave STOP early enough to have the clocks back for the deadline */
+    if (mode == POWER_MODE_STOP && nextEventMs != POWER_IDLE_FOREVER)
+    {
+        *plannedMs = nextEventMs - POWER_STOP_WAKEUP_MS;
+    }
+
+    #if WATCHDOG_ENABLED
+    /* The IWDG keeps running in SLEEP and STOP */
+    if (mode != POWER_MODE_OFF && *plannedMs > Watchdog_GetMaxStopTime())
+    {
+        *plannedMs = Watchdog_GetMaxStopTime();
+    }
+    #endif
+
+    return mode;
+}
+
+static void Power_OnIdleWakeTimer(void *context)
+{
+    /* Waking up was the point */
+    (void)context;
+    g_IdleWakeFired = true;
 }
 
-static void Power_DisarmWakeupTimer(void)
+static void Power_TraceIdle(const PowerIdleTrace_t *entry)
 {
-    if (g_RtcWakeScheduled)
+    g_IdleTrace[g_IdleTraceNext] = *entry;
+    g_IdleTraceNext = (uint8_t)((g_IdleTraceNext + 1U) % POWER_IDLE_TRACE_DEPTH);
+    if (g_IdleTraceCount < POWER_IDLE_TRACE_DEPTH)
     {
-        RtcStopAlarm();
+        g_IdleTraceCount++;
     }
-    g_RtcWakeScheduled = false;
-    g_WakeupTimeoutTicks = 0U;
 }
@@ -25,6 +25,7 @@ typedef enum
     POWER_MODE_RUN = 0,               /* Normal run mode */
     POWER_MODE_SLEEP,                 /* Sleep mode (CPU stopped, peripherals running) */
     POWER_MODE_STOP,                  /* STOP mode (ultra-low power, RTC running) */
+    POWER_MODE_OFF,                   /* Standby: RAM is lost, wake-up is a reset */
 } PowerMode_t;
 
 /* ============================================================================
@@ -39,6 +40,23 @@ typedef enum
     WAKEUP_SOURCE_BUTTON,             /* Button press */
 } WakeupSource_t;
 
+/* ============================================================================
+ * IDLE TRACE
+ * ========================================================================== */
+#define POWER_IDLE_FOREVER 0xFFFFFFFFUL /* No timer running */
+
+/*!
+ * \brief One Power_Idle decision, as kept in the idle trace
+ */
+typedef struct
+{
+    uint32_t TimeMs;                  /* TimerGetCurrentTime() on entry */
+    uint32_t NextEventMs;             /* Time to the next timer deadline, or POWER_IDLE_FOREVER */
+    uint32_t PlannedMs;               /* Wake-up programmed, or POWER_IDLE_FOREVER */
+    uint32_t SleptMs;                 /* Time actually spent in the mode */
+    PowerMode_t Mode;                 /* Mode entered (RUN: an event was already due) */
+} PowerIdleTrace_t;
+
 /* ============================================================================
  * PUBLIC FUNCTION PROTOTYPES
  * ========================================================================== */
@@ -50,11 +68,27 @@ typedef enum
 bool Power_Init(void);
 
 /*!
- * \brief Enters STOP mode with RTC wake-up
- * \param [in] wakeupTimeMs Wake-up time in milliseconds
- * \retval Wake-up source
+ * \brief Sleeps until the next timer deadline in the deepest mode allowed
+ *
+ * \details Takes the next deadline from the timer queue and the mode from
+ *          the LpmSetStopMode/LpmSetOffMode vetoes. STOP is only used for
+ *          idle periods of at least POWER_STOP_MIN_MS, and ends
+ *          POWER_STOP_WAKEUP_MS before the deadline so that the clocks are
+ *          back when the timer fires; the same call then runs out the rest, so a
+ *          deadline costs one wake-up from STOP and nothing more. Sleeps
+ *          never outlast WATCHDOG_MAX_STOP_TIME_MS. Returns at once if a
+ *          timer is already due.
+ * \retval Wake-up source (WAKEUP_SOURCE_RTC if a timer woke the MCU)
+ */
+WakeupSource_t Power_Idle(void);
+
+/*!
+ * \brief Copies the latest Power_Idle decisions, oldest first
+ * \param [out] trace Destination
+ * \param [in] maxEntries Size of trace
+ * \retval Number of entries copied (at most POWER_IDLE_TRACE_DEPTH)
  */
-WakeupSource_t Power_EnterStopMode(uint32_t wakeupTimeMs);
+uint8_t Power_GetIdleTrace(PowerIdleTrace_t *trace, uint8_t maxEntries);
 
 /*!
  * \brief Enters SLEEP mode
@@ -35,6 +35,10 @@
 #define SENSOR_HOUSEKEEPING_INTERVAL_MS 15000UL
 #endif
 
+#ifndef SENSOR_HOUSEKEEPING_SLACK_MS
+#define SENSOR_HOUSEKEEPING_SLACK_MS SENSOR_WAKEUP_DEFAULT_MS
+#endif
+
 typedef struct
 {
     uint8_t flagStartTimers;
@@ -77,6 +81,7 @@ static SensorContext_t g_SensorCtx = {
 
 static TimerEvent_t g_SensorWakeTimer;
 static TimerEvent_t g_SensorHousekeepingTimer;
+static uint32_t g_SensorWakePeriodMs = 0;
 static bool g_SensorTimersReady = false;
 
 /* ------------------------------------------------------------------------- */
@@ -390,8 +395,11 @@ static void Sensor_InitTimers(void)
 
     TimerInit(&g_SensorWakeTimer, Sensor_OnWakeTimer);
     TimerSetContext(&g_SensorWakeTimer, &g_SensorCtx);
+    TimerSetPeriodic(&g_SensorWakeTimer, true);
     TimerInit(&g_SensorHousekeepingTimer, Sensor_OnHousekeepingTimer);
     TimerSetContext(&g_SensorHousekeepingTimer, &g_SensorCtx);
+    TimerSetValue(&g_SensorHousekeepingTimer, SENSOR_HOUSEKEEPING_INTERVAL_MS);
+    TimerSetSlack(&g_SensorHousekeepingTimer, SENSOR_HOUSEKEEPING_SLACK_MS);
     g_SensorTimersReady = true;
 }
 
@@ -447,27 +455,27 @@ static void Sensor_ArmTimers(uint32_t delayMs)
         delayMs = SENSOR_WAKEUP_DEFAULT_MS;
     }
 
-    TimerStop(&g_SensorWakeTimer);
-    TimerSetValue(&g_SensorWakeTimer, delayMs);
-    TimerStart(&g_SensorWakeTimer);
+    /* The wake timer is periodic: it keeps its cadence from one capture to
+     * the next and is only re-armed for a new interval or after a stop */
+    if (!TimerIsStarted(&g_SensorWakeTimer) || delayMs != g_SensorWakePeriodMs)
+    {
+        TimerSetValue(&g_SensorWakeTimer, delayMs);
+        TimerStart(&g_SensorWakeTimer);
+        g_SensorWakePeriodMs = delayMs;
+    }
 
-    TimerStop(&g_SensorHousekeepingTimer);
-    TimerSetValue(&g_SensorHousekeepingTimer, SENSOR_HOUSEKEEPING_INTERVAL_MS);
-    TimerStart(&g_SensorHousekeepingTimer);
+    /* Housekeeping only runs once captures stop coming: push it back */
+    TimerReset(&g_SensorHousekeepingTimer);
 }
 
 static void Sensor_RequestCaptureCycle(void)
 {
     g_SensorCtx.bridge.flagStartTimers = 0U;
 
-    if (!g_SensorCtx.powered)
-    {
-        g_SensorCtx.bridge.pendingCommand = 1U;
-        return;
-    }
-
-    if (!Sensor_RunHandshake())
+    if (!g_SensorCtx.powered || !Sensor_RunHandshake())
     {
+        /* Retry from housekeeping rather than at the capture cadence */
+        TimerStop(&g_SensorWakeTimer);
         g_SensorCtx.bridge.pendingCommand = 1U;
         return;
     }
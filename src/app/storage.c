@@ -7,15 +7,33 @@
  *            Uses HAL flash functions for write/erase operations.
  */
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include "storage.h"
 #include "config.h"
+#include "crc32.h"
 #include "eeprom-board.h"
 
 /* ============================================================================
  * PRIVATE DEFINITIONS
  * ========================================================================== */
 #define OEM_STORAGE_OFFSET (EEPROM_BASE_ADDRESS + 0x0800U)
+#define STORAGE_FCNT_JOURNAL_SLOTS (STORAGE_FCNT_JOURNAL_SIZE / sizeof(uint32_t))
+#define STORAGE_FCNT_JOURNAL_ERASED 0xFFFFFFFFUL
+
+#define STORAGE_LOG_MAGIC (0x4B564C31UL) /* "KVL1" */
+#define STORAGE_LOG_NONE 0xFFU
+#define STORAGE_LOG_MAX_VALUE sizeof(((StorageData_t *)0)->CalibrationData)
+#define STORAGE_LOG_COMPACT_THRESHOLD ((STORAGE_LOG_SEGMENT_SIZE * 3U) / 4U)
+#define STORAGE_LOG_ALIGN(len) (((len) + 3U) & ~3U)
+#define STORAGE_LOG_RECORD_SIZE(len) (sizeof(StorageLogRecordHeader_t) + STORAGE_LOG_ALIGN(len) + sizeof(uint32_t))
+#define STORAGE_EEPROM_CYCLE_MS 4U /* one byte/word program cycle, with margin */
+#define STORAGE_MAX_LISTENERS 4U
+#define STORAGE_SLOT_NONE 0xFFU
+#define STORAGE_HEADER_V1_SIZE offsetof(StorageHeader_t, Sequence)
+#define STORAGE_DATA_MIN_LENGTH (offsetof(StorageData_t, SessionMac) + sizeof(uint32_t)) /* before SessionMac */
+#define STORAGE_KEY_INFO(key, field, cls, min, max) \
+    [STORAGE_KEY_##key] = {offsetof(StorageData_t, field), sizeof(((StorageData_t *)0)->field), (cls), (min), (max)},
 
 /* ============================================================================
  * PRIVATE TYPES
@@ -54,25 +72,99 @@ typedef struct __attribute__((packed))
     uint8_t Reserved[14];
 } OemStorageLayout_t;
 
+/* Log segment header; the segment with the highest valid Sequence is live */
+typedef struct
+{
+    uint32_t Magic;
+    uint32_t Sequence;
+    uint32_t SequenceInv;
+} StorageLogHeader_t;
+
+/* Record: header, value padded to a word, CRC32 over the segment Sequence,
+ * header and value. Records of an older segment generation fail the CRC, so
+ * a reused segment needs no erase. */
+typedef struct
+{
+    uint8_t Key;
+    uint8_t Length;
+    uint16_t Reserved;
+} StorageLogRecordHeader_t;
+
 /* ============================================================================
  * PRIVATE VARIABLES
  * ========================================================================== */
 static StorageData_t g_StorageCache;
 static bool g_StorageInitialized = false;
 
+/* A/B configuration block: the slot holding the newest valid block and its
+ * sequence number. The next block write goes to the other slot. */
+static uint8_t g_BlockSlot = STORAGE_SLOT_NONE;
+static uint32_t g_BlockSequence = 0;
+
+/* FCnt journal: records are written at g_JournalNext and the slot after the
+ * newest record always holds the erased marker, so a boot scan finds the
+ * head without any sequence numbers. */
+static bool g_JournalScanned = false;
+static bool g_JournalHasRecord = false;
+static uint16_t g_JournalNext = 0;
+static uint32_t g_JournalLast = 0;
+
+static const StorageKeyInfo_t g_StorageKeyInfo[STORAGE_KEY_MAX] = {
+    STORAGE_KEY_LIST(STORAGE_KEY_INFO)
+};
+
+/* Key/value log on top of the block: the block is the base image and each
+ * Storage_Write/Storage_Save appends records for the changed keys only.
+ * g_LogIndex holds the offset of the newest record per key (0 = none). */
+static uint8_t g_LogSegment = STORAGE_LOG_NONE;
+static uint32_t g_LogSequence = 0;
+static uint16_t g_LogWritePos = 0;
+static uint16_t g_LogIndex[STORAGE_KEY_MAX];
+static bool g_LogCompactPending = false;
+static StorageWriteStats_t g_WriteStats;
+
+/* Deferred persistence jobs, run by Storage_Process when the gate allows:
+ * one bit per key whose cached value is newer than its log record, plus a
+ * pending FCntUp journal commit */
+static uint32_t g_PendingKeys = 0;
+static bool g_JournalPending = false;
+static StorageWriteGate_t g_WriteGate = NULL;
+
+static StorageChangeCallback_t g_Listeners[STORAGE_MAX_LISTENERS];
+static uint8_t g_ListenerCount = 0;
+
 /* ============================================================================
  * PRIVATE FUNCTION PROTOTYPES
  * ========================================================================== */
-static uint32_t Storage_CalculateCrc(const StorageData_t *data);
+static uint32_t Storage_CalculateCrc(const StorageData_t *data, const StorageHeader_t *header);
 static bool Storage_FlashErase(uint32_t address, uint32_t size);
 static bool Storage_FlashWrite(uint32_t address, const uint8_t *data, uint32_t size);
 static bool Storage_FlashRead(uint32_t address, uint8_t *data, uint32_t size);
+static void Storage_CountWrite(uint32_t size, uint16_t cycles);
 static void Storage_SetDefaults(StorageData_t *data);
 static bool Storage_BufferIsUniform(const uint8_t *buffer, uint32_t size, uint8_t value);
-static bool Storage_ReadBlock(uint32_t address, StorageData_t *data);
+static uint32_t Storage_SlotAddress(uint8_t slot);
+static bool Storage_ReadBlock(uint8_t slot, StorageData_t *data, uint32_t *sequence, bool *written);
+static StorageStatus_t Storage_LoadBlock(StorageData_t *data);
 static StorageStatus_t Storage_WriteBlockRaw(const StorageData_t *data);
 static StorageStatus_t Storage_MigrateFromOem(StorageData_t *out);
+static void Storage_JournalScan(void);
+static bool Storage_JournalAppend(uint32_t uplink);
+static void Storage_JournalMerge(StorageData_t *data);
+static uint32_t Storage_LogSegmentAddress(uint8_t segment);
+static uint32_t Storage_LogRecordCrc(uint32_t sequence, const uint8_t *record, uint8_t length);
+static void Storage_LogFindLive(void);
+static void Storage_LogReplay(StorageData_t *data);
+static bool Storage_LogWriteRecord(uint8_t segment, uint32_t sequence, uint16_t pos, uint8_t key, const uint8_t *value);
+static bool Storage_LogStartSegment(bool keepRecords);
+static StorageStatus_t Storage_LogAppend(StorageKey_t key);
+static StorageStatus_t Storage_LogWriteKey(StorageKey_t key);
+static bool Storage_JobAllowed(uint32_t cycles, bool force);
+static bool Storage_RunJournalJob(void);
+static StorageStatus_t Storage_RunJobs(bool force);
 static bool Storage_OemLayoutLooksValid(const OemStorageLayout_t *oem);
+static void Storage_NotifyChanged(uint32_t keys);
+static bool Storage_IsScalar(const StorageKeyInfo_t *info);
 
 /* ============================================================================
  * PUBLIC FUNCTIONS
@@ -95,15 +187,15 @@ StorageStatus_t Storage_Init(void)
     }
     else if (status == STORAGE_RESTORED_FROM_BACKUP)
     {
-        /* Backup was valid, primary was corrupted (Phase 2.5) */
+        /* One slot was damaged, the other was loaded */
         g_StorageInitialized = true;
 
-        /* Restore primary from backup - write the loaded data back */
-        StorageStatus_t saveStatus = Storage_Save(&g_StorageCache);
+        /* The next block write always targets the slot not loaded, i.e. the
+         * damaged one: rewrite it now so both slots are valid again */
+        StorageStatus_t saveStatus = Storage_WriteBlockRaw(&g_StorageCache);
         if (saveStatus != STORAGE_OK)
         {
-            /* Failed to restore primary, but we have valid data from backup */
-            /* Continue anyway - next save will attempt to restore primary */
+            /* The loaded slot is untouched, so continue on it */
         }
 
         /* Return backup restore status to inform caller */
@@ -111,14 +203,23 @@ StorageStatus_t Storage_Init(void)
     }
     else
     {
-        /* Both primary and backup failed - initialize with defaults and perform factory reset */
+        /* Neither slot is valid - initialize with defaults and perform factory reset */
         Storage_SetDefaults(&g_StorageCache);
 
         g_StorageInitialized = true;
 
-        /* Attempt to save defaults to both primary and backup */
-        StorageStatus_t saveStatus = Storage_Save(&g_StorageCache);
-        if (saveStatus != STORAGE_OK)
+        /* Save defaults to both slots: the log builds on this block and no
+         * later save rewrites it, so it needs its backup copy now. Log
+         * segments written for the lost block may still be intact: the
+         * fresh segment has to outrank them, or the next boot replays their
+         * records over the defaults. */
+        StorageStatus_t saveStatus = Storage_WriteBlockRaw(&g_StorageCache);
+        if (saveStatus == STORAGE_OK)
+        {
+            saveStatus = Storage_WriteBlockRaw(&g_StorageCache);
+        }
+        Storage_LogFindLive();
+        if (saveStatus != STORAGE_OK || !Storage_LogStartSegment(false))
         {
             g_StorageInitialized = false;
             return STORAGE_ERROR_INIT;
@@ -136,18 +237,22 @@ StorageStatus_t Storage_Load(StorageData_t *data)
         return STORAGE_ERROR_PARAM;
     }
 
-    StorageData_t temp;
-
-    if (Storage_ReadBlock(STORAGE_PRIMARY_ADDRESS, &temp))
+    /* Pending jobs mean the EEPROM may lag behind: the cache is current */
+    if (g_StorageInitialized)
     {
-        memcpy(data, &temp, sizeof(StorageData_t));
+        memcpy(data, &g_StorageCache, sizeof(StorageData_t));
         return STORAGE_OK;
     }
 
-    if (Storage_ReadBlock(STORAGE_BACKUP_ADDRESS, &temp))
+    StorageData_t temp;
+
+    StorageStatus_t blockStatus = Storage_LoadBlock(&temp);
+    if (blockStatus == STORAGE_OK || blockStatus == STORAGE_RESTORED_FROM_BACKUP)
     {
+        Storage_LogReplay(&temp);
+        Storage_JournalMerge(&temp);
         memcpy(data, &temp, sizeof(StorageData_t));
-        return STORAGE_RESTORED_FROM_BACKUP;
+        return blockStatus;
     }
 
     StorageStatus_t migrationStatus = Storage_MigrateFromOem(&temp);
@@ -155,416 +260,157 @@ StorageStatus_t Storage_Load(StorageData_t *data)
     {
         memcpy(data, &temp, sizeof(StorageData_t));
         StorageStatus_t persistStatus = Storage_WriteBlockRaw(&temp);
+        if (persistStatus == STORAGE_OK)
+        {
+            persistStatus = Storage_WriteBlockRaw(&temp);
+        }
         if (persistStatus != STORAGE_OK)
         {
             return persistStatus;
         }
+
+        /* Nothing in the log belongs to the migrated block */
+        Storage_LogFindLive();
+        if (!Storage_LogStartSegment(false))
+        {
+            return STORAGE_ERROR_WRITE;
+        }
         return STORAGE_OK;
     }
 
     return migrationStatus;
 }
 
+const StorageData_t *Storage_Get(void)
+{
+    return g_StorageInitialized ? &g_StorageCache : NULL;
+}
+
+bool Storage_Subscribe(StorageChangeCallback_t callback)
+{
+    if (callback == NULL || g_ListenerCount >= STORAGE_MAX_LISTENERS)
+    {
+        return false;
+    }
+    g_Listeners[g_ListenerCount++] = callback;
+    return true;
+}
+
 StorageStatus_t Storage_Save(const StorageData_t *data)
 {
+    uint32_t changed = 0;
+
     if (data == NULL || !g_StorageInitialized)
     {
         return STORAGE_ERROR_PARAM;
     }
 
-    StorageStatus_t status = Storage_WriteBlockRaw(data);
-    if (status == STORAGE_OK && data != &g_StorageCache)
+    /* Only the keys that differ from the cache reach the EEPROM */
+    for (uint8_t key = 0; key < STORAGE_KEY_MAX; key++)
     {
-        memcpy(&g_StorageCache, data, sizeof(StorageData_t));
+        const StorageKeyInfo_t *info = &g_StorageKeyInfo[key];
+        const uint8_t *value = (const uint8_t *)data + info->Offset;
+        uint8_t *cached = (uint8_t *)&g_StorageCache + info->Offset;
+
+        if (memcmp(cached, value, info->Size) != 0)
+        {
+            memcpy(cached, value, info->Size);
+            (void)Storage_LogAppend((StorageKey_t)key);
+            changed |= (1UL << key);
+        }
     }
 
-    return status;
+    /* Listeners run once the whole configuration is updated */
+    Storage_NotifyChanged(changed);
+    return STORAGE_OK;
 }
 
 StorageStatus_t Storage_Read(StorageKey_t key, uint8_t *buffer, uint32_t size)
 {
-    if (buffer == NULL || !g_StorageInitialized)
+    if (buffer == NULL || !g_StorageInitialized || key >= STORAGE_KEY_MAX)
     {
         return STORAGE_ERROR_PARAM;
     }
 
     /* Read from cache */
-    switch (key)
+    const StorageKeyInfo_t *info = &g_StorageKeyInfo[key];
+    if (size < info->Size)
     {
-    case STORAGE_KEY_DEVEUI:
-        if (size >= 8)
-            memcpy(buffer, g_StorageCache.DevEui, 8);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_APPEUI:
-        if (size >= 8)
-            memcpy(buffer, g_StorageCache.AppEui, 8);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_APPKEY:
-        if (size >= 16)
-            memcpy(buffer, g_StorageCache.AppKey, 16);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_DEVADDR:
-        if (size >= 4)
-            memcpy(buffer, &g_StorageCache.DevAddr, 4);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_NWKSKEY:
-        if (size >= 16)
-            memcpy(buffer, g_StorageCache.NwkSKey, 16);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_APPSKEY:
-        if (size >= 16)
-            memcpy(buffer, g_StorageCache.AppSKey, 16);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_TDC:
-        if (size >= 4)
-            memcpy(buffer, &g_StorageCache.TxDutyCycle, 4);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_ADR:
-        if (size >= 1)
-            *buffer = g_StorageCache.AdrEnabled;
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_DR:
-        if (size >= 1)
-            *buffer = g_StorageCache.DataRate;
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_TXP:
-        if (size >= 1)
-            *buffer = g_StorageCache.TxPower;
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_RX2DR:
-        if (size >= 1)
-            *buffer = g_StorageCache.Rx2DataRate;
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_RX2FQ:
-        if (size >= 4)
-            memcpy(buffer, &g_StorageCache.Rx2Frequency, 4);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_RX1DL:
-        if (size >= 4)
-            memcpy(buffer, &g_StorageCache.Rx1Delay, 4);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_RX2DL:
-        if (size >= 4)
-            memcpy(buffer, &g_StorageCache.Rx2Delay, 4);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_JRX1DL:
-        if (size >= 4)
-            memcpy(buffer, &g_StorageCache.JoinRx1Delay, 4);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_JRX2DL:
-        if (size >= 4)
-            memcpy(buffer, &g_StorageCache.JoinRx2Delay, 4);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_FREQBAND:
-        if (size >= 1)
-            *buffer = g_StorageCache.FreqBand;
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_CLASS:
-        if (size >= 1)
-            *buffer = g_StorageCache.DeviceClass;
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_CONFIRMED:
-        if (size >= 1)
-            *buffer = g_StorageCache.ConfirmedMsg;
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_PORT:
-        if (size >= 1)
-            *buffer = g_StorageCache.AppPort;
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_FCNTUP:
-        if (size >= 4)
-            memcpy(buffer, &g_StorageCache.FrameCounterUp, 4);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_FCNTDOWN:
-        if (size >= 4)
-            memcpy(buffer, &g_StorageCache.FrameCounterDown, 4);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_JOIN_MODE:
-        if (size >= 1)
-            *buffer = g_StorageCache.JoinMode;
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_DISABLE_FCNT:
-        if (size >= 1)
-            *buffer = g_StorageCache.DisableFrameCounterCheck;
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_RETRY:
-        if (size >= 1)
-            *buffer = g_StorageCache.RetryCount;
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_RETRY_DELAY:
-        if (size >= 4)
-            memcpy(buffer, &g_StorageCache.RetryDelay, 4);
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    case STORAGE_KEY_CALIBRATION:
-        if (size >= sizeof(g_StorageCache.CalibrationData))
-        {
-            memcpy(buffer, g_StorageCache.CalibrationData, sizeof(g_StorageCache.CalibrationData));
-        }
-        else
-            return STORAGE_ERROR_PARAM;
-        break;
-
-    default:
         return STORAGE_ERROR_PARAM;
     }
 
+    memcpy(buffer, (const uint8_t *)&g_StorageCache + info->Offset, info->Size);
     return STORAGE_OK;
 }
 
 StorageStatus_t Storage_Write(StorageKey_t key, const uint8_t *buffer, uint32_t size)
 {
-    if (buffer == NULL || !g_StorageInitialized)
+    if (buffer == NULL || !g_StorageInitialized || key >= STORAGE_KEY_MAX)
     {
         return STORAGE_ERROR_PARAM;
     }
 
-    switch (key)
+    /* Fixed-size keys need an exact size; calibration may be written short */
+    const StorageKeyInfo_t *info = &g_StorageKeyInfo[key];
+    if ((key == STORAGE_KEY_CALIBRATION) ? (size > info->Size) : (size != info->Size))
     {
-    case STORAGE_KEY_DEVEUI:
-        if (size != 8)
-            return STORAGE_ERROR_PARAM;
-        memcpy(g_StorageCache.DevEui, buffer, 8);
-        break;
-
-    case STORAGE_KEY_APPEUI:
-        if (size != 8)
-            return STORAGE_ERROR_PARAM;
-        memcpy(g_StorageCache.AppEui, buffer, 8);
-        break;
-
-    case STORAGE_KEY_APPKEY:
-        if (size != 16)
-            return STORAGE_ERROR_PARAM;
-        memcpy(g_StorageCache.AppKey, buffer, 16);
-        break;
-
-    case STORAGE_KEY_DEVADDR:
-        if (size != 4)
-            return STORAGE_ERROR_PARAM;
-        memcpy(&g_StorageCache.DevAddr, buffer, 4);
-        break;
-
-    case STORAGE_KEY_NWKSKEY:
-        if (size != 16)
-            return STORAGE_ERROR_PARAM;
-        memcpy(g_StorageCache.NwkSKey, buffer, 16);
-        break;
-
-    case STORAGE_KEY_APPSKEY:
-        if (size != 16)
-            return STORAGE_ERROR_PARAM;
-        memcpy(g_StorageCache.AppSKey, buffer, 16);
-        break;
-
-    case STORAGE_KEY_TDC:
-        if (size != 4)
-            return STORAGE_ERROR_PARAM;
-        memcpy(&g_StorageCache.TxDutyCycle, buffer, 4);
-        break;
-
-    case STORAGE_KEY_ADR:
-        if (size != 1)
-            return STORAGE_ERROR_PARAM;
-        g_StorageCache.AdrEnabled = *buffer;
-        break;
-
-    case STORAGE_KEY_DR:
-        if (size != 1)
-            return STORAGE_ERROR_PARAM;
-        g_StorageCache.DataRate = *buffer;
-        break;
-
-    case STORAGE_KEY_TXP:
-        if (size != 1)
-            return STORAGE_ERROR_PARAM;
-        g_StorageCache.TxPower = *buffer;
-        break;
-
-    case STORAGE_KEY_RX2DR:
-        if (size != 1)
-            return STORAGE_ERROR_PARAM;
-        g_StorageCache.Rx2DataRate = *buffer;
-        break;
-
-    case STORAGE_KEY_RX2FQ:
-        if (size != 4)
-            return STORAGE_ERROR_PARAM;
-        memcpy(&g_StorageCache.Rx2Frequency, buffer, 4);
-        break;
-
-    case STORAGE_KEY_RX1DL:
-        if (size != 4)
-            return STORAGE_ERROR_PARAM;
-        memcpy(&g_StorageCache.Rx1Delay, buffer, 4);
-        break;
-
-    case STORAGE_KEY_RX2DL:
-        if (size != 4)
-            return STORAGE_ERROR_PARAM;
-        memcpy(&g_StorageCache.Rx2Delay, buffer, 4);
-        break;
-
-    case STORAGE_KEY_JRX1DL:
-        if (size != 4)
-            return STORAGE_ERROR_PARAM;
-        memcpy(&g_StorageCache.JoinRx1Delay, buffer, 4);
-        break;
-
-    case STORAGE_KEY_JRX2DL:
-        if (size != 4)
-            return STORAGE_ERROR_PARAM;
-        memcpy(&g_StorageCache.JoinRx2Delay, buffer, 4);
-        break;
-
-    case STORAGE_KEY_FREQBAND:
-        if (size != 1)
-            return STORAGE_ERROR_PARAM;
-        g_StorageCache.FreqBand = *buffer;
-        break;
-
-    case STORAGE_KEY_CLASS:
-        if (size != 1)
-            return STORAGE_ERROR_PARAM;
-        g_StorageCache.DeviceClass = *buffer;
-        break;
-
-    case STORAGE_KEY_CONFIRMED:
-        if (size != 1)
-            return STORAGE_ERROR_PARAM;
-        g_StorageCache.ConfirmedMsg = *buffer;
-        break;
-
-    case STORAGE_KEY_PORT:
-        if (size != 1)
-            return STORAGE_ERROR_PARAM;
-        g_StorageCache.AppPort = *buffer;
-        break;
-
-    case STORAGE_KEY_FCNTUP:
-        if (size != 4)
-            return STORAGE_ERROR_PARAM;
-        memcpy(&g_StorageCache.FrameCounterUp, buffer, 4);
-        break;
+        return STORAGE_ERROR_PARAM;
+    }
 
-    case STORAGE_KEY_FCNTDOWN:
-        if (size != 4)
+    if (Storage_IsScalar(info))
+    {
+        uint32_t value = 0;
+        memcpy(&value, buffer, size);
+        if (value < info->Min || value > info->Max)
+        {
             return STORAGE_ERROR_PARAM;
-        memcpy(&g_StorageCache.FrameCounterDown, buffer, 4);
-        break;
+        }
+    }
 
-    case STORAGE_KEY_JOIN_MODE:
-        if (size != 1)
-            return STORAGE_ERROR_PARAM;
-        g_StorageCache.JoinMode = *buffer;
-        break;
+    uint8_t *cached = (uint8_t *)&g_StorageCache + info->Offset;
+    if (memcmp(cached, buffer, size) == 0)
+    {
+        return STORAGE_OK;
+    }
 
-    case STORAGE_KEY_DISABLE_FCNT:
-        if (size != 1)
-            return STORAGE_ERROR_PARAM;
-        g_StorageCache.DisableFrameCounterCheck = *buffer;
-        break;
+    memcpy(cached, buffer, size);
+    (void)Storage_LogAppend(key);
+    Storage_NotifyChanged(1UL << key);
+    return STORAGE_OK;
+}
 
-    case STORAGE_KEY_RETRY:
-        if (size != 1)
-            return STORAGE_ERROR_PARAM;
-        g_StorageCache.RetryCount = *buffer;
-        break;
+const StorageKeyInfo_t *Storage_GetKeyInfo(StorageKey_t key)
+{
+    return (key < STORAGE_KEY_MAX) ? &g_StorageKeyInfo[key] : NULL;
+}
 
-    case STORAGE_KEY_RETRY_DELAY:
-        if (size != 4)
-            return STORAGE_ERROR_PARAM;
-        memcpy(&g_StorageCache.RetryDelay, buffer, 4);
-        break;
+StorageStatus_t Storage_GetValue(StorageKey_t key, uint32_t *value)
+{
+    if (value == NULL || !g_StorageInitialized || key >= STORAGE_KEY_MAX || !Storage_IsScalar(&g_StorageKeyInfo[key]))
+    {
+        return STORAGE_ERROR_PARAM;
+    }
 
-    case STORAGE_KEY_CALIBRATION:
-        if (size > sizeof(g_StorageCache.CalibrationData))
-            return STORAGE_ERROR_PARAM;
-        memcpy(g_StorageCache.CalibrationData, buffer, size);
-        break;
+    /* Little-endian target: the low bytes of value are the field */
+    *value = 0;
+    memcpy(value, (const uint8_t *)&g_StorageCache + g_StorageKeyInfo[key].Offset, g_StorageKeyInfo[key].Size);
+    return STORAGE_OK;
+}
 
-    default:
+StorageStatus_t Storage_SetValue(StorageKey_t key, uint32_t value)
+{
+    if (key >= STORAGE_KEY_MAX || !Storage_IsScalar(&g_StorageKeyInfo[key]) ||
+        g_StorageKeyInfo[key].Class == STORAGE_CLASS_COUNTER)
+    {
         return STORAGE_ERROR_PARAM;
     }
 
-    return Storage_Save(&g_StorageCache);
+    /* Range check before truncating to the field size */
+    if (value < g_StorageKeyInfo[key].Min || value > g_StorageKeyInfo[key].Max)
+    {
+        return STORAGE_ERROR_PARAM;
+    }
+    return Storage_Write(key, (const uint8_t *)&value, g_StorageKeyInfo[key].Size);
 }
 
 StorageStatus_t Storage_FactoryReset(void)
@@ -581,13 +427,19 @@ StorageStatus_t Storage_FactoryReset(void)
 
     /* Reinitialize with defaults */
     g_StorageInitialized = false;
+    g_PendingKeys = 0;
+    g_JournalPending = false;
+    g_JournalScanned = false;
+    g_LogSegment = STORAGE_LOG_NONE;
     return Storage_Init();
 }
 
 bool Storage_IsValid(void)
 {
     StorageData_t data;
-    return Storage_ReadBlock(STORAGE_PRIMARY_ADDRESS, &data);
+    uint32_t sequence;
+    bool written;
+    return Storage_ReadBlock(0U, &data, &sequence, &written) || Storage_ReadBlock(1U, &data, &sequence, &written);
 }
 
 StorageStatus_t Storage_UpdateFrameCounters(uint32_t uplink, uint32_t downlink)
@@ -597,9 +449,26 @@ StorageStatus_t Storage_UpdateFrameCounters(uint32_t uplink, uint32_t downlink)
         return STORAGE_ERROR_INIT;
     }
 
+    bool downlinkChanged = (g_StorageCache.FrameCounterDown != downlink);
     g_StorageCache.FrameCounterUp = uplink;
     g_StorageCache.FrameCounterDown = downlink;
-    return Storage_Save(&g_StorageCache);
+
+    /* Downlinks are rare: log FCntDown (and FCntUp with it) as records */
+    if (downlinkChanged)
+    {
+        StorageStatus_t status = Storage_LogAppend(STORAGE_KEY_FCNTUP);
+        return (status == STORAGE_OK) ? Storage_LogAppend(STORAGE_KEY_FCNTDOWN) : status;
+    }
+
+    Storage_JournalScan();
+    if (g_JournalHasRecord && uplink >= g_JournalLast && (uplink - g_JournalLast) < STORAGE_FCNT_COMMIT_INTERVAL)
+    {
+        return STORAGE_OK;
+    }
+
+    /* The commit carries the cached FCntUp, whatever it is by then */
+    g_JournalPending = true;
+    return STORAGE_OK;
 }
 
 StorageStatus_t Storage_UpdateJoinKeys(uint32_t devAddr, const uint8_t *nwkSKey, const uint8_t *appSKey)
@@ -612,7 +481,145 @@ StorageStatus_t Storage_UpdateJoinKeys(uint32_t devAddr, const uint8_t *nwkSKey,
     g_StorageCache.DevAddr = devAddr;
     memcpy(g_StorageCache.NwkSKey, nwkSKey, 16);
     memcpy(g_StorageCache.AppSKey, appSKey, 16);
-    return Storage_Save(&g_StorageCache);
+    g_StorageCache.FrameCounterUp = 0;
+    g_StorageCache.FrameCounterDown = 0;
+    g_StorageCache.SessionValid = 1U;
+
+    /* The journal holds the old session's counters: restart it at zero.
+     * Storage_Process runs the journal first and the keys in enum order, so
+     * SessionValid goes last: a reset part way through leaves the session
+     * invalid (LoRaWANApp_Join cleared it) rather than half updated */
+    g_JournalPending = true;
+    static const StorageKey_t sessionKeys[] = {STORAGE_KEY_DEVADDR, STORAGE_KEY_NWKSKEY, STORAGE_KEY_APPSKEY,
+                                               STORAGE_KEY_FCNTUP, STORAGE_KEY_FCNTDOWN, STORAGE_KEY_SESSION_VALID};
+    for (uint8_t i = 0; i < (sizeof(sessionKeys) / sizeof(sessionKeys[0])); i++)
+    {
+        StorageStatus_t status = Storage_LogAppend(sessionKeys[i]);
+        if (status != STORAGE_OK)
+        {
+            return status;
+        }
+    }
+
+    /* Storage_InvalidateSession already cleared the old session's MAC state
+     * unless the join skipped LoRaWANApp_Join */
+    if (!Storage_BufferIsUniform((const uint8_t *)&g_StorageCache.SessionMac, sizeof(g_StorageCache.SessionMac), 0x00))
+    {
+        memset(&g_StorageCache.SessionMac, 0, sizeof(g_StorageCache.SessionMac));
+        return Storage_LogAppend(STORAGE_KEY_SESSION_MAC);
+    }
+    return STORAGE_OK;
+}
+
+StorageStatus_t Storage_InvalidateSession(void)
+{
+    if (!g_StorageInitialized)
+    {
+        return STORAGE_ERROR_INIT;
+    }
+
+    if (g_StorageCache.SessionValid == 0U)
+    {
+        return STORAGE_OK;
+    }
+
+    /* Written through, not deferred: it has to land before the journal
+     * restarts at zero for the next session. The old MAC state goes after
+     * it, so the join's own SESSION_VALID record never finds it set. */
+    g_StorageCache.SessionValid = 0U;
+    g_PendingKeys &= ~(1UL << STORAGE_KEY_SESSION_VALID);
+    StorageStatus_t status = Storage_LogWriteKey(STORAGE_KEY_SESSION_VALID);
+    if (status != STORAGE_OK || Storage_BufferIsUniform((const uint8_t *)&g_StorageCache.SessionMac,
+                                                        sizeof(g_StorageCache.SessionMac), 0x00))
+    {
+        return status;
+    }
+
+    memset(&g_StorageCache.SessionMac, 0, sizeof(g_StorageCache.SessionMac));
+    g_PendingKeys &= ~(1UL << STORAGE_KEY_SESSION_MAC);
+    return Storage_LogWriteKey(STORAGE_KEY_SESSION_MAC);
+}
+
+StorageStatus_t Storage_UpdateMacState(const StorageMacState_t *state)
+{
+    if (!g_StorageInitialized || state == NULL)
+    {
+        return STORAGE_ERROR_PARAM;
+    }
+
+    if (memcmp(&g_StorageCache.SessionMac, state, sizeof(*state)) == 0)
+    {
+        return STORAGE_OK;
+    }
+
+    memcpy(&g_StorageCache.SessionMac, state, sizeof(*state));
+    return Storage_LogAppend(STORAGE_KEY_SESSION_MAC);
+}
+
+void Storage_SetWriteGate(StorageWriteGate_t gate)
+{
+    g_WriteGate = gate;
+}
+
+void Storage_Process(void)
+{
+    if (g_StorageInitialized)
+    {
+        (void)Storage_RunJobs(false);
+    }
+}
+
+StorageStatus_t Storage_Flush(void)
+{
+    if (!g_StorageInitialized)
+    {
+        return STORAGE_ERROR_INIT;
+    }
+    return Storage_RunJobs(true);
+}
+
+/* FCntUp reaches the EEPROM as a journal record, or as a log record along
+ * with FCntDown after a downlink: both kinds, nothing else */
+StorageStatus_t Storage_FlushFrameCounters(void)
+{
+    static const StorageKey_t counterKeys[] = {STORAGE_KEY_FCNTUP, STORAGE_KEY_FCNTDOWN};
+
+    if (!g_StorageInitialized)
+    {
+        return STORAGE_ERROR_INIT;
+    }
+
+    if (g_JournalPending && !Storage_RunJournalJob())
+    {
+        return STORAGE_ERROR_WRITE;
+    }
+
+    for (uint8_t i = 0; i < (sizeof(counterKeys) / sizeof(counterKeys[0])); i++)
+    {
+        if ((g_PendingKeys & (1UL << counterKeys[i])) == 0U)
+        {
+            continue;
+        }
+        if (Storage_LogWriteKey(counterKeys[i]) != STORAGE_OK)
+        {
+            return STORAGE_ERROR_WRITE;
+        }
+        g_PendingKeys &= ~(1UL << counterKeys[i]);
+    }
+    return STORAGE_OK;
+}
+
+void Storage_GetWriteStats(StorageWriteStats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = g_WriteStats;
+    }
+}
+
+void Storage_ResetWriteStats(void)
+{
+    memset(&g_WriteStats, 0, sizeof(g_WriteStats));
 }
 
 /* ============================================================================
@@ -665,77 +672,130 @@ static bool Storage_BufferIsUniform(const uint8_t *buffer, uint32_t size, uint8_
     return true;
 }
 
-static bool Storage_ReadBlock(uint32_t address, StorageData_t *data)
+static uint32_t Storage_SlotAddress(uint8_t slot)
+{
+    return (slot == 0U) ? STORAGE_SLOT_A_ADDRESS : STORAGE_SLOT_B_ADDRESS;
+}
+
+/* Reads and checks one slot. written reports a slot that carries the magic,
+ * valid or not: a slot that fails the checks with it set is damaged (a save
+ * cut short, or decay) rather than never used. */
+static bool Storage_ReadBlock(uint8_t slot, StorageData_t *data, uint32_t *sequence, bool *written)
 {
     StorageHeader_t header;
+    uint32_t address = Storage_SlotAddress(slot);
+    uint32_t headerSize = sizeof(StorageHeader_t);
 
+    *written = false;
     if (!Storage_FlashRead(address, (uint8_t *)&header, sizeof(StorageHeader_t)))
     {
         return false;
     }
 
-    if ((header.Magic != STORAGE_MAGIC) ||
-        (header.Version != STORAGE_VERSION) ||
-        (header.Length != sizeof(StorageData_t)))
+    if (header.Magic != STORAGE_MAGIC)
     {
         return false;
     }
+    *written = true;
 
-    if (!Storage_FlashRead(address + sizeof(StorageHeader_t), (uint8_t *)data, sizeof(StorageData_t)))
+    /* Version 1 (primary/backup copies) had no sequence: both load as 0 */
+    if (header.Version == 1U)
+    {
+        headerSize = STORAGE_HEADER_V1_SIZE;
+        header.Sequence = 0;
+    }
+    else if (header.Version != STORAGE_VERSION)
     {
         return false;
     }
 
-    return (Storage_CalculateCrc(data) == data->Crc);
-}
+    /* Blocks from before a field was added are shorter: their CRC sits
+     * where the new fields start, and those fields load as zero */
+    if (header.Length < STORAGE_DATA_MIN_LENGTH || header.Length > sizeof(StorageData_t) ||
+        (header.Length % sizeof(uint32_t)) != 0U)
+    {
+        return false;
+    }
 
-static StorageStatus_t Storage_WriteBlockRaw(const StorageData_t *data)
-{
-    if (data == NULL)
+    if (!Storage_FlashRead(address + headerSize, (uint8_t *)data, header.Length))
     {
-        return STORAGE_ERROR_PARAM;
+        return false;
     }
 
-    StorageBlock_t block;
-    StorageBlock_t verifyBlock;
+    uint32_t crcOffset = header.Length - sizeof(uint32_t);
+    uint32_t crc;
+    memcpy(&crc, (const uint8_t *)data + crcOffset, sizeof(crc));
+    memset((uint8_t *)data + crcOffset, 0, offsetof(StorageData_t, Crc) - crcOffset);
+    data->Crc = crc;
 
-    block.Header.Magic = STORAGE_MAGIC;
-    block.Header.Version = STORAGE_VERSION;
-    block.Header.Length = sizeof(StorageData_t);
-    memcpy(&block.Data, data, sizeof(StorageData_t));
-    block.Data.Crc = Storage_CalculateCrc(&block.Data);
+    *sequence = header.Sequence;
+    return (Storage_CalculateCrc(data, &header) == data->Crc);
+}
 
-    if (!Storage_FlashErase(STORAGE_BACKUP_ADDRESS, sizeof(StorageBlock_t)))
-    {
-        return STORAGE_ERROR_ERASE;
-    }
+/* Loads the newest valid slot (slot A on a tie) and records it as the one
+ * the next block write must not touch */
+static StorageStatus_t Storage_LoadBlock(StorageData_t *data)
+{
+    StorageData_t temp;
+    bool damaged = false;
 
-    if (!Storage_FlashWrite(STORAGE_BACKUP_ADDRESS, (const uint8_t *)&block, sizeof(StorageBlock_t)))
-    {
-        return STORAGE_ERROR_WRITE;
-    }
+    g_BlockSlot = STORAGE_SLOT_NONE;
+    g_BlockSequence = 0;
 
-    if (!Storage_FlashRead(STORAGE_BACKUP_ADDRESS, (uint8_t *)&verifyBlock, sizeof(StorageBlock_t)))
+    for (uint8_t slot = 0; slot < 2U; slot++)
     {
-        return STORAGE_ERROR_VERIFY;
+        uint32_t sequence = 0;
+        bool written = false;
+
+        if (!Storage_ReadBlock(slot, &temp, &sequence, &written))
+        {
+            damaged = damaged || written;
+            continue;
+        }
+
+        if (g_BlockSlot == STORAGE_SLOT_NONE || sequence > g_BlockSequence)
+        {
+            memcpy(data, &temp, sizeof(StorageData_t));
+            g_BlockSlot = slot;
+            g_BlockSequence = sequence;
+        }
     }
 
-    if (memcmp(&block, &verifyBlock, sizeof(StorageBlock_t)) != 0)
+    if (g_BlockSlot == STORAGE_SLOT_NONE)
     {
-        return STORAGE_ERROR_VERIFY;
+        return STORAGE_ERROR_CRC;
     }
+    return damaged ? STORAGE_RESTORED_FROM_BACKUP : STORAGE_OK;
+}
 
-    if (!Storage_FlashErase(STORAGE_PRIMARY_ADDRESS, sizeof(StorageBlock_t)))
+static StorageStatus_t Storage_WriteBlockRaw(const StorageData_t *data)
+{
+    if (data == NULL)
     {
-        return STORAGE_ERROR_ERASE;
+        return STORAGE_ERROR_PARAM;
     }
 
-    if (!Storage_FlashWrite(STORAGE_PRIMARY_ADDRESS, (const uint8_t *)&block, sizeof(StorageBlock_t)))
+    StorageBlock_t block;
+    StorageBlock_t verifyBlock;
+
+    /* Only the slot not holding the newest valid block is written: until
+     * the new block verifies, a reset still loads the previous one */
+    uint8_t target = (g_BlockSlot == 0U) ? 1U : 0U;
+    uint32_t address = Storage_SlotAddress(target);
+
+    block.Header.Magic = STORAGE_MAGIC;
+    block.Header.Version = STORAGE_VERSION;
+    block.Header.Length = sizeof(StorageData_t);
+    block.Header.Sequence = g_BlockSequence + 1U;
+    memcpy(&block.Data, data, sizeof(StorageData_t));
+    block.Data.Crc = Storage_CalculateCrc(&block.Data, &block.Header);
+
+    if (!Storage_FlashWrite(address, (const uint8_t *)&block, sizeof(StorageBlock_t)))
     {
         return STORAGE_ERROR_WRITE;
     }
 
-    if (!Storage_FlashRead(STORAGE_PRIMARY_ADDRESS, (uint8_t *)&verifyBlock, sizeof(StorageBlock_t)))
+    if (!Storage_FlashRead(address, (uint8_t *)&verifyBlock, sizeof(StorageBlock_t)))
     {
         return STORAGE_ERROR_VERIFY;
     }
@@ -745,6 +805,8 @@ static StorageStatus_t Storage_WriteBlockRaw(const StorageData_t *data)
         return STORAGE_ERROR_VERIFY;
     }
 
+    g_BlockSlot = target;
+    g_BlockSequence = block.Header.Sequence;
     return STORAGE_OK;
 }
 
@@ -927,23 +989,366 @@ static StorageStatus_t Storage_MigrateFromOem(StorageData_t *out)
     return STORAGE_OK;
 }
 
-static uint32_t Storage_CalculateCrc(const StorageData_t *data)
+static uint32_t Storage_CalculateCrc(const StorageData_t *data, const StorageHeader_t *header)
 {
-    /* Simple CRC32 calculation (use HAL CRC peripheral if available) */
-    uint32_t crc = 0xFFFFFFFF;
-    const uint8_t *ptr = (const uint8_t *)data;
-    uint32_t size = sizeof(StorageData_t) - sizeof(uint32_t); /* Exclude CRC field */
+    /* Everything the block stored but its trailing CRC field, then (version
+     * 2 on) the slot sequence, so a damaged sequence cannot pass for a newer
+     * block */
+    uint32_t crc = Crc32Update(Crc32Init(), data, header->Length - sizeof(uint32_t));
+    if (header->Version != 1U)
+    {
+        crc = Crc32Update(crc, &header->Sequence, sizeof(header->Sequence));
+    }
+    return Crc32Finalize(crc);
+}
 
-    for (uint32_t i = 0; i < size; i++)
+static void Storage_JournalScan(void)
+{
+    if (g_JournalScanned)
+    {
+        return;
+    }
+
+    uint32_t previous = STORAGE_FCNT_JOURNAL_ERASED;
+    uint32_t record;
+    g_JournalScanned = true;
+    g_JournalHasRecord = false;
+    g_JournalNext = 0;
+
+    /* Blank (0x00) or fully erased journal: no marker or nothing before it */
+    for (uint16_t i = 0; i < STORAGE_FCNT_JOURNAL_SLOTS; i++)
     {
-        crc ^= ptr[i];
-        for (int j = 0; j < 8; j++)
+        if (!Storage_FlashRead(STORAGE_FCNT_JOURNAL_ADDRESS + (i * sizeof(uint32_t)), (uint8_t *)&record, sizeof(record)))
         {
-            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+            return;
         }
+
+        if (record == STORAGE_FCNT_JOURNAL_ERASED)
+        {
+            /* Marker in slot 0: the newest record is the last slot */
+            if (i == 0U &&
+                !Storage_FlashRead(STORAGE_FCNT_JOURNAL_ADDRESS + STORAGE_FCNT_JOURNAL_SIZE - sizeof(uint32_t),
+                                   (uint8_t *)&previous, sizeof(previous)))
+            {
+                return;
+            }
+
+            if (previous != STORAGE_FCNT_JOURNAL_ERASED)
+            {
+                g_JournalHasRecord = true;
+                g_JournalLast = previous;
+                g_JournalNext = i;
+            }
+            return;
+        }
+        previous = record;
     }
+}
 
-    return ~crc;
+static bool Storage_JournalAppend(uint32_t uplink)
+{
+    uint16_t next = (uint16_t)((g_JournalNext + 1U) % STORAGE_FCNT_JOURNAL_SLOTS);
+    uint32_t erased = STORAGE_FCNT_JOURNAL_ERASED;
+
+    /* Marker first: a reset in between leaves the previous head intact */
+    if (!Storage_FlashWrite(STORAGE_FCNT_JOURNAL_ADDRESS + (next * sizeof(uint32_t)), (const uint8_t *)&erased, sizeof(erased)) ||
+        !Storage_FlashWrite(STORAGE_FCNT_JOURNAL_ADDRESS + (g_JournalNext * sizeof(uint32_t)), (const uint8_t *)&uplink, sizeof(uplink)))
+    {
+        return false;
+    }
+
+    g_JournalNext = next;
+    g_JournalLast = uplink;
+    g_JournalHasRecord = true;
+    return true;
+}
+
+/* The block's FCntUp is only current as of the last full save */
+static void Storage_JournalMerge(StorageData_t *data)
+{
+    Storage_JournalScan();
+    if (g_JournalHasRecord && g_JournalLast > data->FrameCounterUp)
+    {
+        data->FrameCounterUp = g_JournalLast;
+    }
+}
+
+static uint32_t Storage_LogSegmentAddress(uint8_t segment)
+{
+    return STORAGE_LOG_ADDRESS + ((uint32_t)segment * STORAGE_LOG_SEGMENT_SIZE);
+}
+
+static uint32_t Storage_LogRecordCrc(uint32_t sequence, const uint8_t *record, uint8_t length)
+{
+    uint32_t crc = Crc32Update(Crc32Init(), &sequence, sizeof(sequence));
+    crc = Crc32Update(crc, record, sizeof(StorageLogRecordHeader_t) + length);
+    return Crc32Finalize(crc);
+}
+
+/* Selects the segment with the highest valid header, without reading its
+ * records. A segment started after this outranks everything on the EEPROM. */
+static void Storage_LogFindLive(void)
+{
+    StorageLogHeader_t header;
+
+    g_LogSegment = STORAGE_LOG_NONE;
+    g_LogSequence = 0;
+    g_LogWritePos = 0;
+    memset(g_LogIndex, 0, sizeof(g_LogIndex));
+
+    for (uint8_t segment = 0; segment < 2U; segment++)
+    {
+        if (Storage_FlashRead(Storage_LogSegmentAddress(segment), (uint8_t *)&header, sizeof(header)) &&
+            header.Magic == STORAGE_LOG_MAGIC && header.Sequence == ~header.SequenceInv &&
+            (g_LogSegment == STORAGE_LOG_NONE || header.Sequence > g_LogSequence))
+        {
+            g_LogSegment = segment;
+            g_LogSequence = header.Sequence;
+        }
+    }
+}
+
+/* Finds the live segment, applies its records on top of the block image in
+ * data and rebuilds the index; parsing stops at the first invalid record */
+static void Storage_LogReplay(StorageData_t *data)
+{
+    Storage_LogFindLive();
+    if (g_LogSegment == STORAGE_LOG_NONE)
+    {
+        return;
+    }
+
+    uint32_t base = Storage_LogSegmentAddress(g_LogSegment);
+    uint16_t pos = sizeof(StorageLogHeader_t);
+    uint8_t record[sizeof(StorageLogRecordHeader_t) + STORAGE_LOG_MAX_VALUE];
+    StorageLogRecordHeader_t *recordHeader = (StorageLogRecordHeader_t *)record;
+
+    while ((pos + STORAGE_LOG_RECORD_SIZE(0U)) <= STORAGE_LOG_SEGMENT_SIZE)
+    {
+        uint32_t crc;
+        if (!Storage_FlashRead(base + pos, record, sizeof(StorageLogRecordHeader_t)) ||
+            recordHeader->Key >= STORAGE_KEY_MAX ||
+            recordHeader->Length != g_StorageKeyInfo[recordHeader->Key].Size ||
+            (pos + STORAGE_LOG_RECORD_SIZE(recordHeader->Length)) > STORAGE_LOG_SEGMENT_SIZE)
+        {
+            break;
+        }
+
+        uint16_t crcPos = pos + sizeof(StorageLogRecordHeader_t) + STORAGE_LOG_ALIGN(recordHeader->Length);
+        if (!Storage_FlashRead(base + pos + sizeof(StorageLogRecordHeader_t), &record[sizeof(StorageLogRecordHeader_t)],
+                               recordHeader->Length) ||
+            !Storage_FlashRead(base + crcPos, (uint8_t *)&crc, sizeof(crc)) ||
+            crc != Storage_LogRecordCrc(g_LogSequence, record, recordHeader->Length))
+        {
+            break;
+        }
+
+        memcpy((uint8_t *)data + g_StorageKeyInfo[recordHeader->Key].Offset,
+               &record[sizeof(StorageLogRecordHeader_t)], recordHeader->Length);
+        g_LogIndex[recordHeader->Key] = pos;
+        pos += STORAGE_LOG_RECORD_SIZE(recordHeader->Length);
+    }
+
+    g_LogWritePos = pos;
+}
+
+static bool Storage_LogWriteRecord(uint8_t segment, uint32_t sequence, uint16_t pos, uint8_t key, const uint8_t *value)
+{
+    uint8_t length = g_StorageKeyInfo[key].Size;
+    uint8_t record[STORAGE_LOG_RECORD_SIZE(STORAGE_LOG_MAX_VALUE)];
+    StorageLogRecordHeader_t *recordHeader = (StorageLogRecordHeader_t *)record;
+
+    memset(record, 0xFF, sizeof(record));
+    recordHeader->Key = key;
+    recordHeader->Length = length;
+    recordHeader->Reserved = 0xFFFFU;
+    memcpy(&record[sizeof(StorageLogRecordHeader_t)], value, length);
+
+    uint32_t crc = Storage_LogRecordCrc(sequence, record, length);
+    uint16_t crcPos = sizeof(StorageLogRecordHeader_t) + STORAGE_LOG_ALIGN(length);
+    memcpy(&record[crcPos], &crc, sizeof(crc));
+
+    return Storage_FlashWrite(Storage_LogSegmentAddress(segment) + pos, record, STORAGE_LOG_RECORD_SIZE(length));
+}
+
+/* Opens the other segment under the next sequence number. With keepRecords
+ * the newest record of every key is copied over first (compaction); the new
+ * header is written last, so a reset part way through keeps the old segment
+ * live. */
+static bool Storage_LogStartSegment(bool keepRecords)
+{
+    uint8_t target = (g_LogSegment == 0U) ? 1U : 0U;
+    uint32_t sequence = g_LogSequence + 1U;
+    uint16_t index[STORAGE_KEY_MAX];
+    uint16_t pos = sizeof(StorageLogHeader_t);
+    uint8_t value[STORAGE_LOG_MAX_VALUE];
+
+    memset(index, 0, sizeof(index));
+
+    if (keepRecords && g_LogSegment != STORAGE_LOG_NONE)
+    {
+        uint32_t source = Storage_LogSegmentAddress(g_LogSegment);
+        for (uint8_t key = 0; key < STORAGE_KEY_MAX; key++)
+        {
+            if (g_LogIndex[key] == 0U)
+            {
+                continue;
+            }
+
+            if (!Storage_FlashRead(source + g_LogIndex[key] + sizeof(StorageLogRecordHeader_t), value,
+                                   g_StorageKeyInfo[key].Size) ||
+                !Storage_LogWriteRecord(target, sequence, pos, key, value))
+            {
+                return false;
+            }
+            index[key] = pos;
+            pos += STORAGE_LOG_RECORD_SIZE(g_StorageKeyInfo[key].Size);
+        }
+    }
+
+    StorageLogHeader_t header = {STORAGE_LOG_MAGIC, sequence, ~sequence};
+    if (!Storage_FlashWrite(Storage_LogSegmentAddress(target), (const uint8_t *)&header, sizeof(header)))
+    {
+        return false;
+    }
+
+    g_LogSegment = target;
+    g_LogSequence = sequence;
+    g_LogWritePos = pos;
+    memcpy(g_LogIndex, index, sizeof(g_LogIndex));
+    g_LogCompactPending = false;
+    if (keepRecords)
+    {
+        g_WriteStats.Compactions++;
+    }
+    return true;
+}
+
+/* Queues the cached value of key for Storage_Process */
+static StorageStatus_t Storage_LogAppend(StorageKey_t key)
+{
+    g_PendingKeys |= (1UL << key);
+    return STORAGE_OK;
+}
+
+/* Persists the cached value of key; compacts inline only if the log is full
+ * before Storage_Process got to it */
+static StorageStatus_t Storage_LogWriteKey(StorageKey_t key)
+{
+    uint16_t size = STORAGE_LOG_RECORD_SIZE(g_StorageKeyInfo[key].Size);
+
+    if (g_LogSegment == STORAGE_LOG_NONE)
+    {
+        if (!Storage_LogStartSegment(false))
+        {
+            return STORAGE_ERROR_WRITE;
+        }
+    }
+
+    if ((g_LogWritePos + size) > STORAGE_LOG_SEGMENT_SIZE)
+    {
+        if (!Storage_LogStartSegment(true) || (g_LogWritePos + size) > STORAGE_LOG_SEGMENT_SIZE)
+        {
+            return STORAGE_ERROR_WRITE;
+        }
+    }
+
+    if (!Storage_LogWriteRecord(g_LogSegment, g_LogSequence, g_LogWritePos, key,
+                                (const uint8_t *)&g_StorageCache + g_StorageKeyInfo[key].Offset))
+    {
+        return STORAGE_ERROR_WRITE;
+    }
+
+    g_LogIndex[key] = g_LogWritePos;
+    g_LogWritePos += size;
+    if (g_LogWritePos >= STORAGE_LOG_COMPACT_THRESHOLD)
+    {
+        g_LogCompactPending = true;
+    }
+    return STORAGE_OK;
+}
+
+static bool Storage_IsScalar(const StorageKeyInfo_t *info)
+{
+    return info->Size <= sizeof(uint32_t);
+}
+
+static void Storage_NotifyChanged(uint32_t keys)
+{
+    for (uint8_t key = 0; key < STORAGE_KEY_MAX && keys != 0U; key++)
+    {
+        if ((keys & (1UL << key)) == 0U)
+        {
+            continue;
+        }
+        keys &= ~(1UL << key);
+        for (uint8_t i = 0; i < g_ListenerCount; i++)
+        {
+            g_Listeners[i]((StorageKey_t)key);
+        }
+    }
+}
+
+/* Each job asks the gate for its worst case: every program cycle it could
+ * run, since the EEPROM stalls the core (and so every ISR) while it programs */
+static bool Storage_JobAllowed(uint32_t cycles, bool force)
+{
+    return force || g_WriteGate == NULL || g_WriteGate(cycles * STORAGE_EEPROM_CYCLE_MS);
+}
+
+/* Journal first, then keys in enum order, then compaction. A job that is not
+ * allowed or fails stays pending for the next call. */
+static bool Storage_RunJournalJob(void)
+{
+    Storage_JournalScan();
+    if (!Storage_JournalAppend(g_StorageCache.FrameCounterUp))
+    {
+        return false;
+    }
+    g_JournalPending = false;
+    return true;
+}
+
+static StorageStatus_t Storage_RunJobs(bool force)
+{
+    StorageStatus_t status = STORAGE_OK;
+
+    if (g_JournalPending && Storage_JobAllowed(2U, force) && !Storage_RunJournalJob())
+    {
+        status = STORAGE_ERROR_WRITE;
+    }
+
+    for (uint8_t key = 0; key < STORAGE_KEY_MAX && g_PendingKeys != 0U; key++)
+    {
+        if ((g_PendingKeys & (1UL << key)) == 0U)
+        {
+            continue;
+        }
+
+        /* Stop rather than skip ahead: later keys rely on earlier ones */
+        uint32_t cycles = STORAGE_LOG_RECORD_SIZE(g_StorageKeyInfo[key].Size) / sizeof(uint32_t);
+        if (!Storage_JobAllowed(cycles, force))
+        {
+            break;
+        }
+        if (Storage_LogWriteKey((StorageKey_t)key) != STORAGE_OK)
+        {
+            status = STORAGE_ERROR_WRITE;
+            break;
+        }
+        g_PendingKeys &= ~(1UL << key);
+    }
+
+    if (g_LogCompactPending && g_PendingKeys == 0U &&
+        Storage_JobAllowed((g_LogWritePos + sizeof(StorageLogHeader_t)) / sizeof(uint32_t), force))
+    {
+        if (!Storage_LogStartSegment(true))
+        {
+            status = STORAGE_ERROR_WRITE;
+        }
+    }
+
+    return status;
 }
 
 static bool Storage_FlashErase(uint32_t address, uint32_t size)
@@ -953,14 +1358,19 @@ static bool Storage_FlashErase(uint32_t address, uint32_t size)
     {
         return false;
     }
-    uint8_t blank = 0xFF;
+    uint8_t blank[32];
+    memset(blank, 0xFF, sizeof(blank));
 
-    for (uint32_t i = 0; i < size; i++)
+    /* Data EEPROM has no erase: this only blanks what is not blank yet */
+    while (size > 0U)
     {
-        if (EepromMcuWriteBuffer((uint16_t)(offset + i), &blank, 1) != LMN_STATUS_OK)
+        uint32_t chunk = (size < sizeof(blank)) ? size : sizeof(blank);
+        if (!Storage_FlashWrite(address, blank, chunk))
         {
             return false;
         }
+        address += chunk;
+        size -= chunk;
     }
     return true;
 }
@@ -972,7 +1382,23 @@ static bool Storage_FlashWrite(uint32_t address, const uint8_t *data, uint32_t s
     {
         return false;
     }
-    return (EepromMcuWriteBuffer((uint16_t)offset, (uint8_t *)data, (uint16_t)size) == LMN_STATUS_OK);
+    uint16_t cycles = 0;
+    bool ok = (EepromMcuUpdateBuffer((uint16_t)offset, data, (uint16_t)size, &cycles) == LMN_STATUS_OK);
+    Storage_CountWrite(size, cycles);
+    return ok;
+}
+
+/* EepromMcuUpdateBuffer masks interrupts per cycle only, but the call with
+ * the most program cycles still bounds how long a write holds up its caller */
+static void Storage_CountWrite(uint32_t size, uint16_t cycles)
+{
+    g_WriteStats.BytesWritten += size;
+    g_WriteStats.ProgramCycles += cycles;
+    g_WriteStats.ProgramCalls++;
+    if (cycles > g_WriteStats.MaxCyclesPerCall)
+    {
+        g_WriteStats.MaxCyclesPerCall = cycles;
+    }
 }
 
 static bool Storage_FlashRead(uint32_t address, uint8_t *data, uint32_t size)
@@ -18,13 +18,15 @@ extern "C"
 #include <stdbool.h>
 
 #define STORAGE_MAGIC (0x41595301UL)
-#define STORAGE_VERSION (1U)
+#define STORAGE_VERSION (2U)
 
+    /* Version 1 blocks end the header at Length and are loaded as sequence 0 */
     typedef struct
     {
         uint32_t Magic;
         uint16_t Version;
         uint16_t Length;
+        uint32_t Sequence; /* A/B slot generation, covered by the data CRC */
     } StorageHeader_t;
 
     /* ============================================================================
@@ -43,47 +45,99 @@ extern "C"
         STORAGE_ERROR_VERSION,       /* Version mismatch */
         STORAGE_ERROR_PARAM,         /* Invalid parameter */
         STORAGE_FACTORY_RESET,       /* Factory reset performed (both copies corrupted) */
-        STORAGE_RESTORED_FROM_BACKUP /* Restored from backup copy */
+        STORAGE_RESTORED_FROM_BACKUP /* A damaged slot was found, the other slot was loaded */
     } StorageStatus_t;
 
     /* ============================================================================
      * STORAGE KEY DEFINITIONS
      * ========================================================================== */
+    /* Persistence class of a key: who writes it and how it is persisted */
     typedef enum
     {
-        STORAGE_KEY_DEVEUI = 0,   /* DevEUI (8 bytes) */
-        STORAGE_KEY_APPEUI,       /* AppEUI (8 bytes) */
-        STORAGE_KEY_APPKEY,       /* AppKey (16 bytes) */
-        STORAGE_KEY_DEVADDR,      /* DevAddr (4 bytes) */
-        STORAGE_KEY_NWKSKEY,      /* NwkSKey (16 bytes) */
-        STORAGE_KEY_APPSKEY,      /* AppSKey (16 bytes) */
-        STORAGE_KEY_TDC,          /* Transmission Duty Cycle (4 bytes) */
-        STORAGE_KEY_ADR,          /* ADR Enable (1 byte) */
-        STORAGE_KEY_DR,           /* Data Rate (1 byte) */
-        STORAGE_KEY_TXP,          /* TX Power (1 byte) */
-        STORAGE_KEY_RX2DR,        /* RX2 Data Rate (1 byte) */
-        STORAGE_KEY_RX2FQ,        /* RX2 Frequency (4 bytes) */
-        STORAGE_KEY_RX1DL,        /* RX1 Delay (4 bytes) */
-        STORAGE_KEY_RX2DL,        /* RX2 Delay (4 bytes) */
-        STORAGE_KEY_JRX1DL,       /* Join RX1 Delay (4 bytes) */
-        STORAGE_KEY_JRX2DL,       /* Join RX2 Delay (4 bytes) */
-        STORAGE_KEY_FREQBAND,     /* Frequency Sub-band (1 byte) */
-        STORAGE_KEY_CLASS,        /* Device Class (1 byte) */
-        STORAGE_KEY_CONFIRMED,    /* Confirmed messages (1 byte) */
-        STORAGE_KEY_PORT,         /* Application Port (1 byte) */
-        STORAGE_KEY_FCNTUP,       /* Uplink frame counter (4 bytes) */
-        STORAGE_KEY_FCNTDOWN,     /* Downlink frame counter (4 bytes) */
-        STORAGE_KEY_JOIN_MODE,    /* Join mode: 0=ABP, 1=OTAA (1 byte) */
-        STORAGE_KEY_DISABLE_FCNT, /* Disable frame counter check (1 byte) */
-        STORAGE_KEY_RETRY,        /* Confirmed message retry count (1 byte) */
-        STORAGE_KEY_RETRY_DELAY,  /* Delay between retries (4 bytes) */
-        STORAGE_KEY_CALIBRATION,  /* Calibration Data (variable) */
+        STORAGE_CLASS_IDENTITY = 0, /* Provisioning: EUIs and root key */
+        STORAGE_CLASS_SESSION,      /* Written by the stack on join/ABP */
+        STORAGE_CLASS_COUNTER,      /* Frame counters, FCntUp journalled */
+        STORAGE_CLASS_CONFIG,       /* User configuration (AT, downlinks) */
+    } StorageClass_t;
+
+    /* Every key as X(key, field, class, min, max). The list order is the key
+     * ID stored in log records: add new keys at the end. Session keys are
+     * persisted in ID order with SESSION_VALID last, so a new key must never
+     * be needed to make a session valid: SESSION_MAC is cleared together
+     * with SESSION_VALID before a join and only fills in afterwards. min/max
+     * is the valid range of scalar keys (4 bytes or less); arrays ignore it. */
+#define STORAGE_KEY_LIST(X)                                                                                                 \
+    X(DEVEUI, DevEui, STORAGE_CLASS_IDENTITY, 0U, 0U)                                         /* DevEUI (8 bytes) */        \
+    X(APPEUI, AppEui, STORAGE_CLASS_IDENTITY, 0U, 0U)                                         /* AppEUI (8 bytes) */        \
+    X(APPKEY, AppKey, STORAGE_CLASS_IDENTITY, 0U, 0U)                                         /* AppKey (16 bytes) */       \
+    X(DEVADDR, DevAddr, STORAGE_CLASS_SESSION, 0U, UINT32_MAX)                                /* DevAddr (4 bytes) */       \
+    X(NWKSKEY, NwkSKey, STORAGE_CLASS_SESSION, 0U, 0U)                                        /* NwkSKey (16 bytes) */      \
+    X(APPSKEY, AppSKey, STORAGE_CLASS_SESSION, 0U, 0U)                                        /* AppSKey (16 bytes) */      \
+    X(TDC, TxDutyCycle, STORAGE_CLASS_CONFIG, LORAWAN_TDC_MINIMUM_MS, LORAWAN_TDC_MAXIMUM_MS) /* TX interval, ms */         \
+    X(ADR, AdrEnabled, STORAGE_CLASS_CONFIG, 0U, 1U)                                          /* ADR enable */              \
+    X(DR, DataRate, STORAGE_CLASS_CONFIG, 0U, 5U)                                             /* Data rate */               \
+    X(TXP, TxPower, STORAGE_CLASS_CONFIG, 0U, 10U)                                            /* TX power */                \
+    X(RX2DR, Rx2DataRate, STORAGE_CLASS_CONFIG, 0U, 15U)                                      /* RX2 data rate */           \
+    X(RX2FQ, Rx2Frequency, STORAGE_CLASS_CONFIG, 0U, UINT32_MAX)                              /* RX2 frequency, Hz */       \
+    X(RX1DL, Rx1Delay, STORAGE_CLASS_CONFIG, 0U, UINT32_MAX)                                  /* RX1 delay, ms */           \
+    X(RX2DL, Rx2Delay, STORAGE_CLASS_CONFIG, 0U, UINT32_MAX)                                  /* RX2 delay, ms */           \
+    X(JRX1DL, JoinRx1Delay, STORAGE_CLASS_CONFIG, 0U, UINT32_MAX)                             /* Join RX1 delay, ms */      \
+    X(JRX2DL, JoinRx2Delay, STORAGE_CLASS_CONFIG, 0U, UINT32_MAX)                             /* Join RX2 delay, ms */      \
+    X(FREQBAND, FreqBand, STORAGE_CLASS_CONFIG, 1U, 2U)                                       /* Frequency sub-band */      \
+    X(CLASS, DeviceClass, STORAGE_CLASS_CONFIG, 0U, 2U)                                       /* Device class A-C */        \
+    X(CONFIRMED, ConfirmedMsg, STORAGE_CLASS_CONFIG, 0U, 1U)                                  /* Confirmed uplinks */       \
+    X(PORT, AppPort, STORAGE_CLASS_CONFIG, 1U, 223U)                                          /* Application port */        \
+    X(FCNTUP, FrameCounterUp, STORAGE_CLASS_COUNTER, 0U, UINT32_MAX)                          /* Uplink frame counter */    \
+    X(FCNTDOWN, FrameCounterDown, STORAGE_CLASS_COUNTER, 0U, UINT32_MAX)                      /* Downlink frame counter */  \
+    X(JOIN_MODE, JoinMode, STORAGE_CLASS_CONFIG, 0U, 1U)                                      /* 0=ABP, 1=OTAA */           \
+    X(DISABLE_FCNT, DisableFrameCounterCheck, STORAGE_CLASS_CONFIG, 0U, 1U)                   /* Skip FCnt check */         \
+    X(RETRY, RetryCount, STORAGE_CLASS_CONFIG, 0U, 15U)                                       /* Confirmed retry count */   \
+    X(RETRY_DELAY, RetryDelay, STORAGE_CLASS_CONFIG, 0U, UINT32_MAX)                          /* Retry backoff, ms */       \
+    X(CALIBRATION, CalibrationData, STORAGE_CLASS_CONFIG, 0U, 0U)                             /* Calibration (32 bytes) */  \
+    X(SESSION_VALID, SessionValid, STORAGE_CLASS_SESSION, 0U, 1U)                             /* OTAA session resumable */  \
+    X(SESSION_MAC, SessionMac, STORAGE_CLASS_SESSION, 0U, 0U)                                 /* Negotiated MAC state */
+
+#define STORAGE_KEY_ENUM(key, field, cls, min, max) STORAGE_KEY_##key,
+
+    typedef enum
+    {
+        STORAGE_KEY_LIST(STORAGE_KEY_ENUM)
         STORAGE_KEY_MAX
     } StorageKey_t;
 
+    /* Where a key lives in StorageData_t and what it may hold */
+    typedef struct
+    {
+        uint16_t Offset; /* Byte offset in StorageData_t */
+        uint8_t Size;    /* Bytes; also the size of its log records */
+        uint8_t Class;   /* StorageClass_t */
+        uint32_t Min;    /* Valid range, scalar keys only */
+        uint32_t Max;
+    } StorageKeyInfo_t;
+
+    /* MAC parameters the network set for the current session (LinkADRReq,
+     * RXParamSetupReq, RXTimingSetupReq, DutyCycleReq, ADR backoff). All zero
+     * (Valid = 0) until the first change after a join: the configured values
+     * apply. */
+    typedef struct
+    {
+        uint32_t Rx1DelayMs;
+        uint32_t Rx2DelayMs;
+        uint32_t Rx2Frequency;
+        uint16_t ChannelMask;
+        uint8_t DataRate;
+        uint8_t TxPower;
+        uint8_t Rx1DrOffset;
+        uint8_t Rx2DataRate;
+        uint8_t MaxDutyCycle;
+        uint8_t Valid;
+    } StorageMacState_t;
+
     /* ============================================================================
      * STORAGE DATA STRUCTURE
      * ========================================================================== */
+    /* Fields are only ever added right before Crc: a block written with a
+     * shorter Length loads its prefix and leaves the newer fields zero */
     typedef struct
     {
         uint8_t DevEui[8];
@@ -111,11 +165,32 @@ extern "C"
         uint8_t JoinMode;                 /* Join mode: 0=ABP, 1=OTAA */
         uint8_t DisableFrameCounterCheck; /* Disable frame counter check for testing */
         uint8_t RetryCount;               /* Confirmed message retry count */
+        uint8_t SessionValid;             /* OTAA keys/DevAddr belong to a live join (was padding) */
         uint32_t RetryDelay;              /* Delay between retries (ms) */
         uint8_t CalibrationData[32];      /* Reserved for calibration parameters */
+        StorageMacState_t SessionMac;     /* Negotiated MAC state of the OTAA session */
         uint32_t Crc;                     /* CRC32 for data integrity */
     } StorageData_t;
 
+    /* EEPROM programming done by the storage layer since the last reset of
+     * the counters (see Storage_GetWriteStats) */
+    typedef struct
+    {
+        uint32_t BytesWritten;     /* Bytes handed to the EEPROM driver */
+        uint32_t ProgramCycles;    /* Byte/word program cycles actually run */
+        uint32_t ProgramCalls;     /* EepromMcuUpdateBuffer calls */
+        uint32_t MaxCyclesPerCall; /* Longest call: how long a write blocks its caller */
+        uint32_t Compactions;      /* Key/value log segment compactions */
+    } StorageWriteStats_t;
+
+    /* Asked before each deferred EEPROM job with its worst-case duration;
+     * returns false to keep the job pending (see Storage_SetWriteGate) */
+    typedef bool (*StorageWriteGate_t)(uint32_t durationMs);
+
+    /* Called after Storage_Write/Storage_Save changed the value of key; the
+     * new value is already visible through Storage_Get */
+    typedef void (*StorageChangeCallback_t)(StorageKey_t key);
+
     /* ============================================================================
      * PUBLIC FUNCTION PROTOTYPES
      * ========================================================================== */
@@ -124,13 +199,16 @@ extern "C"
      * \brief Initializes the storage system
      * \retval STORAGE_OK if successful
      * \retval STORAGE_ERROR_INIT if initialization failed
-     * \retval STORAGE_FACTORY_RESET if both primary and backup invalid (factory reset applied)
-     * \retval STORAGE_RESTORED_FROM_BACKUP if primary corrupted, restored from backup
+     * \retval STORAGE_FACTORY_RESET if neither slot is valid (factory reset applied)
+     * \retval STORAGE_RESTORED_FROM_BACKUP if a slot was damaged (e.g. a save cut
+     *         short); the other slot was loaded and the damaged one rewritten
      */
     StorageStatus_t Storage_Init(void);
 
     /*!
      * \brief Loads configuration from non-volatile storage
+     * \details Once initialized this is the cached configuration, including
+     *          changes still waiting for Storage_Process
      * \param [out] data Pointer to storage data structure
      * \retval STORAGE_OK if data loaded successfully
      * \retval STORAGE_ERROR_PARAM if data pointer is NULL
@@ -139,8 +217,28 @@ extern "C"
      */
     StorageStatus_t Storage_Load(StorageData_t *data);
 
+    /*!
+     * \brief Read-only view of the cached configuration
+     * \details Reads in place, without the copy Storage_Load makes; the view
+     *          tracks every later Storage_Write/Storage_Save
+     * \retval Pointer to the configuration, NULL before Storage_Init succeeded
+     */
+    const StorageData_t *Storage_Get(void);
+
+    /*!
+     * \brief Registers a callback for configuration changes
+     * \details Frame counter and join key updates from the LoRaWAN stack are
+     *          not reported; the stack already holds those values
+     * \param [in] callback Called once per changed key
+     * \retval true if registered, false if all listener slots are taken
+     */
+    bool Storage_Subscribe(StorageChangeCallback_t callback);
+
     /*!
      * \brief Saves configuration to non-volatile storage
+     * \details Queues a key/value log record for each field that differs
+     *          from the cached configuration; unchanged fields cost nothing.
+     *          Storage_Process writes the records.
      * \param [in] data Pointer to storage data structure
      * \retval STORAGE_OK if data saved successfully
      * \retval STORAGE_ERROR_PARAM if data pointer is NULL
@@ -162,6 +260,7 @@ extern "C"
 
     /*!
      * \brief Writes a specific key to storage
+     * \details Scalar keys are checked against their valid range
      * \param [in] key Storage key identifier
      * \param [in] buffer Buffer containing data to write
      * \param [in] size Size of data
@@ -171,6 +270,32 @@ extern "C"
      */
     StorageStatus_t Storage_Write(StorageKey_t key, const uint8_t *buffer, uint32_t size);
 
+    /*!
+     * \brief Describes a key: location, size, class and valid range
+     * \param [in] key Storage key identifier
+     * \retval Descriptor, NULL for an unknown key
+     */
+    const StorageKeyInfo_t *Storage_GetKeyInfo(StorageKey_t key);
+
+    /*!
+     * \brief Reads a scalar key (4 bytes or less) as a number
+     * \param [in] key Storage key identifier
+     * \param [out] value Current value
+     * \retval STORAGE_OK if read successful
+     * \retval STORAGE_ERROR_PARAM if the key is unknown or not a scalar
+     */
+    StorageStatus_t Storage_GetValue(StorageKey_t key, uint32_t *value);
+
+    /*!
+     * \brief Writes a scalar configuration key from a number
+     * \details Frame counters are refused: only the stack updates them
+     * \param [in] key Storage key identifier
+     * \param [in] value New value, checked against the key's range
+     * \retval STORAGE_OK if written
+     * \retval STORAGE_ERROR_PARAM if the key or value is not accepted
+     */
+    StorageStatus_t Storage_SetValue(StorageKey_t key, uint32_t value);
+
     /*!
      * \brief Performs factory reset (erases all stored data)
      * \retval STORAGE_OK if reset successful
@@ -194,6 +319,8 @@ extern "C"
 
     /*!
      * \brief Updates join session keys after OTAA join
+     * \details Also zeroes the frame counters and marks the session valid so
+     *          it can be resumed after a reset
      * \param [in] devAddr Device address
      * \param [in] nwkSKey Network session key (16 bytes)
      * \param [in] appSKey Application session key (16 bytes)
@@ -201,6 +328,67 @@ extern "C"
      */
     StorageStatus_t Storage_UpdateJoinKeys(uint32_t devAddr, const uint8_t *nwkSKey, const uint8_t *appSKey);
 
+    /*!
+     * \brief Marks the stored OTAA session as stale so the next boot rejoins
+     * \details Also clears the negotiated MAC state of the old session
+     * \retval STORAGE_OK if updated successfully (or already stale)
+     */
+    StorageStatus_t Storage_InvalidateSession(void);
+
+    /*!
+     * \brief Updates the MAC state negotiated for the current session
+     * \details Queued like a configuration write, and only if it changed;
+     *          listeners are not notified
+     * \param [in] state MAC parameters as the stack now uses them
+     * \retval STORAGE_OK if updated successfully
+     */
+    StorageStatus_t Storage_UpdateMacState(const StorageMacState_t *state);
+
+    /*!
+     * \brief Runs the deferred EEPROM jobs the write gate allows
+     * \details Call from the main loop. Commits the FCnt journal, writes the
+     *          queued key/value records and compacts the log once it passes
+     *          its fill threshold; writes only ever compact inline when the
+     *          log is completely full
+     */
+    void Storage_Process(void);
+
+    /*!
+     * \brief Runs every deferred EEPROM job now, ignoring the write gate
+     * \details For callers that must have all data persisted, e.g. before a
+     *          reset
+     * \retval STORAGE_OK if nothing is left pending
+     * \retval STORAGE_ERROR_WRITE if a job failed (it stays pending)
+     */
+    StorageStatus_t Storage_Flush(void);
+
+    /*!
+     * \brief Runs the deferred FCnt jobs now, ignoring the write gate
+     * \details The journal commit and any pending FCntUp/FCntDown records
+     *          only: what has to land before a frame goes out, without the
+     *          config records and compaction that Storage_Flush would add
+     * \retval STORAGE_OK if no FCnt job is left pending
+     * \retval STORAGE_ERROR_WRITE if a job failed (it stays pending)
+     */
+    StorageStatus_t Storage_FlushFrameCounters(void);
+
+    /*!
+     * \brief Installs the gate Storage_Process asks before each job
+     * \param [in] gate Callback, or NULL to run jobs unconditionally
+     */
+    void Storage_SetWriteGate(StorageWriteGate_t gate);
+
+    /*!
+     * \brief Reads the EEPROM write counters
+     * \param [out] stats Counters since boot or the last Storage_ResetWriteStats
+     */
+    void Storage_GetWriteStats(StorageWriteStats_t *stats);
+
+    /*!
+     * \brief Clears the EEPROM write counters
+     */
+    void Storage_ResetWriteStats(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include <string.h>
 #include "stm32l0xx.h"
 #include "utilities.h"
@@ -34,38 +35,127 @@ static void FlashWaitReady(void)
     }
 }
 
-LmnStatus_t EepromMcuWriteBuffer(uint16_t addr, uint8_t *buffer, uint16_t size)
+/* Waits for the program cycle just started and clears any error it raised */
+static bool FlashProgramDone(void)
+{
+    FlashWaitReady();
+    if ((FLASH->SR & (FLASH_SR_WRPERR | FLASH_SR_EOP | FLASH_SR_SIZERR)) != 0U)
+    {
+        FLASH->SR = FLASH_SR_WRPERR | FLASH_SR_EOP | FLASH_SR_SIZERR;
+        return false;
+    }
+    return true;
+}
+
+/* Longest stretch with interrupts masked by a program cycle, in SysTick clocks */
+static uint32_t g_EepromMaxIrqOffCycles = 0;
+
+/* Programs one byte or aligned word. Only the cycle itself runs with
+ * interrupts masked; the wait for a previous cycle does not. The masked time
+ * is metered on SysTick, counting reloads through COUNTFLAG since a cycle
+ * outlasts the 1 ms tick. */
+static bool EepromMcuProgramUnit(uint32_t address, const uint8_t *data, uint32_t width)
+{
+    uint32_t word = 0;
+    uint32_t reloads = 0;
+    bool ok;
+
+    memcpy(&word, data, width);
+    FlashWaitReady();
+
+    CRITICAL_SECTION_BEGIN();
+    uint32_t start = SysTick->VAL;
+    (void)SysTick->CTRL;
+    if (width == 4U)
+    {
+        *(__IO uint32_t *)address = word;
+    }
+    else
+    {
+        *(__IO uint8_t *)address = (uint8_t)word;
+    }
+    while ((FLASH->SR & FLASH_SR_BSY) != 0U)
+    {
+        if ((SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk) != 0U)
+        {
+            reloads++;
+        }
+    }
+    uint32_t stop = SysTick->VAL;
+    ok = FlashProgramDone();
+    CRITICAL_SECTION_END();
+
+    uint32_t elapsed = (reloads * (SysTick->LOAD + 1U)) + start - stop;
+    if (elapsed > g_EepromMaxIrqOffCycles)
+    {
+        g_EepromMaxIrqOffCycles = elapsed;
+    }
+    return ok;
+}
+
+/* Data EEPROM needs no erase and programs a byte or an aligned word in the
+ * same ~3.2 ms cycle, so aligned spans go out a word at a time. With
+ * skipUnchanged, words/bytes that already hold the value are not touched. */
+static LmnStatus_t EepromMcuProgramBuffer(uint16_t addr, const uint8_t *buffer, uint16_t size, bool skipUnchanged,
+                                          uint16_t *programmed)
 {
+    uint16_t cycles = 0;
+
+    if (programmed != NULL)
+    {
+        *programmed = 0;
+    }
+
     if (buffer == NULL || size == 0U)
     {
         return LMN_STATUS_ERROR;
     }
 
-    if ((DATA_EEPROM_BASE + addr) >= DATA_EEPROM_BANK2_END)
+    if ((DATA_EEPROM_BASE + addr + size - 1U) > DATA_EEPROM_BANK2_END)
     {
         return LMN_STATUS_ERROR;
     }
 
+    uint32_t address = DATA_EEPROM_BASE + addr;
+    uint32_t end = address + size;
+    LmnStatus_t status = LMN_STATUS_OK;
+
     FlashUnlock();
-    CRITICAL_SECTION_BEGIN();
 
-    for (uint16_t i = 0; i < size; i++)
+    while (address < end)
     {
-        FlashWaitReady();
-        *(__IO uint8_t *)(DATA_EEPROM_BASE + addr + i) = buffer[i];
-        FlashWaitReady();
-        if ((FLASH->SR & (FLASH_SR_WRPERR | FLASH_SR_EOP | FLASH_SR_SIZERR)) != 0U)
+        uint32_t width = (((address & 3U) == 0U) && ((end - address) >= 4U)) ? 4U : 1U;
+
+        if (!skipUnchanged || memcmp((const void *)address, buffer, width) != 0)
         {
-            FLASH->SR = FLASH_SR_WRPERR | FLASH_SR_EOP | FLASH_SR_SIZERR;
-            CRITICAL_SECTION_END();
-            FlashLock();
-            return LMN_STATUS_ERROR;
+            cycles++;
+            if (!EepromMcuProgramUnit(address, buffer, width))
+            {
+                status = LMN_STATUS_ERROR;
+                break;
+            }
         }
+        address += width;
+        buffer += width;
     }
 
-    CRITICAL_SECTION_END();
     FlashLock();
-    return LMN_STATUS_OK;
+
+    if (programmed != NULL)
+    {
+        *programmed = cycles;
+    }
+    return status;
+}
+
+LmnStatus_t EepromMcuWriteBuffer(uint16_t addr, uint8_t *buffer, uint16_t size)
+{
+    return EepromMcuProgramBuffer(addr, buffer, size, false, NULL);
+}
+
+LmnStatus_t EepromMcuUpdateBuffer(uint16_t addr, const uint8_t *buffer, uint16_t size, uint16_t *programmed)
+{
+    return EepromMcuProgramBuffer(addr, buffer, size, true, programmed);
 }
 
 LmnStatus_t EepromMcuReadBuffer(uint16_t addr, uint8_t *buffer, uint16_t size)
@@ -75,7 +165,7 @@ LmnStatus_t EepromMcuReadBuffer(uint16_t addr, uint8_t *buffer, uint16_t size)
         return LMN_STATUS_ERROR;
     }
 
-    if ((DATA_EEPROM_BASE + addr) >= DATA_EEPROM_BANK2_END)
+    if ((DATA_EEPROM_BASE + addr + size - 1U) > DATA_EEPROM_BANK2_END)
     {
         return LMN_STATUS_ERROR;
     }
@@ -84,6 +174,16 @@ LmnStatus_t EepromMcuReadBuffer(uint16_t addr, uint8_t *buffer, uint16_t size)
     return LMN_STATUS_OK;
 }
 
+uint32_t EepromMcuGetMaxIrqOffUs(void)
+{
+    return g_EepromMaxIrqOffCycles / (SystemCoreClock / 1000000U);
+}
+
+void EepromMcuResetIrqStats(void)
+{
+    g_EepromMaxIrqOffCycles = 0;
+}
+
 void EepromMcuSetDeviceAddr(uint8_t addr)
 {
     (void)addr;
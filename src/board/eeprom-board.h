@@ -36,6 +36,19 @@ typedef enum
  */
 LmnStatus_t EepromMcuWriteBuffer(uint16_t addr, uint8_t *buffer, uint16_t size);
 
+/*!
+ * \brief Writes data to EEPROM, skipping words that already hold the value
+ *
+ * \param [in]  addr       EEPROM address offset
+ * \param [in]  buffer     Pointer to data buffer to write
+ * \param [in]  size       Number of bytes to write
+ * \param [out] programmed Program cycles actually run (may be NULL)
+ *
+ * \retval LMN_STATUS_OK      Write successful
+ * \retval LMN_STATUS_ERROR   Write failed
+ */
+LmnStatus_t EepromMcuUpdateBuffer(uint16_t addr, const uint8_t *buffer, uint16_t size, uint16_t *programmed);
+
 /*!
  * \brief Reads data from EEPROM (Flash emulation)
  *
@@ -48,6 +61,21 @@ LmnStatus_t EepromMcuWriteBuffer(uint16_t addr, uint8_t *buffer, uint16_t size);
  */
 LmnStatus_t EepromMcuReadBuffer(uint16_t addr, uint8_t *buffer, uint16_t size);
 
+/*!
+ * \brief Longest time interrupts were masked by an EEPROM program cycle
+ *
+ * \details Each byte/word is programmed in its own critical section, so
+ *          this is one cycle (~3.2 ms), not a whole buffer.
+ *
+ * \retval Microseconds since boot or the last EepromMcuResetIrqStats()
+ */
+uint32_t EepromMcuGetMaxIrqOffUs(void);
+
+/*!
+ * \brief Clears the maximum reported by EepromMcuGetMaxIrqOffUs()
+ */
+void EepromMcuResetIrqStats(void);
+
 /*!
  * \brief Sets the EEPROM device address (placeholder)
  *
@@ -1,8 +1,24 @@
+/*!
+ * \file      rtc-board.c
+ *
+ * \brief     Time base and alarm behind timer.c
+ *
+ * \details   Default back end: LPTIM1 clocked by the 32.768 kHz LSE through
+ *            its /32 prescaler (1024 ticks per second), free running over its
+ *            16-bit range and extended in software on each autoreload match,
+ *            once every 64 s. The alarm is the LPTIM compare. LPTIM1 keeps
+ *            counting in STOP mode and wakes the MCU through EXTI line 29, so
+ *            timers keep running while the MCU sleeps.
+ *
+ *            RTC_BACKEND_SYSTICK (make RTC_IMPL=systick) keeps the old 1 ms
+ *            SysTick time base as a debug fallback. SysTick stops in STOP
+ *            mode, so timers stall there.
+ */
 #include <stdbool.h>
 #include "stm32l0xx.h"
+#include "utilities.h"
 #include "rtc-board.h"
 
-static volatile uint32_t RtcTick = 0;
 static uint32_t RtcTimerContext = 0;
 static volatile uint32_t AlarmTick = 0;
 static volatile bool AlarmEnabled = false;
@@ -10,6 +26,10 @@ static bool RtcInitialized = false;
 static uint32_t Backup0 = 0;
 static uint32_t Backup1 = 0;
 
+#if defined(RTC_BACKEND_SYSTICK)
+
+static volatile uint32_t RtcTick = 0;
+
 void RtcInit(void)
 {
     if (!RtcInitialized)
@@ -19,17 +39,6 @@ void RtcInit(void)
     }
 }
 
-uint32_t RtcSetTimerContext(void)
-{
-    RtcTimerContext = RtcGetTimerValue();
-    return RtcTimerContext;
-}
-
-uint32_t RtcGetTimerContext(void)
-{
-    return RtcTimerContext;
-}
-
 uint32_t RtcGetMinimumTimeout(void)
 {
     return 1U;
@@ -45,49 +54,358 @@ uint32_t RtcTick2Ms(uint32_t tick)
     return tick;
 }
 
-void RtcDelayMs(uint32_t delay)
+void RtcSetAlarm(uint32_t timeout)
 {
-    uint32_t start = RtcGetTimerValue();
-    while ((RtcGetTimerValue() - start) < delay)
+    AlarmTick = RtcTimerContext + timeout;
+    AlarmEnabled = true;
+}
+
+void RtcStopAlarm(void)
+{
+    AlarmEnabled = false;
+}
+
+uint32_t RtcGetTimerValue(void)
+{
+    return RtcTick;
+}
+
+uint32_t RtcGetCalendarTime(uint16_t *milliseconds)
+{
+    uint32_t ticks = RtcGetTimerValue();
+    if (milliseconds != NULL)
     {
-        __NOP();
+        *milliseconds = (uint16_t)(ticks % 1000U);
+    }
+    return ticks / 1000U;
+}
+
+void RtcOnSysTick(void)
+{
+    RtcTick++;
+    if (AlarmEnabled)
+    {
+        if ((int32_t)(RtcTick - AlarmTick) >= 0)
+        {
+            AlarmEnabled = false;
+            TimerIrqHandler();
+        }
     }
 }
 
+void RtcOnLptimIrq(void)
+{
+}
+
+#else /* LPTIM1 on LSE */
+
+/* LSE / 32: a 0.98 ms tick, as fine as the 1 ms timers need, and the
+ * 16-bit counter only wraps every 64 s instead of every 2 s */
+#define RTC_LPTIM_PRESC_DIV32 (LPTIM_CFGR_PRESC_2 | LPTIM_CFGR_PRESC_0)
+#define RTC_LPTIM_ARR 0xFFFFU
+#define RTC_LPTIM_PERIOD (RTC_LPTIM_ARR + 1U)
+
+/* Compare value while no alarm is armed: one tick before the autoreload
+ * match, so the idle compare interrupt lands next to the overflow one */
+#define RTC_LPTIM_CMP_IDLE (RTC_LPTIM_ARR - 1U)
+
+/* A compare write reaches the LSE domain up to 3 LSE clocks later, which is
+ * within one prescaled tick; timer.c keeps alarms at least
+ * RTC_ALARM_MIN_TICKS out so the compare always makes it */
+#define RTC_LPTIM_CMP_SYNC_TICKS 1U
+#define RTC_ALARM_MIN_TICKS 3U
+
+/* Flags are cleared through ICR; the host model (tools/sim_rtc.c) hooks this */
+#ifndef RTC_LPTIM_CLEAR_FLAGS
+#define RTC_LPTIM_CLEAR_FLAGS(flags) (LPTIM1->ICR = (flags))
+#endif
+
+/* Upper bits of the tick count: autoreload matches seen by the interrupt.
+ * The count is (RtcOverflows << 16) + ((CNT + 1) & 0xFFFF), which steps to
+ * a new period exactly when ARRM is raised (CNT == ARR), so a pending ARRM
+ * means "add one period" whatever CNT the interrupt finds. */
+static volatile uint32_t RtcOverflows = 0;
+
+/* The compare holds the alarm. It is loaded once the alarm is less than two
+ * periods away; matches in the period before are filtered out by time. */
+static volatile bool AlarmArmed = false;
+static bool CompareWritePending = false;
+
+static void RtcStartLse(void);
+static uint16_t RtcReadCounter(void);
+static void RtcGetTicks(uint32_t *high, uint32_t *low);
+static void RtcWriteCompare(uint16_t value);
+static void RtcArmAlarm(void);
+
+void RtcInit(void)
+{
+    if (RtcInitialized)
+    {
+        return;
+    }
+
+    RtcStartLse();
+
+    /* LPTIM1 kernel clock = LSE (LPTIM1SEL = 11) */
+    RCC->APB1ENR |= RCC_APB1ENR_LPTIM1EN;
+    RCC->CCIPR |= RCC_CCIPR_LPTIM1SEL;
+
+    /* IER and CFGR are only writable while the timer is disabled */
+    LPTIM1->CR = 0U;
+    LPTIM1->CFGR = RTC_LPTIM_PRESC_DIV32;
+    LPTIM1->IER = LPTIM_IER_ARRMIE | LPTIM_IER_CMPMIE;
+    LPTIM1->CR = LPTIM_CR_ENABLE;
+
+    LPTIM1->ARR = RTC_LPTIM_ARR;
+    while ((LPTIM1->ISR & LPTIM_ISR_ARROK) == 0U)
+    {
+    }
+    RTC_LPTIM_CLEAR_FLAGS(LPTIM_ICR_ARROKCF);
+    RtcWriteCompare(RTC_LPTIM_CMP_IDLE);
+    LPTIM1->CR |= LPTIM_CR_CNTSTRT;
+
+    /* Line 29 carries the LPTIM1 wakeup out of STOP */
+    EXTI->IMR |= EXTI_IMR_IM29;
+    NVIC_SetPriority(LPTIM1_IRQn, 0U);
+    NVIC_EnableIRQ(LPTIM1_IRQn);
+
+    /* SysTick keeps counting core clocks, without its interrupt, for the
+     * interrupt-masked time metering in eeprom-board.c */
+    SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+    SysTick->VAL = 0U;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+
+    RtcInitialized = true;
+}
+
+uint32_t RtcGetMinimumTimeout(void)
+{
+    return RTC_ALARM_MIN_TICKS;
+}
+
+/* ms * 1024 / 1000 = ms * 128 / 125, split so that nothing overflows */
+uint32_t RtcMs2Tick(uint32_t milliseconds)
+{
+    uint32_t quotient = milliseconds / 125U;
+    uint32_t remainder = milliseconds % 125U;
+    return (quotient << 7) + ((remainder << 7) / 125U);
+}
+
+uint32_t RtcTick2Ms(uint32_t tick)
+{
+    uint32_t quotient = tick >> 7;
+    uint32_t remainder = tick & 0x7FU;
+    return (quotient * 125U) + ((remainder * 125U) >> 7);
+}
+
 void RtcSetAlarm(uint32_t timeout)
 {
+    CRITICAL_SECTION_BEGIN();
     AlarmTick = RtcTimerContext + timeout;
     AlarmEnabled = true;
+    AlarmArmed = false;
+    RtcArmAlarm();
+    CRITICAL_SECTION_END();
 }
 
 void RtcStopAlarm(void)
 {
+    CRITICAL_SECTION_BEGIN();
     AlarmEnabled = false;
+    if (AlarmArmed)
+    {
+        AlarmArmed = false;
+        RtcWriteCompare(RTC_LPTIM_CMP_IDLE);
+    }
+    CRITICAL_SECTION_END();
 }
 
-void RtcStartAlarm(uint32_t timeout)
+uint32_t RtcGetTimerValue(void)
 {
-    RtcSetAlarm(timeout);
+    uint32_t high;
+    uint32_t low;
+    RtcGetTicks(&high, &low);
+    return (high << 16) + low;
 }
 
-uint32_t RtcGetTimerValue(void)
+/* 1024 ticks per second: seconds and milliseconds come from shifts of the
+ * full 48-bit count, so this keeps counting long after the 32-bit tick
+ * value wraps (every 48.5 days) */
+uint32_t RtcGetCalendarTime(uint16_t *milliseconds)
 {
-    return RtcTick;
+    uint32_t high;
+    uint32_t low;
+    RtcGetTicks(&high, &low);
+
+    if (milliseconds != NULL)
+    {
+        *milliseconds = (uint16_t)(((low & 0x3FFU) * 1000U) >> 10);
+    }
+    return (high << 6) | (low >> 10);
 }
 
-uint32_t RtcGetTimerElapsedTime(void)
+void RtcOnSysTick(void)
 {
-    return RtcGetTimerValue() - RtcTimerContext;
 }
 
-uint32_t RtcGetCalendarTime(uint16_t *milliseconds)
+void RtcOnLptimIrq(void)
 {
-    uint32_t ticks = RtcGetTimerValue();
-    if (milliseconds != NULL)
+    uint32_t isr = LPTIM1->ISR & (LPTIM_ISR_ARRM | LPTIM_ISR_CMPM);
+
+    RTC_LPTIM_CLEAR_FLAGS(isr);
+    if ((isr & LPTIM_ISR_ARRM) != 0U)
     {
-        *milliseconds = (uint16_t)(ticks % 1000U);
+        RtcOverflows++;
     }
-    return ticks / 1000U;
+
+    if (!AlarmEnabled)
+    {
+        return;
+    }
+
+    /* An overflow, or a compare match one period early: the loaded compare
+     * (or the autoreload match, for phase 0) still lands on time */
+    int32_t remaining = (int32_t)(AlarmTick - RtcGetTimerValue());
+    if (remaining > 0 && AlarmArmed)
+    {
+        return;
+    }
+    if (remaining > (int32_t)RTC_LPTIM_CMP_SYNC_TICKS)
+    {
+        RtcArmAlarm();
+        return;
+    }
+
+    AlarmEnabled = false;
+    if (AlarmArmed)
+    {
+        AlarmArmed = false;
+        RtcWriteCompare(RTC_LPTIM_CMP_IDLE);
+    }
+    TimerIrqHandler();
+}
+
+static void RtcStartLse(void)
+{
+    if ((RCC->CSR & RCC_CSR_LSERDY) != 0U)
+    {
+        return;
+    }
+
+    /* LSEON sits in the backup domain */
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+    PWR->CR |= PWR_CR_DBP;
+    RCC->CSR |= RCC_CSR_LSEON;
+    while ((RCC->CSR & RCC_CSR_LSERDY) == 0U)
+    {
+    }
+    PWR->CR &= ~PWR_CR_DBP;
+}
+
+/* CNT runs on the asynchronous LSE clock: two equal reads are stable */
+static uint16_t RtcReadCounter(void)
+{
+    uint32_t first;
+    uint32_t second = LPTIM1->CNT;
+    do
+    {
+        first = second;
+        second = LPTIM1->CNT;
+    } while (first != second);
+    return (uint16_t)second;
+}
+
+static void RtcGetTicks(uint32_t *high, uint32_t *low)
+{
+    CRITICAL_SECTION_BEGIN();
+    uint32_t overflows = RtcOverflows;
+    uint32_t phase = (RtcReadCounter() + 1U) & RTC_LPTIM_ARR;
+
+    /* Autoreload match not serviced yet. A phase in the upper half was read
+     * before the match (CNT == ARR - n), so it still belongs to this period */
+    if (((LPTIM1->ISR & LPTIM_ISR_ARRM) != 0U) && (phase < (RTC_LPTIM_PERIOD / 2U)))
+    {
+        overflows++;
+    }
+    CRITICAL_SECTION_END();
+
+    *high = overflows;
+    *low = phase;
+}
+
+static void RtcWriteCompare(uint16_t value)
+{
+    /* One write in flight at a time: a new value waits for CMPOK */
+    if (CompareWritePending)
+    {
+        while ((LPTIM1->ISR & LPTIM_ISR_CMPOK) == 0U)
+        {
+        }
+    }
+    RTC_LPTIM_CLEAR_FLAGS(LPTIM_ICR_CMPOKCF);
+    LPTIM1->CMP = value;
+    CompareWritePending = true;
+}
+
+/* Called with interrupts masked. Loads the compare once the alarm is less
+ * than two periods away, which leaves at least a full period for the write
+ * to land when the load happens from the overflow interrupt. */
+static void RtcArmAlarm(void)
+{
+    uint32_t remaining = AlarmTick - RtcGetTimerValue();
+
+    if ((int32_t)remaining <= (int32_t)RTC_LPTIM_CMP_SYNC_TICKS)
+    {
+        /* Set late (interrupt latency past timer.c's minimum): a compare
+         * write would miss it, so raise it now, at most 1 tick early */
+        NVIC_SetPendingIRQ(LPTIM1_IRQn);
+        return;
+    }
+
+    if (remaining < (2U * RTC_LPTIM_PERIOD))
+    {
+        /* Phase 0 (CNT == ARR) is the autoreload match itself; ARR is not a
+         * valid compare value, so that alarm rides on the ARRM interrupt */
+        uint32_t phase = AlarmTick & RTC_LPTIM_ARR;
+        if (phase != 0U)
+        {
+            RtcWriteCompare((uint16_t)(phase - 1U));
+        }
+        AlarmArmed = true;
+    }
+}
+
+#endif /* RTC_BACKEND_SYSTICK */
+
+uint32_t RtcSetTimerContext(void)
+{
+    RtcTimerContext = RtcGetTimerValue();
+    return RtcTimerContext;
+}
+
+uint32_t RtcGetTimerContext(void)
+{
+    return RtcTimerContext;
+}
+
+void RtcDelayMs(uint32_t delay)
+{
+    uint32_t start = RtcGetTimerValue();
+    uint32_t ticks = RtcMs2Tick(delay);
+    while ((RtcGetTimerValue() - start) < ticks)
+    {
+        __NOP();
+    }
+}
+
+void RtcStartAlarm(uint32_t timeout)
+{
+    RtcSetAlarm(timeout);
+}
+
+uint32_t RtcGetTimerElapsedTime(void)
+{
+    return RtcGetTimerValue() - RtcTimerContext;
 }
 
 void RtcBkupWrite(uint32_t data0, uint32_t data1)
@@ -117,16 +435,3 @@ TimerTime_t RtcTempCompensation(TimerTime_t period, float temperature)
     (void)temperature;
     return period;
 }
-
-void RtcOnSysTick(void)
-{
-    RtcTick++;
-    if (AlarmEnabled)
-    {
-        if ((int32_t)(RtcTick - AlarmTick) >= 0)
-        {
-            AlarmEnabled = false;
-            TimerIrqHandler();
-        }
-    }
-}
@@ -21,6 +21,10 @@ void RtcBkupWrite(uint32_t data0, uint32_t data1);
 void RtcBkupRead(uint32_t *data0, uint32_t *data1);
 void RtcProcess(void);
 TimerTime_t RtcTempCompensation(TimerTime_t period, float temperature);
+
+/* Interrupt entries (sysIrqHandlers.c); each is a no-op for the back end
+ * not built (RTC_BACKEND_SYSTICK selects SysTick, LPTIM1 otherwise) */
 void RtcOnSysTick(void);
+void RtcOnLptimIrq(void);
 
 #endif /* RTC_BOARD_H */
@@ -183,6 +183,11 @@ void SysTick_Handler(void)
     RtcOnSysTick();
 }
 
+void LPTIM1_IRQHandler(void)
+{
+    RtcOnLptimIrq();
+}
+
 static void HandleExtiLine(uint8_t line)
 {
     uint32_t mask = (1U << line);
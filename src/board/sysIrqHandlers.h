@@ -37,6 +37,8 @@ void DebugMon_Handler( void );
 
 void SysTick_Handler( void );
 
+void LPTIM1_IRQHandler( void );
+
 void EXTI0_1_IRQHandler( void );
 
 void EXTI2_3_IRQHandler( void );
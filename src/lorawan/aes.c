@@ -55,6 +55,22 @@
 #  define USE_TABLES
 #endif
 
+/*  Implementation variant, selected by the build (AES_IMPL in the Makefile):
+
+    default           byte-oriented rounds with S-box and GF(2^8) x2/x3
+                      S-box tables (768 bytes of tables)
+    AES_IMPL_SMALL    byte-oriented rounds with the S-box table only;
+                      MixColumns uses xtime (256 bytes of tables, slower)
+    AES_IMPL_TTABLE   32-bit T-table rounds for aes_encrypt using a single
+                      1 KB table and rotations, which are single cycle on
+                      the Cortex-M0+ (1.25 KB of tables, fastest)
+
+    Key expansion and decryption are byte-oriented in every variant.
+*/
+#if defined( AES_IMPL_SMALL ) && defined( AES_IMPL_TTABLE )
+#  error "AES_IMPL_SMALL and AES_IMPL_TTABLE are mutually exclusive"
+#endif
+
 /*  On Intel Core 2 duo VERSION_1 is faster */
 
 /* alternative versions (test for performance on your system) */
@@ -64,6 +80,10 @@
 
 #include "aes.h"
 
+#if !defined( AES_IMPL_TTABLE ) || defined( AES_ENC_128_OTFK ) || defined( AES_ENC_256_OTFK )
+#  define AES_BYTE_ENC_ROUNDS   /* byte-oriented encryption rounds are built */
+#endif
+
 //#if defined( HAVE_UINT_32T )
 //  typedef unsigned long uint32_t;
 //#endif
@@ -197,8 +217,17 @@ static const uint8_t sbox[256]  =  sb_data(f1);
 static const uint8_t isbox[256] = isb_data(f1);
 #endif
 
+#if defined( AES_BYTE_ENC_ROUNDS ) && !defined( AES_IMPL_SMALL )
 static const uint8_t gfm2_sbox[256] = sb_data(f2);
 static const uint8_t gfm3_sbox[256] = sb_data(f3);
+#endif
+
+#if defined( AES_IMPL_TTABLE )
+/* column (2s, s, s, 3s) packed little-endian: row 0 in the low byte */
+#define t0_w(x) ((uint32_t)f2(x) | ((uint32_t)(x) << 8) | \
+                 ((uint32_t)(x) << 16) | ((uint32_t)f3(x) << 24))
+static const uint32_t t0_tab[256] = sb_data(t0_w);
+#endif
 
 #if defined( AES_DEC_PREKEYED )
 static const uint8_t gfmul_9[256] = mm_data(f9);
@@ -211,8 +240,13 @@ static const uint8_t gfmul_e[256] = mm_data(fe);
 #if defined( AES_DEC_PREKEYED )
 #define is_box(x)    isbox[(x)]
 #endif
+#if defined( AES_IMPL_SMALL )
+#define gfm2_sb(x)   f2(s_box(x))
+#define gfm3_sb(x)   f3(s_box(x))
+#else
 #define gfm2_sb(x)   gfm2_sbox[(x)]
 #define gfm3_sb(x)   gfm3_sbox[(x)]
+#endif
 #if defined( AES_DEC_PREKEYED )
 #define gfm_9(x)     gfmul_9[(x)]
 #define gfm_b(x)     gfmul_b[(x)]
@@ -373,6 +407,9 @@ static void xor_block( void *d, const void *s )
 #endif
 }
 
+#if defined( AES_BYTE_ENC_ROUNDS ) || defined( AES_DEC_PREKEYED ) || \
+    defined( AES_DEC_128_OTFK ) || defined( AES_DEC_256_OTFK )
+
 static void copy_and_key( void *d, const void *s, const void *k )
 {
 #if defined( HAVE_UINT_32T )
@@ -408,6 +445,10 @@ static void add_round_key( uint8_t d[N_BLOCK], const uint8_t k[N_BLOCK] )
     xor_block(d, k);
 }
 
+#endif
+
+#if defined( AES_BYTE_ENC_ROUNDS )
+
 static void shift_sub_rows( uint8_t st[N_BLOCK] )
 {   uint8_t tt;
 
@@ -424,6 +465,8 @@ static void shift_sub_rows( uint8_t st[N_BLOCK] )
     st[ 7] = s_box(st[ 3]); st[ 3] = s_box( tt );
 }
 
+#endif
+
 #if defined( AES_DEC_PREKEYED )
 
 static void inv_shift_sub_rows( uint8_t st[N_BLOCK] )
@@ -444,6 +487,8 @@ static void inv_shift_sub_rows( uint8_t st[N_BLOCK] )
 
 #endif
 
+#if defined( AES_BYTE_ENC_ROUNDS )
+
 #if defined( VERSION_1 )
   static void mix_sub_columns( uint8_t dt[N_BLOCK] )
   { uint8_t st[N_BLOCK];
@@ -473,6 +518,8 @@ static void inv_shift_sub_rows( uint8_t st[N_BLOCK] )
     dt[15] = gfm3_sb(st[12]) ^ s_box(st[1]) ^ s_box(st[6]) ^ gfm2_sb(st[11]);
   }
 
+#endif
+
 #if defined( AES_DEC_PREKEYED )
 
 #if defined( VERSION_1 )
@@ -565,6 +612,70 @@ return_type aes_set_key( const uint8_t key[], length_type keylen, aes_context ct
 
 /*  Encrypt a single block of 16 bytes */
 
+#if defined( AES_IMPL_TTABLE )
+
+#define rotl8(x)    (((x) << 8) | ((x) >> 24))
+#define rotl16(x)   (((x) << 16) | ((x) >> 16))
+#define rotl24(x)   (((x) << 24) | ((x) >> 8))
+
+#define b0(x)       ((uint8_t)(x))
+#define b1(x)       ((uint8_t)((x) >> 8))
+#define b2(x)       ((uint8_t)((x) >> 16))
+#define b3(x)       ((uint8_t)((x) >> 24))
+
+/* one full round: SubBytes + ShiftRows + MixColumns on column c */
+#define t_round(a, b, c, d) \
+    (t0_tab[b0(a)] ^ rotl8(t0_tab[b1(b)]) ^ rotl16(t0_tab[b2(c)]) ^ rotl24(t0_tab[b3(d)]))
+
+/* final round: SubBytes + ShiftRows only */
+#define t_last(a, b, c, d) \
+    ((uint32_t)s_box(b0(a)) | ((uint32_t)s_box(b1(b)) << 8) | \
+     ((uint32_t)s_box(b2(c)) << 16) | ((uint32_t)s_box(b3(d)) << 24))
+
+static uint32_t load_le32( const uint8_t *p )
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store_le32( uint8_t *p, uint32_t v )
+{
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+return_type aes_encrypt( const uint8_t in[N_BLOCK], uint8_t  out[N_BLOCK], const aes_context ctx[1] )
+{
+    const uint32_t *rk = ctx->ksch_w;
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    uint8_t r;
+
+    if( !ctx->rnd )
+        return ( uint8_t )-1;
+
+    s0 = load_le32( in      ) ^ rk[0];
+    s1 = load_le32( in +  4 ) ^ rk[1];
+    s2 = load_le32( in +  8 ) ^ rk[2];
+    s3 = load_le32( in + 12 ) ^ rk[3];
+
+    for( r = 1 ; r < ctx->rnd ; ++r )
+    {
+        rk += N_COL;
+        t0 = t_round( s0, s1, s2, s3 ) ^ rk[0];
+        t1 = t_round( s1, s2, s3, s0 ) ^ rk[1];
+        t2 = t_round( s2, s3, s0, s1 ) ^ rk[2];
+        t3 = t_round( s3, s0, s1, s2 ) ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    rk += N_COL;
+    store_le32( out     , t_last( s0, s1, s2, s3 ) ^ rk[0] );
+    store_le32( out +  4, t_last( s1, s2, s3, s0 ) ^ rk[1] );
+    store_le32( out +  8, t_last( s2, s3, s0, s1 ) ^ rk[2] );
+    store_le32( out + 12, t_last( s3, s0, s1, s2 ) ^ rk[3] );
+    return 0;
+}
+
+#else
+
 return_type aes_encrypt( const uint8_t in[N_BLOCK], uint8_t  out[N_BLOCK], const aes_context ctx[1] )
 {
     if( ctx->rnd )
@@ -592,6 +703,8 @@ return_type aes_encrypt( const uint8_t in[N_BLOCK], uint8_t  out[N_BLOCK], const
     return 0;
 }
 
+#endif
+
 /* CBC encrypt a number of blocks (input and return an IV) */
 
 return_type aes_cbc_encrypt( const uint8_t *in, uint8_t *out,
@@ -69,10 +69,26 @@ typedef uint8_t return_type;
 
 typedef uint8_t length_type;
 
+#if defined( AES_IMPL_TTABLE )
+#  if defined( __BYTE_ORDER__ ) && ( __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__ )
+#    error "AES_IMPL_TTABLE reads the key schedule as little-endian words"
+#  endif
+/*  The T-table rounds read the key schedule as 32-bit words, so it is
+    word aligned and also visible as words (little-endian byte order).
+*/
+typedef struct
+{   union
+    {   uint8_t  ksch[(N_MAX_ROUNDS + 1) * N_BLOCK];
+        uint32_t ksch_w[(N_MAX_ROUNDS + 1) * N_COL];
+    };
+    uint8_t rnd;
+} aes_context;
+#else
 typedef struct
 {   uint8_t ksch[(N_MAX_ROUNDS + 1) * N_BLOCK];
     uint8_t rnd;
 } aes_context;
+#endif
 
 /*  The following calls are for a precomputed key schedule
 
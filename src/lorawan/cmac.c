@@ -56,35 +56,24 @@ DEALINGS WITH THE SOFTWARE
         }                                   \
     } while( 0 )
 
-void AES_CMAC_Init( AES_CMAC_CTX* ctx )
-{
-    memset1( ctx->X, 0, sizeof ctx->X );
-    ctx->M_n = 0;
-    memset1( ctx->rijndael.ksch, '\0', 240 );
-}
-
-void AES_CMAC_SetKey( AES_CMAC_CTX* ctx, const uint8_t key[AES_CMAC_KEY_LENGTH] )
-{
-    aes_set_key( key, AES_CMAC_KEY_LENGTH, &ctx->rijndael );
-}
-
-void AES_CMAC_Update( AES_CMAC_CTX* ctx, const uint8_t* data, uint32_t len )
+static void CmacAbsorb( const aes_context* rijndael, uint8_t X[16], uint8_t M_last[16],
+                        uint32_t* M_n, const uint8_t* data, uint32_t len )
 {
     uint32_t mlen;
     uint8_t  in[16];
 
-    if( ctx->M_n > 0 )
+    if( *M_n > 0 )
     {
-        mlen = MIN( 16 - ctx->M_n, len );
-        memcpy1( ctx->M_last + ctx->M_n, data, mlen );
-        ctx->M_n += mlen;
-        if( ctx->M_n < 16 || len == mlen )
+        mlen = MIN( 16 - *M_n, len );
+        memcpy1( M_last + *M_n, data, mlen );
+        *M_n += mlen;
+        if( *M_n < 16 || len == mlen )
             return;
-        XOR( ctx->M_last, ctx->X );
+        XOR( M_last, X );
 
-        memcpy1( in, &ctx->X[0], 16 );  // Otherwise it does not look good
-        aes_encrypt( in, in, &ctx->rijndael );
-        memcpy1( &ctx->X[0], in, 16 );
+        memcpy1( in, &X[0], 16 );  // Otherwise it does not look good
+        aes_encrypt( in, in, rijndael );
+        memcpy1( &X[0], in, 16 );
 
         data += mlen;
         len -= mlen;
@@ -92,63 +81,119 @@ void AES_CMAC_Update( AES_CMAC_CTX* ctx, const uint8_t* data, uint32_t len )
     while( len > 16 )
     { /* not last block */
 
-        XOR( data, ctx->X );
+        XOR( data, X );
 
-        memcpy1( in, &ctx->X[0], 16 );  // Otherwise it does not look good
-        aes_encrypt( in, in, &ctx->rijndael );
-        memcpy1( &ctx->X[0], in, 16 );
+        memcpy1( in, &X[0], 16 );  // Otherwise it does not look good
+        aes_encrypt( in, in, rijndael );
+        memcpy1( &X[0], in, 16 );
 
         data += 16;
         len -= 16;
     }
     /* potential last block, save it */
-    memcpy1( ctx->M_last, data, len );
-    ctx->M_n = len;
+    memcpy1( M_last, data, len );
+    *M_n = len;
 }
 
-void AES_CMAC_Final( uint8_t digest[AES_CMAC_DIGEST_LENGTH], AES_CMAC_CTX* ctx )
+static void CmacDeriveSubkeys( const aes_context* rijndael, uint8_t K1[16], uint8_t K2[16] )
 {
-    uint8_t K[16];
-    uint8_t in[16];
     /* generate subkey K1 */
-    memset1( K, '\0', 16 );
+    memset1( K1, '\0', 16 );
 
-    aes_encrypt( K, K, &ctx->rijndael );
+    aes_encrypt( K1, K1, rijndael );
 
-    if( K[0] & 0x80 )
+    if( K1[0] & 0x80 )
     {
-        LSHIFT( K, K );
-        K[15] ^= 0x87;
+        LSHIFT( K1, K1 );
+        K1[15] ^= 0x87;
     }
     else
-        LSHIFT( K, K );
+        LSHIFT( K1, K1 );
 
-    if( ctx->M_n == 16 )
+    /* generate subkey K2 */
+    if( K1[0] & 0x80 )
+    {
+        LSHIFT( K1, K2 );
+        K2[15] ^= 0x87;
+    }
+    else
+        LSHIFT( K1, K2 );
+}
+
+static void CmacFinish( uint8_t digest[AES_CMAC_DIGEST_LENGTH], const aes_context* rijndael,
+                        const uint8_t K1[16], const uint8_t K2[16],
+                        uint8_t X[16], uint8_t M_last[16], uint32_t M_n )
+{
+    uint8_t in[16];
+
+    if( M_n == 16 )
     {
         /* last block was a complete block */
-        XOR( K, ctx->M_last );
+        XOR( K1, M_last );
     }
     else
     {
-        /* generate subkey K2 */
-        if( K[0] & 0x80 )
-        {
-            LSHIFT( K, K );
-            K[15] ^= 0x87;
-        }
-        else
-            LSHIFT( K, K );
-
         /* padding(M_last) */
-        ctx->M_last[ctx->M_n] = 0x80;
-        while( ++ctx->M_n < 16 )
-            ctx->M_last[ctx->M_n] = 0;
+        M_last[M_n] = 0x80;
+        while( ++M_n < 16 )
+            M_last[M_n] = 0;
 
-        XOR( K, ctx->M_last );
+        XOR( K2, M_last );
     }
-    XOR( ctx->M_last, ctx->X );
+    XOR( M_last, X );
+
+    memcpy1( in, &X[0], 16 );  // Otherwise it does not look good
+    aes_encrypt( in, digest, rijndael );
+}
 
-    memcpy1( in, &ctx->X[0], 16 );  // Otherwise it does not look good
-    aes_encrypt( in, digest, &ctx->rijndael );
-    memset1( K, 0, sizeof K );
+void AES_CMAC_Init( AES_CMAC_CTX* ctx )
+{
+    memset1( ctx->X, 0, sizeof ctx->X );
+    ctx->M_n = 0;
+    memset1( ctx->rijndael.ksch, '\0', 240 );
+}
+
+void AES_CMAC_SetKey( AES_CMAC_CTX* ctx, const uint8_t key[AES_CMAC_KEY_LENGTH] )
+{
+    aes_set_key( key, AES_CMAC_KEY_LENGTH, &ctx->rijndael );
+}
+
+void AES_CMAC_Update( AES_CMAC_CTX* ctx, const uint8_t* data, uint32_t len )
+{
+    CmacAbsorb( &ctx->rijndael, ctx->X, ctx->M_last, &ctx->M_n, data, len );
+}
+
+void AES_CMAC_Final( uint8_t digest[AES_CMAC_DIGEST_LENGTH], AES_CMAC_CTX* ctx )
+{
+    uint8_t K1[16];
+    uint8_t K2[16];
+
+    CmacDeriveSubkeys( &ctx->rijndael, K1, K2 );
+    CmacFinish( digest, &ctx->rijndael, K1, K2, ctx->X, ctx->M_last, ctx->M_n );
+    memset1( K1, 0, sizeof K1 );
+    memset1( K2, 0, sizeof K2 );
+}
+
+void AES_CMAC_PrepareKey( AES_CMAC_KEY* key, const uint8_t k[AES_CMAC_KEY_LENGTH] )
+{
+    aes_set_key( k, AES_CMAC_KEY_LENGTH, &key->rijndael );
+    CmacDeriveSubkeys( &key->rijndael, key->K1, key->K2 );
+}
+
+void AES_CMAC_KeyedInit( AES_CMAC_KEYED_CTX* ctx, const AES_CMAC_KEY* key )
+{
+    ctx->key = key;
+    memset1( ctx->X, 0, sizeof ctx->X );
+    ctx->M_n = 0;
+}
+
+void AES_CMAC_KeyedUpdate( AES_CMAC_KEYED_CTX* ctx, const uint8_t* data, uint32_t len )
+{
+    CmacAbsorb( &ctx->key->rijndael, ctx->X, ctx->M_last, &ctx->M_n, data, len );
+}
+
+void AES_CMAC_KeyedFinal( uint8_t digest[AES_CMAC_DIGEST_LENGTH], AES_CMAC_KEYED_CTX* ctx )
+{
+    CmacFinish( digest, &ctx->key->rijndael, ctx->key->K1, ctx->key->K2,
+                ctx->X, ctx->M_last, ctx->M_n );
 }
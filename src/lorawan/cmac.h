@@ -51,16 +51,39 @@ typedef struct _AES_CMAC_CTX {
             uint8_t        M_last[16];
             uint32_t       M_n;
     } AES_CMAC_CTX;
+
+/* Key schedule and K1/K2 subkeys expanded once for a long-lived key */
+typedef struct _AES_CMAC_KEY {
+            aes_context    rijndael;
+            uint8_t        K1[16];
+            uint8_t        K2[16];
+    } AES_CMAC_KEY;
+
+/* Streaming state over a prepared key; holds no key material itself */
+typedef struct _AES_CMAC_KEYED_CTX {
+            const AES_CMAC_KEY *key;
+            uint8_t        X[16];
+            uint8_t        M_last[16];
+            uint32_t       M_n;
+    } AES_CMAC_KEYED_CTX;
    
 //#include <sys/cdefs.h>
     
 //__BEGIN_DECLS
+/* Update/KeyedUpdate take fragments of any length, any number of times: the
+ * partial last block carries over, so a message split across buffers is
+ * MACed by one call per fragment */
 void     AES_CMAC_Init(AES_CMAC_CTX * ctx);
 void     AES_CMAC_SetKey(AES_CMAC_CTX * ctx, const uint8_t key[AES_CMAC_KEY_LENGTH]);
 void     AES_CMAC_Update(AES_CMAC_CTX * ctx, const uint8_t * data, uint32_t len);
           //          __attribute__((__bounded__(__string__,2,3)));
 void     AES_CMAC_Final(uint8_t digest[AES_CMAC_DIGEST_LENGTH], AES_CMAC_CTX  * ctx);
             //     __attribute__((__bounded__(__minbytes__,1,AES_CMAC_DIGEST_LENGTH)));
+
+void     AES_CMAC_PrepareKey(AES_CMAC_KEY * key, const uint8_t k[AES_CMAC_KEY_LENGTH]);
+void     AES_CMAC_KeyedInit(AES_CMAC_KEYED_CTX * ctx, const AES_CMAC_KEY * key);
+void     AES_CMAC_KeyedUpdate(AES_CMAC_KEYED_CTX * ctx, const uint8_t * data, uint32_t len);
+void     AES_CMAC_KeyedFinal(uint8_t digest[AES_CMAC_DIGEST_LENGTH], AES_CMAC_KEYED_CTX * ctx);
 //__END_DECLS
 
 #ifdef __cplusplus
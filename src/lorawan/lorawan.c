@@ -1,19 +1,88 @@
 #include "lorawan.h"
 #include "lorawan_crypto.h"
+#include "lorawan_mac.h"
 #include "lorawan_region.h"
 #include "radio.h"
 #include "board.h"
 #include "storage.h"
 #include "config.h"
 #include "timer.h"
+#include <stdio.h>
 #include <string.h>
 
 #define UPSTREAM_DIR   0
 #define DOWNSTREAM_DIR 1
 
+#define LORAWAN_MTYPE_MASK             0xE0
+#define LORAWAN_MTYPE_UNCONFIRMED_DOWN 0x60
+#define LORAWAN_MTYPE_CONFIRMED_DOWN   0xA0
+#define LORAWAN_FCTRL_ADR              0x80
+#define LORAWAN_FCTRL_ADR_ACK_REQ      0x40
+#define LORAWAN_FCTRL_ACK              0x20
+#define LORAWAN_FCTRL_FOPTS_LEN_MASK   0x0F
+#define LORAWAN_MAX_FCNT_GAP           16384U
+#define LORAWAN_RX_PREAMBLE_SYMBOLS    8
+#define LORAWAN_RX_SYMB_TIMEOUT_MAX    1023U /* 10-bit REG_LR_SYMBTIMEOUT */
+
+/* SX1276 typical supply currents (datasheet, PA_BOOST at +20 dBm) */
+#ifndef LORAWAN_RADIO_TX_CURRENT_UA
+#define LORAWAN_RADIO_TX_CURRENT_UA      120000U
+#endif
+#ifndef LORAWAN_RADIO_RX_CURRENT_UA
+#define LORAWAN_RADIO_RX_CURRENT_UA      10800U
+#endif
+#ifndef LORAWAN_RADIO_STANDBY_CURRENT_UA
+#define LORAWAN_RADIO_STANDBY_CURRENT_UA 1600U
+#endif
+#ifndef LORAWAN_RADIO_SLEEP_CURRENT_UA
+#define LORAWAN_RADIO_SLEEP_CURRENT_UA   1U
+#endif
+
+typedef struct
+{
+    uint16_t SymbTimeout;
+    int32_t OffsetMs;
+} LoRaWANRxWindowParams_t;
+
+/* A confirmed uplink stays in the radio buffer until it is acknowledged or
+ * its attempts run out; retransmissions resend those exact bytes (same FCnt,
+ * same MIC) on the next channel. */
+typedef struct
+{
+    bool Active;
+    uint8_t *Frame;
+    uint8_t FrameLen;
+    uint8_t Attempt;
+    uint8_t MaxAttempts;
+    uint8_t DataRate;
+} LoRaWANRetransmission_t;
+
+typedef enum
+{
+    LORAWAN_RADIO_STATE_SLEEP = 0,
+    LORAWAN_RADIO_STATE_STANDBY,
+    LORAWAN_RADIO_STATE_RX,
+    LORAWAN_RADIO_STATE_TX,
+    LORAWAN_RADIO_STATE_COUNT
+} LoRaWANRadioState_t;
+
+/* Data downlink decoded in place in the radio driver's receive buffer */
+typedef struct
+{
+    uint8_t MHdr;
+    uint8_t FCtrl;
+    uint32_t FCnt;
+    const uint8_t *FOpts;
+    uint8_t FOptsLen;
+    bool HasPort;
+    uint8_t Port;
+    uint8_t *FrmPayload;
+    uint8_t FrmPayloadLen;
+} LoRaWANDownlink_t;
+
 static LoRaWANStatus_t LoRaWAN_BuildJoinRequest(LoRaWANContext_t *ctx, uint8_t *buffer, uint8_t *size);
 static LoRaWANStatus_t LoRaWAN_ParseJoinAccept(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8_t size);
-static LoRaWANStatus_t LoRaWAN_BuildUplink(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8_t size, uint8_t port, LoRaWANMsgType_t msgType, uint8_t *out, uint8_t *outLen);
+static LoRaWANStatus_t LoRaWAN_BuildUplink(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8_t size, uint8_t port, LoRaWANMsgType_t msgType, uint8_t **frame, uint8_t *frameLen);
 
 typedef enum
 {
@@ -34,6 +103,22 @@ static bool g_Rx2Pending = false;
 static uint32_t g_LastTxFrequency = 0;
 static uint8_t g_LastTxDatarate = 0;
 static uint8_t g_LastTxChannel = 0;
+static LoRaWANCryptoSession_t g_CryptoSession;
+static LoRaWANKeystream_t g_NextUplinkKeystream;
+static bool g_DownlinkAckPending = false;
+static LoRaWANRxWindowParams_t g_RxWindowParams[2];
+static LoRaWANRadioState_t g_RadioState = LORAWAN_RADIO_STATE_STANDBY;
+static TimerTime_t g_RadioStateSince = 0;
+static uint32_t g_CycleStateMs[LORAWAN_RADIO_STATE_COUNT];
+static bool g_CycleActive = false;
+static volatile bool g_CycleEnergyReady = false;
+static LoRaWANCycleEnergy_t g_LastCycleEnergy;
+static LoRaWANRetransmission_t g_Retransmission;
+static TimerEvent_t g_RetransmitTimer;
+static uint32_t g_BackoffRandom = 0;
+static bool g_DutyCycleOff = false;
+static TimerTime_t g_DutyCycleOffUntil = 0;
+static uint32_t g_AdrAckCounter = 0;
 
 static void OnRadioTxDone(void);
 static void OnRadioTxTimeout(void);
@@ -42,24 +127,48 @@ static void OnRadioRxTimeout(void);
 static void OnRadioRxError(void);
 static void OnRx1TimerEvent(void *context);
 static void OnRx2TimerEvent(void *context);
+static void OnRetransmitTimerEvent(void *context);
+static LoRaWANStatus_t LoRaWAN_TransmitFrame(LoRaWANContext_t *ctx, uint8_t *frame, uint8_t frameLen, uint8_t datarate);
+static bool LoRaWAN_ScheduleRetransmission(void);
+static void LoRaWAN_CompleteUplink(LoRaWANStatus_t status);
+static uint32_t LoRaWAN_DutyCycleWaitMs(void);
+static bool LoRaWAN_AdrAtFloor(const LoRaWANContext_t *ctx);
+static bool LoRaWAN_AdrAckRequested(const LoRaWANContext_t *ctx);
+static void LoRaWAN_AdrBackoff(LoRaWANContext_t *ctx);
 static bool LoRaWAN_GetPhyParams(uint8_t dr, uint32_t *bandwidth, uint8_t *spreadingFactor);
 static int8_t LoRaWAN_ComputeTxPowerDbm(uint8_t txPowerIndex, const LoRaWANRegionParams_t *region);
+static bool LoRaWAN_ComputeRxWindowParams(uint8_t dr, LoRaWANRxWindowParams_t *params);
+static void LoRaWAN_RadioSetState(LoRaWANRadioState_t state);
+static void LoRaWAN_RadioSleep(void);
+static void LoRaWAN_BeginRadioCycle(void);
+static void LoRaWAN_EndRadioCycle(void);
 static void LoRaWAN_ResetRxTracking(void);
+static uint8_t LoRaWAN_GetRx1Datarate(LoRaWANContext_t *ctx);
 static void LoRaWAN_ScheduleRxWindows(LoRaWANContext_t *ctx);
 static void LoRaWAN_OpenRxWindow(uint8_t window);
 static void LoRaWAN_HandleRxWindowComplete(void);
 static void LoRaWAN_HandleJoinFailure(void);
 static LoRaWANStatus_t LoRaWAN_HandleJoinAccept(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8_t size);
+static const LoRaWANCryptoSession_t *LoRaWAN_GetCryptoSession(LoRaWANContext_t *ctx);
+static bool LoRaWAN_LoadCryptoSession(LoRaWANContext_t *ctx);
+static void LoRaWAN_ResumeUplinkCounter(LoRaWANContext_t *ctx);
+static void LoRaWAN_SaveMacState(const LoRaWANContext_t *ctx);
+static void LoRaWAN_RestoreMacState(LoRaWANContext_t *ctx);
+static void LoRaWAN_PrecomputeNextUplink(LoRaWANContext_t *ctx);
+static bool LoRaWAN_DecodeDownlink(LoRaWANContext_t *ctx, uint8_t *buffer, uint8_t size, LoRaWANDownlink_t *frame);
 
 LoRaWANStatus_t LoRaWAN_Init(LoRaWANContext_t *ctx)
 {
-    if (ctx == NULL || ctx->Session == NULL || ctx->RadioBuffer == NULL || ctx->RadioBufferSize < 255)
+    if (ctx == NULL || ctx->Session == NULL || ctx->RadioBuffer == NULL || ctx->RadioBufferSize < LORAWAN_RADIO_BUFFER_SIZE)
     {
         return LORAWAN_STATUS_INVALID_PARAM;
     }
 
     g_ActiveCtx = ctx;
     ctx->Session->Joined = false;
+    LoRaWAN_Crypto_SessionClear(&g_CryptoSession);
+    g_NextUplinkKeystream.Valid = false;
+    g_DownlinkAckPending = false;
 
     if (!g_RadioInitialized)
     {
@@ -76,17 +185,118 @@ LoRaWANStatus_t LoRaWAN_Init(LoRaWANContext_t *ctx)
         TimerInit(&g_Rx2Timer, OnRx2TimerEvent);
         TimerSetContext(&g_Rx1Timer, (void *)1);
         TimerSetContext(&g_Rx2Timer, (void *)2);
+        TimerInit(&g_RetransmitTimer, OnRetransmitTimerEvent);
 
         g_RadioInitialized = true;
     }
 
     g_CurrentOp = LORAWAN_OP_NONE;
     LoRaWAN_ResetRxTracking();
+    TimerStop(&g_RetransmitTimer);
+    g_Retransmission.Active = false;
+    g_DutyCycleOff = false;
+    LoRaWAN_Mac_Reset();
+    g_AdrAckCounter = 0;
+
+    if (ctx->Settings.ChannelMask == 0U)
+    {
+        ctx->Settings.ChannelMask = LoRaWAN_RegionDefaultChannelMask(ctx->Settings.Region);
+    }
 
     g_LastTxDatarate = ctx->Settings.DataRate;
     return LORAWAN_STATUS_SUCCESS;
 }
 
+LoRaWANStatus_t LoRaWAN_ActivatePersonalization(LoRaWANContext_t *ctx)
+{
+    if (ctx == NULL || ctx->Session == NULL || ctx->Session->DevAddr == 0U)
+    {
+        return LORAWAN_STATUS_INVALID_PARAM;
+    }
+
+    if (!LoRaWAN_LoadCryptoSession(ctx))
+    {
+        return LORAWAN_STATUS_ERROR;
+    }
+
+    LoRaWAN_ResumeUplinkCounter(ctx);
+    ctx->Session->Joined = true;
+    return LORAWAN_STATUS_SUCCESS;
+}
+
+/* OTAA counterpart of ActivatePersonalization: session keys, DevAddr and
+ * counters of the last join come from storage, and so does the MAC state
+ * the network negotiated since */
+LoRaWANStatus_t LoRaWAN_RestoreSession(LoRaWANContext_t *ctx)
+{
+    if (ctx == NULL || ctx->Session == NULL || ctx->Session->DevAddr == 0U)
+    {
+        return LORAWAN_STATUS_INVALID_PARAM;
+    }
+
+    if (!LoRaWAN_LoadCryptoSession(ctx))
+    {
+        return LORAWAN_STATUS_ERROR;
+    }
+
+    LoRaWAN_RestoreMacState(ctx);
+    LoRaWAN_ResumeUplinkCounter(ctx);
+    ctx->Session->Joined = true;
+    return LORAWAN_STATUS_SUCCESS;
+}
+
+/* The stored FCntUp is the newest journal record, and up to
+ * LORAWAN_FCNT_RESUME_GAP frames may have gone out since. Skip past them
+ * (the network accepts a gap but drops a reused FCnt as a replay) and
+ * commit the new value before anything is sent. */
+static void LoRaWAN_ResumeUplinkCounter(LoRaWANContext_t *ctx)
+{
+    ctx->Session->FCntUp += LORAWAN_FCNT_RESUME_GAP;
+    Storage_UpdateFrameCounters(ctx->Session->FCntUp, ctx->Session->FCntDown);
+}
+
+/* Everything MAC commands and the ADR backoff change in the settings. A
+ * restored session must open its RX windows and pick its channels exactly
+ * as the network expects, so this is persisted with the session. */
+static void LoRaWAN_SaveMacState(const LoRaWANContext_t *ctx)
+{
+    StorageMacState_t state;
+
+    memset(&state, 0, sizeof(state));
+    state.Rx1DelayMs = ctx->Settings.Rx1DelayMs;
+    state.Rx2DelayMs = ctx->Settings.Rx2DelayMs;
+    state.Rx2Frequency = ctx->Settings.Rx2Frequency;
+    state.ChannelMask = ctx->Settings.ChannelMask;
+    state.DataRate = ctx->Settings.DataRate;
+    state.TxPower = ctx->Settings.TxPower;
+    state.Rx1DrOffset = ctx->Settings.Rx1DrOffset;
+    state.Rx2DataRate = ctx->Settings.Rx2DataRate;
+    state.MaxDutyCycle = ctx->Settings.MaxDutyCycle;
+    state.Valid = 1U;
+    (void)Storage_UpdateMacState(&state);
+}
+
+/* Nothing saved yet means nothing was negotiated: the configuration stands */
+static void LoRaWAN_RestoreMacState(LoRaWANContext_t *ctx)
+{
+    const StorageData_t *storage = Storage_Get();
+    if (storage == NULL || storage->SessionMac.Valid == 0U)
+    {
+        return;
+    }
+
+    const StorageMacState_t *state = &storage->SessionMac;
+    ctx->Settings.Rx1DelayMs = state->Rx1DelayMs;
+    ctx->Settings.Rx2DelayMs = state->Rx2DelayMs;
+    ctx->Settings.Rx2Frequency = state->Rx2Frequency;
+    ctx->Settings.ChannelMask = state->ChannelMask;
+    ctx->Settings.DataRate = state->DataRate;
+    ctx->Settings.TxPower = state->TxPower;
+    ctx->Settings.Rx1DrOffset = state->Rx1DrOffset;
+    ctx->Settings.Rx2DataRate = state->Rx2DataRate;
+    ctx->Settings.MaxDutyCycle = state->MaxDutyCycle;
+}
+
 LoRaWANStatus_t LoRaWAN_RequestJoin(LoRaWANContext_t *ctx)
 {
     if (ctx == NULL)
@@ -135,11 +345,39 @@ LoRaWANStatus_t LoRaWAN_RequestJoin(LoRaWANContext_t *ctx)
                       LoRaWAN_ComputeTxPowerDbm(ctx->Settings.TxPower, region),
                       0, bandwidth, spreadingFactor,
                       1, 8, false, true, 0, false, false, 4000);
+    LoRaWAN_BeginRadioCycle();
     Radio.Send(frame, frameLen);
 
     return LORAWAN_STATUS_SUCCESS;
 }
 
+uint8_t *LoRaWAN_GetTxPayloadBuffer(LoRaWANContext_t *ctx, uint8_t *maxSize)
+{
+    if (ctx == NULL || ctx->RadioBuffer == NULL)
+    {
+        return NULL;
+    }
+
+    /* The pending confirmed frame still lives in the payload slot */
+    if (g_Retransmission.Active)
+    {
+        return NULL;
+    }
+
+    if (maxSize != NULL)
+    {
+        *maxSize = LORAWAN_MAX_PAYLOAD_LEN;
+    }
+
+    return &ctx->RadioBuffer[LORAWAN_TX_PAYLOAD_OFFSET];
+}
+
+bool LoRaWAN_IsBusy(LoRaWANContext_t *ctx)
+{
+    (void)ctx;
+    return (g_CurrentOp != LORAWAN_OP_NONE);
+}
+
 LoRaWANStatus_t LoRaWAN_Send(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8_t size, uint8_t port, LoRaWANMsgType_t msgType)
 {
     if (ctx == NULL || !ctx->Session->Joined)
@@ -147,21 +385,109 @@ LoRaWANStatus_t LoRaWAN_Send(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8
         return LORAWAN_STATUS_NOT_JOINED;
     }
 
-    uint8_t frame[255];
+    if (g_CurrentOp != LORAWAN_OP_NONE || LoRaWAN_DutyCycleWaitMs() > 0U)
+    {
+        return LORAWAN_STATUS_BUSY;
+    }
+
+    /* A deferred FCnt commit must land before the frame it covers: without
+     * it a reset would resume below this frame's FCnt and repeat it */
+    if (Storage_FlushFrameCounters() != STORAGE_OK)
+    {
+        return LORAWAN_STATUS_ERROR;
+    }
+
+    uint8_t *frame = NULL;
     uint8_t frameLen = 0;
-    LoRaWANStatus_t status = LoRaWAN_BuildUplink(ctx, buffer, size, port, msgType, frame, &frameLen);
+    LoRaWANStatus_t status = LoRaWAN_BuildUplink(ctx, buffer, size, port, msgType, &frame, &frameLen);
+    if (status != LORAWAN_STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    status = LoRaWAN_TransmitFrame(ctx, frame, frameLen, ctx->Settings.DataRate);
     if (status != LORAWAN_STATUS_SUCCESS)
     {
         return status;
     }
 
+    g_Retransmission.Active = (msgType == LORAWAN_MSG_CONFIRMED);
+    g_Retransmission.Frame = frame;
+    g_Retransmission.FrameLen = frameLen;
+    g_Retransmission.Attempt = 1;
+    g_Retransmission.MaxAttempts = (uint8_t)(1U + ctx->Settings.RetryCount);
+    g_Retransmission.DataRate = ctx->Settings.DataRate;
+
+    LoRaWAN_Mac_OnAnswersSent();
+    ctx->Session->FCntUp++;
+    g_DownlinkAckPending = false;
+    Storage_UpdateFrameCounters(ctx->Session->FCntUp, ctx->Session->FCntDown);
+    LoRaWAN_AdrBackoff(ctx);
+
+    return LORAWAN_STATUS_SUCCESS;
+}
+
+/* Lowest DR at full power on the default channels: nothing left to back off */
+static bool LoRaWAN_AdrAtFloor(const LoRaWANContext_t *ctx)
+{
+    return ctx->Settings.DataRate == 0U && ctx->Settings.TxPower == 0U &&
+           ctx->Settings.ChannelMask == LoRaWAN_RegionDefaultChannelMask(ctx->Settings.Region);
+}
+
+static bool LoRaWAN_AdrAckRequested(const LoRaWANContext_t *ctx)
+{
+    return ctx->Settings.AdrState == LORAWAN_ADR_ON && g_AdrAckCounter >= LORAWAN_ADR_ACK_LIMIT &&
+           !LoRaWAN_AdrAtFloor(ctx);
+}
+
+/* ADR_ACK_LIMIT uplinks without any downlink set ADRACKReq; every further
+ * ADR_ACK_DELAY uplinks first raise TX power to the maximum, then lower the
+ * DR one step at a time, and finally re-enable the default channels. Any
+ * downlink resets the counter. */
+static void LoRaWAN_AdrBackoff(LoRaWANContext_t *ctx)
+{
+    if (ctx->Settings.AdrState != LORAWAN_ADR_ON)
+    {
+        g_AdrAckCounter = 0;
+        return;
+    }
+
+    if (g_AdrAckCounter < UINT32_MAX)
+    {
+        g_AdrAckCounter++;
+    }
+
+    if (g_AdrAckCounter < (LORAWAN_ADR_ACK_LIMIT + LORAWAN_ADR_ACK_DELAY) ||
+        ((g_AdrAckCounter - LORAWAN_ADR_ACK_LIMIT) % LORAWAN_ADR_ACK_DELAY) != 0U)
+    {
+        return;
+    }
+
+    if (ctx->Settings.TxPower != 0U)
+    {
+        ctx->Settings.TxPower = 0U;
+    }
+    else if (ctx->Settings.DataRate > 0U)
+    {
+        ctx->Settings.DataRate--;
+    }
+    else
+    {
+        ctx->Settings.ChannelMask = LoRaWAN_RegionDefaultChannelMask(ctx->Settings.Region);
+    }
+    LoRaWAN_SaveMacState(ctx);
+}
+
+/* Puts an already built data frame on air on the next channel */
+static LoRaWANStatus_t LoRaWAN_TransmitFrame(LoRaWANContext_t *ctx, uint8_t *frame, uint8_t frameLen, uint8_t datarate)
+{
     const LoRaWANRegionParams_t *region = LoRaWAN_RegionGetParams(ctx->Settings.Region);
     if (region == NULL)
     {
         return LORAWAN_STATUS_ERROR;
     }
 
-    uint8_t channel = LoRaWAN_RegionGetNextChannel(ctx->Settings.Region, NULL);
+    uint8_t channel = LoRaWAN_RegionGetNextChannel(ctx->Settings.Region, ctx->Settings.ChannelMask, NULL);
     uint32_t uplinkFrequency = LoRaWAN_RegionGetUplinkFrequency(ctx->Settings.Region, channel);
     if (uplinkFrequency == 0)
     {
@@ -170,7 +496,7 @@ LoRaWANStatus_t LoRaWAN_Send(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8
 
     uint32_t bandwidth = 0;
     uint8_t spreadingFactor = 0;
-    if (!LoRaWAN_GetPhyParams(ctx->Settings.DataRate, &bandwidth, &spreadingFactor))
+    if (!LoRaWAN_GetPhyParams(datarate, &bandwidth, &spreadingFactor))
     {
         return LORAWAN_STATUS_INVALID_PARAM;
     }
@@ -180,7 +506,7 @@ LoRaWANStatus_t LoRaWAN_Send(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8
     g_CurrentOp = LORAWAN_OP_TX;
     g_LastTxChannel = channel;
     g_LastTxFrequency = uplinkFrequency;
-    g_LastTxDatarate = ctx->Settings.DataRate;
+    g_LastTxDatarate = datarate;
 
     Radio.SetModem(MODEM_LORA);
     Radio.SetChannel(uplinkFrequency);
@@ -188,18 +514,116 @@ LoRaWANStatus_t LoRaWAN_Send(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8
                       LoRaWAN_ComputeTxPowerDbm(ctx->Settings.TxPower, region),
                       0, bandwidth, spreadingFactor,
                       1, 8, false, true, 0, false, false, 3000);
+    LoRaWAN_BeginRadioCycle();
     Radio.Send(frame, frameLen);
 
-    ctx->Session->FCntUp++;
-    Storage_UpdateFrameCounters(ctx->Session->FCntUp, ctx->Session->FCntDown);
-
     return LORAWAN_STATUS_SUCCESS;
 }
 
+/* Backoff is RetryDelayMs +/- 50 % so devices that missed the same ACK do
+ * not retransmit in lockstep. xorshift32 seeded from the MCU unique ID. */
+static bool LoRaWAN_ScheduleRetransmission(void)
+{
+    if (!g_Retransmission.Active || g_ActiveCtx == NULL ||
+        g_Retransmission.Attempt >= g_Retransmission.MaxAttempts)
+    {
+        return false;
+    }
+
+    if (g_BackoffRandom == 0U)
+    {
+        g_BackoffRandom = BoardGetRandomSeed() ^ g_ActiveCtx->Session->DevAddr;
+        if (g_BackoffRandom == 0U)
+        {
+            g_BackoffRandom = 1U;
+        }
+    }
+    g_BackoffRandom ^= g_BackoffRandom << 13;
+    g_BackoffRandom ^= g_BackoffRandom >> 17;
+    g_BackoffRandom ^= g_BackoffRandom << 5;
+
+    uint32_t delay = g_ActiveCtx->Settings.RetryDelayMs;
+    delay = (delay / 2U) + (g_BackoffRandom % (delay + 1U));
+    if (delay < LoRaWAN_DutyCycleWaitMs())
+    {
+        delay = LoRaWAN_DutyCycleWaitMs();
+    }
+    if (delay == 0U)
+    {
+        delay = 1U;
+    }
+
+    TimerSetValue(&g_RetransmitTimer, delay);
+    TimerStart(&g_RetransmitTimer);
+    return true;
+}
+
+static void OnRetransmitTimerEvent(void *context)
+{
+    (void)context;
+
+    if (g_ActiveCtx == NULL || !g_Retransmission.Active)
+    {
+        return;
+    }
+
+    g_Retransmission.Attempt++;
+
+    /* LoRaWAN 1.0.x: fall back one DR after every two unacknowledged
+     * transmissions at the same rate */
+    if (g_ActiveCtx->Settings.RetryDrStepDown && (g_Retransmission.Attempt % 2U) == 1U &&
+        g_Retransmission.DataRate > 0U &&
+        LoRaWAN_RegionValidateDr(g_ActiveCtx->Settings.Region, (uint8_t)(g_Retransmission.DataRate - 1U)))
+    {
+        g_Retransmission.DataRate--;
+    }
+
+    if (LoRaWAN_TransmitFrame(g_ActiveCtx, g_Retransmission.Frame, g_Retransmission.FrameLen,
+                              g_Retransmission.DataRate) != LORAWAN_STATUS_SUCCESS)
+    {
+        LoRaWAN_CompleteUplink(LORAWAN_STATUS_SEND_FAILED);
+    }
+}
+
+/* Ends one data-uplink attempt. An unacknowledged confirmed frame goes back
+ * on air while attempts remain; otherwise the final result is reported once. */
+static void LoRaWAN_CompleteUplink(LoRaWANStatus_t status)
+{
+    if (status != LORAWAN_STATUS_SUCCESS && LoRaWAN_ScheduleRetransmission())
+    {
+        return;
+    }
+
+    g_Retransmission.Active = false;
+    g_CurrentOp = LORAWAN_OP_NONE;
+
+    if (g_ActiveCtx != NULL && g_ActiveCtx->Callbacks.OnTxComplete != NULL)
+    {
+        g_ActiveCtx->Callbacks.OnTxComplete(status);
+    }
+}
+
 void LoRaWAN_Process(LoRaWANContext_t *ctx)
 {
-    (void)ctx;
     TimerProcess();
+    LoRaWAN_PrecomputeNextUplink(ctx);
+
+    if (g_CycleEnergyReady)
+    {
+        g_CycleEnergyReady = false;
+        DEBUG_PRINT("LoRaWAN: cycle TX %lums RX %lums STBY %lums SLEEP %lums, %luuC (sleep saved %luuC)\r\n",
+                    (unsigned long)g_LastCycleEnergy.TxMs, (unsigned long)g_LastCycleEnergy.RxMs,
+                    (unsigned long)g_LastCycleEnergy.StandbyMs, (unsigned long)g_LastCycleEnergy.SleepMs,
+                    (unsigned long)g_LastCycleEnergy.ChargeUc, (unsigned long)g_LastCycleEnergy.SleepSavedUc);
+    }
+}
+
+void LoRaWAN_GetCycleEnergy(LoRaWANCycleEnergy_t *energy)
+{
+    if (energy != NULL)
+    {
+        *energy = g_LastCycleEnergy;
+    }
 }
 
 void LoRaWAN_RunRxWindow(LoRaWANContext_t *ctx, uint8_t window)
@@ -288,8 +712,118 @@ static int8_t LoRaWAN_ComputeTxPowerDbm(uint8_t txPowerIndex, const LoRaWANRegio
     return power;
 }
 
+/* Sizes an RX window the way LoRaMac-node's ComputeRxWindowParameters does:
+ * the radio must see LORAWAN_RX_MIN_SYMBOLS preamble symbols even if the
+ * window opens LORAWAN_RX_TIMER_ERROR_MS early or late, so the symbol timeout
+ * covers twice the error budget and the window is centred on the point where
+ * the gateway's preamble is expected to start (minus the radio wakeup time). */
+static bool LoRaWAN_ComputeRxWindowParams(uint8_t dr, LoRaWANRxWindowParams_t *params)
+{
+    uint32_t bandwidth = 0;
+    uint8_t spreadingFactor = 0;
+
+    if (params == NULL || !LoRaWAN_GetPhyParams(dr, &bandwidth, &spreadingFactor))
+    {
+        return false;
+    }
+
+    uint32_t bandwidthHz = 125000U << bandwidth;
+    uint32_t tSymbolUs = ((1UL << spreadingFactor) * 1000000UL) / bandwidthHz;
+    int32_t preambleUs = (2 * LORAWAN_RX_MIN_SYMBOLS - LORAWAN_RX_PREAMBLE_SYMBOLS) * (int32_t)tSymbolUs;
+    int32_t windowUs = preambleUs + 2 * LORAWAN_RX_TIMER_ERROR_MS * 1000;
+    uint32_t symbTimeout = ((uint32_t)windowUs + tSymbolUs - 1U) / tSymbolUs;
+
+    if (symbTimeout < LORAWAN_RX_MIN_SYMBOLS)
+    {
+        symbTimeout = LORAWAN_RX_MIN_SYMBOLS;
+    }
+    if (symbTimeout > LORAWAN_RX_SYMB_TIMEOUT_MAX)
+    {
+        symbTimeout = LORAWAN_RX_SYMB_TIMEOUT_MAX;
+    }
+
+    int32_t offsetUs = (int32_t)(LORAWAN_RX_PREAMBLE_SYMBOLS / 2 * tSymbolUs)
+                     - (int32_t)((symbTimeout * tSymbolUs + 1U) / 2U)
+                     - (int32_t)(Radio.GetWakeupTime() * 1000U);
+
+    params->SymbTimeout = (uint16_t)symbTimeout;
+    params->OffsetMs = (offsetUs < 0) ? -((-offsetUs + 999) / 1000) : (offsetUs + 999) / 1000;
+    return true;
+}
+
+static uint32_t LoRaWAN_ApplyRxWindowOffset(uint32_t delayMs, int32_t offsetMs)
+{
+    int32_t start = (int32_t)delayMs + offsetMs;
+
+    return (start < 1) ? 1U : (uint32_t)start;
+}
+
+/* Tracks which power state the SX1276 is in so each Class A cycle can be
+ * charged per state. TX and RX are entered by Radio.Send/Radio.Rx (which
+ * wake the radio and its TCXO); every other transition goes to sleep. */
+static void LoRaWAN_RadioSetState(LoRaWANRadioState_t state)
+{
+    if (g_CycleActive)
+    {
+        g_CycleStateMs[g_RadioState] += TimerGetElapsedTime(g_RadioStateSince);
+    }
+    g_RadioStateSince = TimerGetCurrentTime();
+    g_RadioState = state;
+}
+
+/* The radio sleeps between TxDone and RX1 and between RX1 and RX2 instead of
+ * idling in standby; the RX timers already fire Radio.GetWakeupTime() early
+ * (see LoRaWAN_ComputeRxWindowParams), which is the TCXO start-up lead the
+ * radio needs when Radio.Rx brings it back up. */
+static void LoRaWAN_RadioSleep(void)
+{
+    Radio.Sleep();
+    LoRaWAN_RadioSetState(LORAWAN_RADIO_STATE_SLEEP);
+}
+
+static void LoRaWAN_BeginRadioCycle(void)
+{
+    g_CycleActive = false;
+    LoRaWAN_RadioSetState(LORAWAN_RADIO_STATE_TX);
+    memset(g_CycleStateMs, 0, sizeof(g_CycleStateMs));
+    g_CycleActive = true;
+}
+
+static void LoRaWAN_EndRadioCycle(void)
+{
+    static const uint32_t currentUa[LORAWAN_RADIO_STATE_COUNT] = {
+        LORAWAN_RADIO_SLEEP_CURRENT_UA,
+        LORAWAN_RADIO_STANDBY_CURRENT_UA,
+        LORAWAN_RADIO_RX_CURRENT_UA,
+        LORAWAN_RADIO_TX_CURRENT_UA};
+
+    if (!g_CycleActive)
+    {
+        return;
+    }
+
+    LoRaWAN_RadioSetState(g_RadioState);
+    g_CycleActive = false;
+
+    uint32_t chargeNc = 0;
+    for (uint8_t i = 0; i < LORAWAN_RADIO_STATE_COUNT; i++)
+    {
+        chargeNc += g_CycleStateMs[i] * currentUa[i];
+    }
+
+    g_LastCycleEnergy.TxMs = g_CycleStateMs[LORAWAN_RADIO_STATE_TX];
+    g_LastCycleEnergy.RxMs = g_CycleStateMs[LORAWAN_RADIO_STATE_RX];
+    g_LastCycleEnergy.StandbyMs = g_CycleStateMs[LORAWAN_RADIO_STATE_STANDBY];
+    g_LastCycleEnergy.SleepMs = g_CycleStateMs[LORAWAN_RADIO_STATE_SLEEP];
+    g_LastCycleEnergy.ChargeUc = chargeNc / 1000U;
+    g_LastCycleEnergy.SleepSavedUc = (g_LastCycleEnergy.SleepMs *
+                                      (LORAWAN_RADIO_STANDBY_CURRENT_UA - LORAWAN_RADIO_SLEEP_CURRENT_UA)) / 1000U;
+    g_CycleEnergyReady = true;
+}
+
 static void LoRaWAN_ResetRxTracking(void)
 {
+    LoRaWAN_EndRadioCycle();
     TimerStop(&g_Rx1Timer);
     TimerStop(&g_Rx2Timer);
     g_Rx1Pending = false;
@@ -297,6 +831,12 @@ static void LoRaWAN_ResetRxTracking(void)
     g_ActiveRxWindow = 0;
 }
 
+static uint8_t LoRaWAN_GetRx1Datarate(LoRaWANContext_t *ctx)
+{
+    uint8_t offset = (g_CurrentOp == LORAWAN_OP_JOIN) ? 0U : ctx->Settings.Rx1DrOffset;
+    return LoRaWAN_RegionGetRx1DataRate(ctx->Settings.Region, g_LastTxDatarate, offset);
+}
+
 static void LoRaWAN_ScheduleRxWindows(LoRaWANContext_t *ctx)
 {
     if (ctx == NULL)
@@ -307,6 +847,15 @@ static void LoRaWAN_ScheduleRxWindows(LoRaWANContext_t *ctx)
     uint32_t rx1Delay = (g_CurrentOp == LORAWAN_OP_JOIN) ? ctx->Settings.JoinRx1DelayMs : ctx->Settings.Rx1DelayMs;
     uint32_t rx2Delay = (g_CurrentOp == LORAWAN_OP_JOIN) ? ctx->Settings.JoinRx2DelayMs : ctx->Settings.Rx2DelayMs;
 
+    if (LoRaWAN_ComputeRxWindowParams(LoRaWAN_GetRx1Datarate(ctx), &g_RxWindowParams[0]))
+    {
+        rx1Delay = LoRaWAN_ApplyRxWindowOffset(rx1Delay, g_RxWindowParams[0].OffsetMs);
+    }
+    if (LoRaWAN_ComputeRxWindowParams(ctx->Settings.Rx2DataRate, &g_RxWindowParams[1]))
+    {
+        rx2Delay = LoRaWAN_ApplyRxWindowOffset(rx2Delay, g_RxWindowParams[1].OffsetMs);
+    }
+
     if (rx1Delay == 0U)
     {
         rx1Delay = 1U;
@@ -343,8 +892,8 @@ static void LoRaWAN_OpenRxWindow(uint8_t window)
 
     if (window == 1)
     {
-        frequency = g_LastTxFrequency;
-        datarate = g_LastTxDatarate;
+        frequency = LoRaWAN_RegionGetRx1Frequency(g_ActiveCtx->Settings.Region, g_LastTxChannel);
+        datarate = LoRaWAN_GetRx1Datarate(g_ActiveCtx);
     }
     else
     {
@@ -368,10 +917,14 @@ static void LoRaWAN_OpenRxWindow(uint8_t window)
 
     Radio.SetModem(MODEM_LORA);
     Radio.SetChannel(frequency);
-    Radio.SetRxConfig(MODEM_LORA, bandwidth, spreadingFactor, 1, 0, 8, 8, false, 0, true, 0, false, false, false);
+    /* Single-shot RX: the radio gives up on its own after SymbTimeout symbols
+     * without a preamble; the millisecond timeout only bounds a locked frame. */
+    Radio.SetRxConfig(MODEM_LORA, bandwidth, spreadingFactor, 1, 0, LORAWAN_RX_PREAMBLE_SYMBOLS,
+                      g_RxWindowParams[window - 1].SymbTimeout, false, 0, true, 0, false, false, false);
 
     g_ActiveRxWindow = window;
-    Radio.Rx(1000);
+    LoRaWAN_RadioSetState(LORAWAN_RADIO_STATE_RX);
+    Radio.Rx(LORAWAN_RX_MAX_WINDOW_MS);
 }
 
 static void OnRx1TimerEvent(void *context)
@@ -388,17 +941,46 @@ static void OnRx2TimerEvent(void *context)
     LoRaWAN_OpenRxWindow(2);
 }
 
+/* DutyCycleReq: after each transmission stay silent for airtime * (2^n - 1).
+ * The deadline is only compared while an off period is running: a stale one
+ * would read as up to 24.8 days ahead once the uptime wraps past it. */
+static uint32_t LoRaWAN_DutyCycleWaitMs(void)
+{
+    if (!g_DutyCycleOff)
+    {
+        return 0;
+    }
+
+    int32_t remaining = (int32_t)(g_DutyCycleOffUntil - TimerGetCurrentTime());
+    if (remaining <= 0 || g_ActiveCtx == NULL || g_ActiveCtx->Settings.MaxDutyCycle == 0U)
+    {
+        g_DutyCycleOff = false;
+        return 0;
+    }
+
+    return (uint32_t)remaining;
+}
+
 static void OnRadioTxDone(void)
 {
-    Radio.Standby();
+    TimerTime_t airtime = TimerGetElapsedTime(g_RadioStateSince);
+    LoRaWAN_RadioSleep();
+
+    if (g_ActiveCtx != NULL && g_ActiveCtx->Settings.MaxDutyCycle > 0U)
+    {
+        g_DutyCycleOffUntil = TimerGetCurrentTime() + airtime * ((1UL << g_ActiveCtx->Settings.MaxDutyCycle) - 1UL);
+        g_DutyCycleOff = true;
+    }
 
     if (g_ActiveCtx == NULL)
     {
+        LoRaWAN_EndRadioCycle();
         return;
     }
 
     if (g_CurrentOp == LORAWAN_OP_NONE)
     {
+        LoRaWAN_EndRadioCycle();
         if (g_ActiveCtx->Callbacks.OnTxComplete != NULL)
         {
             g_ActiveCtx->Callbacks.OnTxComplete(LORAWAN_STATUS_SUCCESS);
@@ -411,7 +993,7 @@ static void OnRadioTxDone(void)
 
 static void OnRadioTxTimeout(void)
 {
-    Radio.Standby();
+    LoRaWAN_RadioSleep();
     LoRaWAN_ResetRxTracking();
 
     if (g_CurrentOp == LORAWAN_OP_JOIN)
@@ -420,11 +1002,7 @@ static void OnRadioTxTimeout(void)
         return;
     }
 
-    if (g_ActiveCtx != NULL && g_ActiveCtx->Callbacks.OnTxComplete != NULL)
-    {
-        g_ActiveCtx->Callbacks.OnTxComplete(LORAWAN_STATUS_SEND_FAILED);
-    }
-    g_CurrentOp = LORAWAN_OP_NONE;
+    LoRaWAN_CompleteUplink(LORAWAN_STATUS_SEND_FAILED);
 }
 
 static LoRaWANStatus_t LoRaWAN_HandleJoinAccept(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8_t size)
@@ -454,11 +1032,12 @@ static void LoRaWAN_HandleJoinFailure(void)
 
 static void OnRadioRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
 {
-    Radio.Standby();
-    LoRaWAN_ResetRxTracking();
+    LoRaWAN_RadioSleep();
 
     if (g_CurrentOp == LORAWAN_OP_JOIN)
     {
+        LoRaWAN_ResetRxTracking();
+
         if (LoRaWAN_HandleJoinAccept(g_ActiveCtx, payload, (uint8_t)size) == LORAWAN_STATUS_SUCCESS)
         {
             g_CurrentOp = LORAWAN_OP_NONE;
@@ -475,16 +1054,42 @@ static void OnRadioRxDone(uint8_t *payload, uint16_t size, int16_t rssi, int8_t
         return;
     }
 
-    g_CurrentOp = LORAWAN_OP_NONE;
+    /* Foreign, corrupt or replayed frames count as an empty window, so
+     * RX2 still opens after a rejected RX1 frame. */
+    LoRaWANDownlink_t frame;
+    if (size > 0xFF || !LoRaWAN_DecodeDownlink(g_ActiveCtx, payload, (uint8_t)size, &frame))
+    {
+        OnRadioRxError();
+        return;
+    }
 
-    if (g_ActiveCtx != NULL && g_ActiveCtx->Callbacks.OnTxComplete != NULL)
+    LoRaWAN_ResetRxTracking();
+
+    /* FOpts and a port-0 payload never come together (checked in decode) */
+    LoRaWANMacRxInfo_t rxInfo = {
+        .Snr = snr,
+        .BatteryLevel = (g_ActiveCtx->Callbacks.GetBatteryLevel != NULL) ? g_ActiveCtx->Callbacks.GetBatteryLevel() : 255U};
+    LoRaWAN_Mac_OnDownlinkReceived();
+    g_AdrAckCounter = 0;
+    if (frame.FOptsLen > 0)
     {
-        g_ActiveCtx->Callbacks.OnTxComplete(LORAWAN_STATUS_SUCCESS);
+        LoRaWAN_Mac_ProcessCommands(&g_ActiveCtx->Settings, frame.FOpts, frame.FOptsLen, &rxInfo);
     }
+    else if (frame.HasPort && frame.Port == 0)
+    {
+        LoRaWAN_Mac_ProcessCommands(&g_ActiveCtx->Settings, frame.FrmPayload, frame.FrmPayloadLen, &rxInfo);
+    }
+    if (frame.FOptsLen > 0 || (frame.HasPort && frame.Port == 0))
+    {
+        LoRaWAN_SaveMacState(g_ActiveCtx);
+    }
+
+    bool acked = (frame.FCtrl & LORAWAN_FCTRL_ACK) != 0U;
+    LoRaWAN_CompleteUplink((g_Retransmission.Active && !acked) ? LORAWAN_STATUS_NO_ACK : LORAWAN_STATUS_SUCCESS);
 
-    if (g_ActiveCtx != NULL && g_ActiveCtx->Callbacks.OnRxData != NULL)
+    if (frame.HasPort && g_ActiveCtx->Callbacks.OnRxData != NULL)
     {
-        g_ActiveCtx->Callbacks.OnRxData(payload, (uint8_t)size, 0, rssi, snr);
+        g_ActiveCtx->Callbacks.OnRxData(frame.FrmPayload, frame.FrmPayloadLen, frame.Port, rssi, snr);
     }
 }
 
@@ -498,17 +1103,12 @@ static void LoRaWAN_HandleRxWindowComplete(void)
         return;
     }
 
-    if (g_ActiveCtx != NULL && g_ActiveCtx->Callbacks.OnTxComplete != NULL)
-    {
-        g_ActiveCtx->Callbacks.OnTxComplete(LORAWAN_STATUS_SUCCESS);
-    }
-
-    g_CurrentOp = LORAWAN_OP_NONE;
+    LoRaWAN_CompleteUplink(g_Retransmission.Active ? LORAWAN_STATUS_NO_ACK : LORAWAN_STATUS_SUCCESS);
 }
 
 static void OnRadioRxTimeout(void)
 {
-    Radio.Standby();
+    LoRaWAN_RadioSleep();
     uint8_t window = g_ActiveRxWindow;
     g_ActiveRxWindow = 0;
 
@@ -597,9 +1197,16 @@ static LoRaWANStatus_t LoRaWAN_ParseJoinAccept(LoRaWANContext_t *ctx, const uint
         return LORAWAN_STATUS_ERROR;
     }
 
+    if (!LoRaWAN_LoadCryptoSession(ctx))
+    {
+        return LORAWAN_STATUS_ERROR;
+    }
+
     ctx->Session->Joined = true;
     ctx->Session->FCntUp = 0;
     ctx->Session->FCntDown = 0;
+    LoRaWAN_Mac_Reset();
+    g_AdrAckCounter = 0;
 
     if (ctx->Callbacks.OnJoinSuccess)
     {
@@ -611,13 +1218,36 @@ static LoRaWANStatus_t LoRaWAN_ParseJoinAccept(LoRaWANContext_t *ctx, const uint
     return LORAWAN_STATUS_SUCCESS;
 }
 
-static LoRaWANStatus_t LoRaWAN_BuildUplink(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8_t size, uint8_t port, LoRaWANMsgType_t msgType, uint8_t *out, uint8_t *outLen)
+static LoRaWANStatus_t LoRaWAN_BuildUplink(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8_t size, uint8_t port, LoRaWANMsgType_t msgType, uint8_t **frame, uint8_t *frameLen)
 {
-    if (ctx == NULL || buffer == NULL || out == NULL || outLen == NULL)
+    if (ctx == NULL || buffer == NULL || frame == NULL || frameLen == NULL || size > LORAWAN_MAX_PAYLOAD_LEN)
     {
         return LORAWAN_STATUS_INVALID_PARAM;
     }
 
+    const LoRaWANCryptoSession_t *crypto = LoRaWAN_GetCryptoSession(ctx);
+    if (crypto == NULL)
+    {
+        return LORAWAN_STATUS_ERROR;
+    }
+
+    /* Payloads encoded through LoRaWAN_GetTxPayloadBuffer are already in place */
+    uint8_t *payload = &ctx->RadioBuffer[LORAWAN_TX_PAYLOAD_OFFSET];
+    if (buffer != payload)
+    {
+        memmove(payload, buffer, size);
+    }
+
+    if (!LoRaWAN_Crypto_SessionEncryptPayload(crypto, &g_NextUplinkKeystream, payload, size, ctx->Session->DevAddr, ctx->Session->FCntUp, UPSTREAM_DIR, payload))
+    {
+        return LORAWAN_STATUS_ERROR;
+    }
+
+    /* Pending MAC answers ride in FOpts, in the room reserved before FPort */
+    uint8_t fOpts[LORAWAN_MAX_FOPTS_LEN];
+    uint8_t fOptsLen = LoRaWAN_Mac_GetAnswers(fOpts, sizeof(fOpts));
+
+    uint8_t *out = payload - (LORAWAN_MHDR_LEN + LORAWAN_FHDR_MIN_LEN + fOptsLen + 1);
     uint8_t idx = 0;
     out[idx++] = (msgType == LORAWAN_MSG_CONFIRMED) ? 0x80 : 0x40;
     out[idx++] = ctx->Session->DevAddr & 0xFF;
@@ -625,22 +1255,19 @@ static LoRaWANStatus_t LoRaWAN_BuildUplink(LoRaWANContext_t *ctx, const uint8_t
     out[idx++] = (ctx->Session->DevAddr >> 16) & 0xFF;
     out[idx++] = (ctx->Session->DevAddr >> 24) & 0xFF;
 
-    out[idx++] = 0x00; /* FCtrl */
+    out[idx++] = ((ctx->Settings.AdrState == LORAWAN_ADR_ON) ? LORAWAN_FCTRL_ADR : 0x00) |
+                 (LoRaWAN_AdrAckRequested(ctx) ? LORAWAN_FCTRL_ADR_ACK_REQ : 0x00) |
+                 (g_DownlinkAckPending ? LORAWAN_FCTRL_ACK : 0x00) | fOptsLen; /* FCtrl */
     out[idx++] = ctx->Session->FCntUp & 0xFF;
     out[idx++] = (ctx->Session->FCntUp >> 8) & 0xFF;
+    memcpy(&out[idx], fOpts, fOptsLen);
+    idx += fOptsLen;
 
     out[idx++] = port;
-
-    uint8_t encPayload[255];
-    if (!LoRaWAN_Crypto_EncryptPayload(ctx->Session->AppSKey, buffer, size, ctx->Session->DevAddr, ctx->Session->FCntUp, UPSTREAM_DIR, encPayload))
-    {
-        return LORAWAN_STATUS_ERROR;
-    }
-    memcpy(&out[idx], encPayload, size);
-    idx += size;
+    idx += size; /* FRMPayload already encrypted in place */
 
     uint32_t mic = 0;
-    if (!LoRaWAN_Crypto_ComputeMic(ctx->Session->NwkSKey, out, idx, ctx->Session->DevAddr, ctx->Session->FCntUp, UPSTREAM_DIR, &mic))
+    if (!LoRaWAN_Crypto_SessionComputeMic(crypto, out, idx, ctx->Session->DevAddr, ctx->Session->FCntUp, UPSTREAM_DIR, &mic))
     {
         return LORAWAN_STATUS_ERROR;
     }
@@ -650,6 +1277,150 @@ static LoRaWANStatus_t LoRaWAN_BuildUplink(LoRaWANContext_t *ctx, const uint8_t
     out[idx++] = (mic >> 16) & 0xFF;
     out[idx++] = (mic >> 24) & 0xFF;
 
-    *outLen = idx;
+    *frame = out;
+    *frameLen = idx;
     return LORAWAN_STATUS_SUCCESS;
 }
+
+static const LoRaWANCryptoSession_t *LoRaWAN_GetCryptoSession(LoRaWANContext_t *ctx)
+{
+    /* Keys normally expand on join/activation; this only covers sessions
+     * marked joined by other means. */
+    if (!g_CryptoSession.Valid && !LoRaWAN_LoadCryptoSession(ctx))
+    {
+        return NULL;
+    }
+
+    return &g_CryptoSession;
+}
+
+static bool LoRaWAN_LoadCryptoSession(LoRaWANContext_t *ctx)
+{
+    /* New keys may reuse DevAddr/FCnt of the old session */
+    g_NextUplinkKeystream.Valid = false;
+    return LoRaWAN_Crypto_SessionInit(&g_CryptoSession, ctx->Session->NwkSKey, ctx->Session->AppSKey);
+}
+
+/* Idle-time job: the CTR blocks of the next uplink depend only on DevAddr
+ * and FCntUp, so encrypt them while the application gathers its payload. */
+static void LoRaWAN_PrecomputeNextUplink(LoRaWANContext_t *ctx)
+{
+    if (ctx == NULL || ctx->Session == NULL || !ctx->Session->Joined || g_CurrentOp != LORAWAN_OP_NONE)
+    {
+        return;
+    }
+
+    if (g_NextUplinkKeystream.Valid &&
+        g_NextUplinkKeystream.FCnt == ctx->Session->FCntUp &&
+        g_NextUplinkKeystream.DevAddr == ctx->Session->DevAddr)
+    {
+        return;
+    }
+
+    const LoRaWANCryptoSession_t *crypto = LoRaWAN_GetCryptoSession(ctx);
+    if (crypto != NULL)
+    {
+        LoRaWAN_Crypto_SessionPrecomputeKeystream(crypto, ctx->Session->DevAddr, ctx->Session->FCntUp,
+                                                  UPSTREAM_DIR, &g_NextUplinkKeystream);
+    }
+}
+
+/* Parse MHDR/FHDR in place, reject on DevAddr/FCnt/MIC before spending any
+ * AES-CTR work, then decrypt FRMPayload over itself. Session.FCntDown holds
+ * the next expected downlink counter. */
+static bool LoRaWAN_DecodeDownlink(LoRaWANContext_t *ctx, uint8_t *buffer, uint8_t size, LoRaWANDownlink_t *frame)
+{
+    if (ctx == NULL || ctx->Session == NULL || !ctx->Session->Joined || buffer == NULL || frame == NULL ||
+        size < (LORAWAN_MHDR_LEN + LORAWAN_FHDR_MIN_LEN + LORAWAN_MIC_LEN))
+    {
+        return false;
+    }
+
+    uint8_t mtype = buffer[0] & LORAWAN_MTYPE_MASK;
+    if (mtype != LORAWAN_MTYPE_UNCONFIRMED_DOWN && mtype != LORAWAN_MTYPE_CONFIRMED_DOWN)
+    {
+        return false;
+    }
+
+    uint32_t devAddr = (uint32_t)buffer[1] | ((uint32_t)buffer[2] << 8) |
+                       ((uint32_t)buffer[3] << 16) | ((uint32_t)buffer[4] << 24);
+    if (devAddr != ctx->Session->DevAddr)
+    {
+        return false;
+    }
+
+    frame->MHdr = buffer[0];
+    frame->FCtrl = buffer[5];
+    frame->FOptsLen = frame->FCtrl & LORAWAN_FCTRL_FOPTS_LEN_MASK;
+    frame->FOpts = &buffer[LORAWAN_MHDR_LEN + LORAWAN_FHDR_MIN_LEN];
+
+    uint8_t micOffset = size - LORAWAN_MIC_LEN;
+    uint8_t portOffset = LORAWAN_MHDR_LEN + LORAWAN_FHDR_MIN_LEN + frame->FOptsLen;
+    if (portOffset > micOffset)
+    {
+        return false;
+    }
+
+    /* Rebuild the 32-bit counter from its transmitted low 16 bits */
+    uint16_t fCnt16 = (uint16_t)(buffer[6] | (buffer[7] << 8));
+    uint32_t expected = ctx->Session->FCntDown;
+    uint32_t fCnt = (expected & 0xFFFF0000UL) | fCnt16;
+    if (fCnt16 < (uint16_t)(expected & 0xFFFF))
+    {
+        fCnt += 0x10000UL;
+    }
+
+    if (!ctx->Session->DisableFrameCounterCheck && (fCnt - expected) >= LORAWAN_MAX_FCNT_GAP)
+    {
+        return false;
+    }
+
+    const LoRaWANCryptoSession_t *crypto = LoRaWAN_GetCryptoSession(ctx);
+    uint32_t mic = 0;
+    if (crypto == NULL ||
+        !LoRaWAN_Crypto_SessionComputeMic(crypto, buffer, micOffset, devAddr, fCnt, DOWNSTREAM_DIR, &mic))
+    {
+        return false;
+    }
+
+    uint32_t rxMic = (uint32_t)buffer[micOffset] | ((uint32_t)buffer[micOffset + 1] << 8) |
+                     ((uint32_t)buffer[micOffset + 2] << 16) | ((uint32_t)buffer[micOffset + 3] << 24);
+    if (mic != rxMic)
+    {
+        return false;
+    }
+
+    frame->FCnt = fCnt;
+    frame->HasPort = (portOffset < micOffset);
+    frame->Port = frame->HasPort ? buffer[portOffset] : 0;
+    frame->FrmPayload = &buffer[frame->HasPort ? portOffset + 1 : portOffset];
+    frame->FrmPayloadLen = frame->HasPort ? (uint8_t)(micOffset - portOffset - 1) : 0;
+
+    /* FOpts and a port-0 payload are mutually exclusive */
+    if (frame->HasPort && frame->Port == 0 && frame->FOptsLen > 0)
+    {
+        return false;
+    }
+
+    if (frame->FrmPayloadLen > 0)
+    {
+        bool ok = (frame->Port == 0)
+                      ? LoRaWAN_Crypto_SessionEncryptMacPayload(crypto, frame->FrmPayload, frame->FrmPayloadLen,
+                                                                devAddr, fCnt, DOWNSTREAM_DIR, frame->FrmPayload)
+                      : LoRaWAN_Crypto_SessionEncryptPayload(crypto, NULL, frame->FrmPayload, frame->FrmPayloadLen,
+                                                             devAddr, fCnt, DOWNSTREAM_DIR, frame->FrmPayload);
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    ctx->Session->FCntDown = fCnt + 1;
+    if (mtype == LORAWAN_MTYPE_CONFIRMED_DOWN)
+    {
+        g_DownlinkAckPending = true;
+    }
+    Storage_UpdateFrameCounters(ctx->Session->FCntUp, ctx->Session->FCntDown);
+
+    return true;
+}
@@ -9,12 +9,35 @@
 extern "C" {
 #endif
 
+/* Uplinks are built in place in RadioBuffer: FRMPayload always starts at
+ * LORAWAN_TX_PAYLOAD_OFFSET and MHDR/FHDR/FPort are written right-aligned
+ * in front of it, so the frame start moves back only by the FOpts length. */
+#define LORAWAN_MHDR_LEN           1
+#define LORAWAN_FHDR_MIN_LEN       7
+#define LORAWAN_MIC_LEN            4
+#define LORAWAN_TX_PAYLOAD_OFFSET  (LORAWAN_MHDR_LEN + LORAWAN_FHDR_MIN_LEN + LORAWAN_MAX_FOPTS_LEN + 1)
+#define LORAWAN_RADIO_BUFFER_SIZE  (LORAWAN_TX_PAYLOAD_OFFSET + LORAWAN_MAX_PAYLOAD_LEN + LORAWAN_MIC_LEN)
+
+/* Radio on-time and charge of the last Class A cycle, from Radio.Send until
+ * the last RX window closes. SleepSavedUc is what the same sleep time would
+ * have cost with the radio parked in standby. */
+typedef struct
+{
+    uint32_t TxMs;
+    uint32_t RxMs;
+    uint32_t StandbyMs;
+    uint32_t SleepMs;
+    uint32_t ChargeUc;
+    uint32_t SleepSavedUc;
+} LoRaWANCycleEnergy_t;
+
 typedef struct
 {
     void (*OnJoinSuccess)(uint32_t devAddr);
     void (*OnJoinFailure)(void);
     void (*OnTxComplete)(LoRaWANStatus_t status);
     void (*OnRxData)(const uint8_t *buffer, uint8_t size, uint8_t port, int16_t rssi, int8_t snr);
+    uint8_t (*GetBatteryLevel)(void); /* DevStatusAns: 0 external, 1..254, 255 unknown */
 } LoRaWANCallbacks_t;
 
 typedef struct
@@ -27,11 +50,16 @@ typedef struct
 } LoRaWANContext_t;
 
 LoRaWANStatus_t LoRaWAN_Init(LoRaWANContext_t *ctx);
+LoRaWANStatus_t LoRaWAN_ActivatePersonalization(LoRaWANContext_t *ctx); /* ABP: DevAddr/session keys preloaded */
+LoRaWANStatus_t LoRaWAN_RestoreSession(LoRaWANContext_t *ctx); /* OTAA: resume a persisted join */
 LoRaWANStatus_t LoRaWAN_RequestJoin(LoRaWANContext_t *ctx);
+uint8_t *LoRaWAN_GetTxPayloadBuffer(LoRaWANContext_t *ctx, uint8_t *maxSize);
 LoRaWANStatus_t LoRaWAN_Send(LoRaWANContext_t *ctx, const uint8_t *buffer, uint8_t size, uint8_t port, LoRaWANMsgType_t msgType);
 void LoRaWAN_Process(LoRaWANContext_t *ctx);
 void LoRaWAN_RunRxWindow(LoRaWANContext_t *ctx, uint8_t window); /* window: 1 or 2 */
 void LoRaWAN_HandleRadioEvent(LoRaWANContext_t *ctx);
+void LoRaWAN_GetCycleEnergy(LoRaWANCycleEnergy_t *energy);
+bool LoRaWAN_IsBusy(LoRaWANContext_t *ctx);
 
 #ifdef __cplusplus
 }
@@ -1,8 +1,6 @@
 #include <string.h>
 #include "lorawan_crypto.h"
 #include "lorawan_types.h"
-#include "aes.h"
-#include "cmac.h"
 
 #define LORAWAN_BLOCK_SIZE 16
 
@@ -123,6 +121,50 @@ bool LoRaWAN_Crypto_ComputeMic(const uint8_t *nwkSKey, const uint8_t *payload,
     return true;
 }
 
+static bool EncryptCtr(const aes_context *aes, const LoRaWANKeystream_t *keystream,
+                       const uint8_t *input, uint8_t length, uint32_t devAddr,
+                       uint32_t fCnt, uint8_t direction, uint8_t *output)
+{
+    uint8_t a[LORAWAN_BLOCK_SIZE];
+    uint8_t s[LORAWAN_BLOCK_SIZE];
+    uint16_t counter = 1;
+    uint8_t blockCount = (length + LORAWAN_BLOCK_SIZE - 1) / LORAWAN_BLOCK_SIZE;
+    uint8_t cachedBlocks = 0;
+
+    if (keystream != NULL && keystream->Valid && keystream->DevAddr == devAddr &&
+        keystream->FCnt == fCnt && keystream->Direction == direction)
+    {
+        cachedBlocks = LORAWAN_CRYPTO_KEYSTREAM_BLOCKS;
+    }
+
+    for (uint8_t i = 0; i < blockCount; i++)
+    {
+        const uint8_t *block = s;
+        if (i < cachedBlocks)
+        {
+            block = &keystream->S[i * LORAWAN_BLOCK_SIZE];
+            counter++;
+        }
+        else
+        {
+            PrepareAi(a, direction, devAddr, fCnt, counter++);
+            if (aes_encrypt(a, s, aes) != 0)
+            {
+                return false;
+            }
+        }
+
+        uint8_t blockSize = (length >= LORAWAN_BLOCK_SIZE) ? LORAWAN_BLOCK_SIZE : length;
+        for (uint8_t j = 0; j < blockSize; j++)
+        {
+            output[i * LORAWAN_BLOCK_SIZE + j] = input[i * LORAWAN_BLOCK_SIZE + j] ^ block[j];
+        }
+        length -= blockSize;
+    }
+
+    return true;
+}
+
 bool LoRaWAN_Crypto_EncryptPayload(const uint8_t *key, const uint8_t *input,
                                    uint8_t length, uint32_t devAddr, uint32_t fCnt,
                                    uint8_t direction, uint8_t *output)
@@ -138,26 +180,109 @@ bool LoRaWAN_Crypto_EncryptPayload(const uint8_t *key, const uint8_t *input,
         return false;
     }
 
+    return EncryptCtr(&ctx, NULL, input, length, devAddr, fCnt, direction, output);
+}
+
+bool LoRaWAN_Crypto_SessionInit(LoRaWANCryptoSession_t *session, const uint8_t *nwkSKey,
+                                const uint8_t *appSKey)
+{
+    if (session == NULL || nwkSKey == NULL || appSKey == NULL)
+    {
+        return false;
+    }
+
+    session->Valid = false;
+    if (aes_set_key(appSKey, 16, &session->AppSKey) != 0)
+    {
+        return false;
+    }
+    AES_CMAC_PrepareKey(&session->NwkSKey, nwkSKey);
+
+    session->Valid = true;
+    return true;
+}
+
+void LoRaWAN_Crypto_SessionClear(LoRaWANCryptoSession_t *session)
+{
+    if (session != NULL)
+    {
+        memset(session, 0, sizeof(*session));
+    }
+}
+
+bool LoRaWAN_Crypto_SessionComputeMic(const LoRaWANCryptoSession_t *session, const uint8_t *payload,
+                                      uint8_t length, uint32_t devAddr, uint32_t fCnt,
+                                      uint8_t direction, uint32_t *mic)
+{
+    if (session == NULL || !session->Valid || payload == NULL || mic == NULL)
+    {
+        return false;
+    }
+
+    uint8_t b0[LORAWAN_BLOCK_SIZE];
+    uint8_t digest[AES_CMAC_DIGEST_LENGTH];
+    AES_CMAC_KEYED_CTX ctx;
+
+    PrepareB0(b0, direction, devAddr, fCnt, length);
+
+    AES_CMAC_KeyedInit(&ctx, &session->NwkSKey);
+    AES_CMAC_KeyedUpdate(&ctx, b0, LORAWAN_BLOCK_SIZE);
+    AES_CMAC_KeyedUpdate(&ctx, payload, length);
+    AES_CMAC_KeyedFinal(digest, &ctx);
+
+    *mic = (uint32_t)digest[0] | ((uint32_t)digest[1] << 8) |
+           ((uint32_t)digest[2] << 16) | ((uint32_t)digest[3] << 24);
+    return true;
+}
+
+bool LoRaWAN_Crypto_SessionPrecomputeKeystream(const LoRaWANCryptoSession_t *session, uint32_t devAddr,
+                                                uint32_t fCnt, uint8_t direction, LoRaWANKeystream_t *keystream)
+{
+    if (session == NULL || !session->Valid || keystream == NULL)
+    {
+        return false;
+    }
+
     uint8_t a[LORAWAN_BLOCK_SIZE];
-    uint8_t s[LORAWAN_BLOCK_SIZE];
-    uint16_t counter = 1;
-    uint8_t blockCount = (length + LORAWAN_BLOCK_SIZE - 1) / LORAWAN_BLOCK_SIZE;
 
-    for (uint8_t i = 0; i < blockCount; i++)
+    keystream->Valid = false;
+    for (uint8_t i = 0; i < LORAWAN_CRYPTO_KEYSTREAM_BLOCKS; i++)
     {
-        PrepareAi(a, direction, devAddr, fCnt, counter++);
-        if (aes_encrypt(a, s, &ctx) != 0)
+        PrepareAi(a, direction, devAddr, fCnt, (uint16_t)(i + 1));
+        if (aes_encrypt(a, &keystream->S[i * LORAWAN_BLOCK_SIZE], &session->AppSKey) != 0)
         {
             return false;
         }
-
-        uint8_t blockSize = (length >= LORAWAN_BLOCK_SIZE) ? LORAWAN_BLOCK_SIZE : length;
-        for (uint8_t j = 0; j < blockSize; j++)
-        {
-            output[i * LORAWAN_BLOCK_SIZE + j] = input[i * LORAWAN_BLOCK_SIZE + j] ^ s[j];
-        }
-        length -= blockSize;
     }
 
+    keystream->DevAddr = devAddr;
+    keystream->FCnt = fCnt;
+    keystream->Direction = direction;
+    keystream->Valid = true;
     return true;
 }
+
+bool LoRaWAN_Crypto_SessionEncryptPayload(const LoRaWANCryptoSession_t *session, const LoRaWANKeystream_t *keystream,
+                                          const uint8_t *input, uint8_t length, uint32_t devAddr,
+                                          uint32_t fCnt, uint8_t direction, uint8_t *output)
+{
+    if (session == NULL || !session->Valid || input == NULL || output == NULL)
+    {
+        return false;
+    }
+
+    return EncryptCtr(&session->AppSKey, keystream, input, length, devAddr, fCnt, direction, output);
+}
+
+/* FPort 0 FRMPayload carries MAC commands and is encrypted with NwkSKey */
+bool LoRaWAN_Crypto_SessionEncryptMacPayload(const LoRaWANCryptoSession_t *session, const uint8_t *input,
+                                             uint8_t length, uint32_t devAddr, uint32_t fCnt,
+                                             uint8_t direction, uint8_t *output)
+{
+    if (session == NULL || !session->Valid || input == NULL || output == NULL)
+    {
+        return false;
+    }
+
+    return EncryptCtr(&session->NwkSKey.rijndael, NULL, input, length, devAddr, fCnt, direction, output);
+}
@@ -3,10 +3,42 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "aes.h"
+#include "cmac.h"
+
+/* Number of AES-CTR blocks precomputed ahead of the next uplink */
+#ifndef LORAWAN_CRYPTO_KEYSTREAM_BLOCKS
+#define LORAWAN_CRYPTO_KEYSTREAM_BLOCKS 2
+#endif
+
+/* Session keys expanded once per join/activation and reused for every frame */
+typedef struct
+{
+    aes_context AppSKey;
+    AES_CMAC_KEY NwkSKey;
+    bool Valid;
+} LoRaWANCryptoSession_t;
+
+/* AES-CTR keystream for one (DevAddr, FCnt, direction); payload independent */
+typedef struct
+{
+    uint8_t S[LORAWAN_CRYPTO_KEYSTREAM_BLOCKS * 16];
+    uint32_t DevAddr;
+    uint32_t FCnt;
+    uint8_t Direction;
+    bool Valid;
+} LoRaWANKeystream_t;
 
 bool LoRaWAN_Crypto_ComputeJoinMic(const uint8_t *appKey, const uint8_t *joinRequest, uint8_t length, uint32_t *mic);
 bool LoRaWAN_Crypto_ComputeJoinKeys(const uint8_t *appKey, const uint8_t *appNonce, const uint8_t *netId, const uint8_t *devNonce, uint8_t *nwkSKey, uint8_t *appSKey);
 bool LoRaWAN_Crypto_ComputeMic(const uint8_t *nwkSKey, const uint8_t *payload, uint8_t length, uint32_t devAddr, uint32_t fCnt, uint8_t direction, uint32_t *mic);
 bool LoRaWAN_Crypto_EncryptPayload(const uint8_t *key, const uint8_t *input, uint8_t length, uint32_t devAddr, uint32_t fCnt, uint8_t direction, uint8_t *output);
 
+bool LoRaWAN_Crypto_SessionInit(LoRaWANCryptoSession_t *session, const uint8_t *nwkSKey, const uint8_t *appSKey);
+void LoRaWAN_Crypto_SessionClear(LoRaWANCryptoSession_t *session);
+bool LoRaWAN_Crypto_SessionComputeMic(const LoRaWANCryptoSession_t *session, const uint8_t *payload, uint8_t length, uint32_t devAddr, uint32_t fCnt, uint8_t direction, uint32_t *mic);
+bool LoRaWAN_Crypto_SessionPrecomputeKeystream(const LoRaWANCryptoSession_t *session, uint32_t devAddr, uint32_t fCnt, uint8_t direction, LoRaWANKeystream_t *keystream);
+bool LoRaWAN_Crypto_SessionEncryptPayload(const LoRaWANCryptoSession_t *session, const LoRaWANKeystream_t *keystream, const uint8_t *input, uint8_t length, uint32_t devAddr, uint32_t fCnt, uint8_t direction, uint8_t *output);
+bool LoRaWAN_Crypto_SessionEncryptMacPayload(const LoRaWANCryptoSession_t *session, const uint8_t *input, uint8_t length, uint32_t devAddr, uint32_t fCnt, uint8_t direction, uint8_t *output);
+
 #endif /* LORAWAN_CRYPTO_H */
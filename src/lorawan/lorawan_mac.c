@@ -0,0 +1,330 @@
+#include <stddef.h>
+#include <string.h>
+#include "lorawan_mac.h"
+#include "lorawan_region.h"
+
+#define LORAWAN_MAC_ANSWERS_MAX_LEN  LORAWAN_MAX_FOPTS_LEN
+
+/* LinkADRAns / RXParamSetupAns status bits */
+#define LORAWAN_MAC_LINK_ADR_CHMASK_ACK   0x01
+#define LORAWAN_MAC_LINK_ADR_DR_ACK       0x02
+#define LORAWAN_MAC_LINK_ADR_POWER_ACK    0x04
+#define LORAWAN_MAC_LINK_ADR_ALL_ACK      0x07
+#define LORAWAN_MAC_RX_PARAM_CHANNEL_ACK  0x01
+#define LORAWAN_MAC_RX_PARAM_RX2_DR_ACK   0x02
+#define LORAWAN_MAC_RX_PARAM_OFFSET_ACK   0x04
+#define LORAWAN_MAC_RX_PARAM_ALL_ACK      0x07
+
+#define LORAWAN_MAC_KEEP_CURRENT          0x0F /* DR/TXPower nibble: no change */
+
+typedef struct
+{
+    uint8_t Buffer[LORAWAN_MAC_ANSWERS_MAX_LEN];
+    uint8_t Length;
+} LoRaWANMacAnswers_t;
+
+typedef void (*LoRaWANMacHandler_t)(LoRaWANSettings_t *settings, const uint8_t *payload, uint8_t count, const LoRaWANMacRxInfo_t *rxInfo);
+
+typedef struct
+{
+    uint8_t Cid;
+    uint8_t PayloadLen;  /* Request bytes after the CID */
+    bool Block;          /* Consecutive requests are applied as one */
+    LoRaWANMacHandler_t Handler; /* NULL: length known, command not supported */
+} LoRaWANMacCommand_t;
+
+static void LoRaWAN_Mac_HandleLinkAdr(LoRaWANSettings_t *settings, const uint8_t *payload, uint8_t count, const LoRaWANMacRxInfo_t *rxInfo);
+static void LoRaWAN_Mac_HandleDutyCycle(LoRaWANSettings_t *settings, const uint8_t *payload, uint8_t count, const LoRaWANMacRxInfo_t *rxInfo);
+static void LoRaWAN_Mac_HandleRxParamSetup(LoRaWANSettings_t *settings, const uint8_t *payload, uint8_t count, const LoRaWANMacRxInfo_t *rxInfo);
+static void LoRaWAN_Mac_HandleDevStatus(LoRaWANSettings_t *settings, const uint8_t *payload, uint8_t count, const LoRaWANMacRxInfo_t *rxInfo);
+static void LoRaWAN_Mac_HandleRxTimingSetup(LoRaWANSettings_t *settings, const uint8_t *payload, uint8_t count, const LoRaWANMacRxInfo_t *rxInfo);
+
+static const LoRaWANMacCommand_t g_MacCommands[] = {
+    { LORAWAN_MAC_LINK_CHECK,      2, false, NULL },
+    { LORAWAN_MAC_LINK_ADR,        4, true,  LoRaWAN_Mac_HandleLinkAdr },
+    { LORAWAN_MAC_DUTY_CYCLE,      1, false, LoRaWAN_Mac_HandleDutyCycle },
+    { LORAWAN_MAC_RX_PARAM_SETUP,  4, false, LoRaWAN_Mac_HandleRxParamSetup },
+    { LORAWAN_MAC_DEV_STATUS,      0, false, LoRaWAN_Mac_HandleDevStatus },
+    { LORAWAN_MAC_NEW_CHANNEL,     5, false, NULL },
+    { LORAWAN_MAC_RX_TIMING_SETUP, 1, false, LoRaWAN_Mac_HandleRxTimingSetup },
+    { LORAWAN_MAC_TX_PARAM_SETUP,  1, false, NULL },
+    { LORAWAN_MAC_DL_CHANNEL,      4, false, NULL },
+    { LORAWAN_MAC_DEVICE_TIME,     5, false, NULL },
+};
+
+static LoRaWANMacAnswers_t g_Answers;       /* Sent once */
+static LoRaWANMacAnswers_t g_StickyAnswers; /* Repeated until a downlink arrives */
+static uint8_t g_AnswersInFlight = 0;       /* Bytes of g_Answers in the last uplink */
+
+static const LoRaWANMacCommand_t *LoRaWAN_Mac_FindCommand(uint8_t cid)
+{
+    for (uint8_t i = 0; i < (uint8_t)(sizeof(g_MacCommands) / sizeof(g_MacCommands[0])); i++)
+    {
+        if (g_MacCommands[i].Cid == cid)
+        {
+            return &g_MacCommands[i];
+        }
+    }
+    return NULL;
+}
+
+static uint8_t LoRaWAN_Mac_AnswerLength(uint8_t cid)
+{
+    switch (cid)
+    {
+        case LORAWAN_MAC_LINK_ADR:
+        case LORAWAN_MAC_RX_PARAM_SETUP:
+            return 2;
+        case LORAWAN_MAC_DEV_STATUS:
+            return 3;
+        default:
+            return 1;
+    }
+}
+
+static void LoRaWAN_Mac_Queue(LoRaWANMacAnswers_t *answers, const uint8_t *answer, uint8_t length)
+{
+    if ((uint8_t)(answers->Length + length) > LORAWAN_MAC_ANSWERS_MAX_LEN)
+    {
+        return;
+    }
+
+    memcpy(&answers->Buffer[answers->Length], answer, length);
+    answers->Length += length;
+}
+
+/* AU915 LinkADRReq blocks: the channel mask accumulates over the block, the
+ * last request carries DR/TXPower, and every request gets the same status */
+static void LoRaWAN_Mac_HandleLinkAdr(LoRaWANSettings_t *settings, const uint8_t *payload, uint8_t count, const LoRaWANMacRxInfo_t *rxInfo)
+{
+    (void)rxInfo;
+
+    uint8_t status = LORAWAN_MAC_LINK_ADR_ALL_ACK;
+    uint16_t channelMask = settings->ChannelMask;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        const uint8_t *req = &payload[i * 5U];
+        uint16_t chMask = (uint16_t)(req[1] | (req[2] << 8));
+        uint8_t chMaskCntl = (req[3] >> 4) & 0x07;
+
+        if (!LoRaWAN_RegionApplyChMask(settings->Region, chMaskCntl, chMask, &channelMask))
+        {
+            status &= (uint8_t)~LORAWAN_MAC_LINK_ADR_CHMASK_ACK;
+        }
+    }
+
+    const uint8_t *last = &payload[(count - 1U) * 5U];
+    uint8_t dataRate = (last[0] >> 4) & 0x0F;
+    uint8_t txPower = last[0] & 0x0F;
+
+    /* With ADR off the device keeps its own DR and power */
+    if (settings->AdrState == LORAWAN_ADR_OFF)
+    {
+        dataRate = LORAWAN_MAC_KEEP_CURRENT;
+        txPower = LORAWAN_MAC_KEEP_CURRENT;
+    }
+
+    if (dataRate != LORAWAN_MAC_KEEP_CURRENT && !LoRaWAN_RegionValidateUplinkDr(settings->Region, dataRate))
+    {
+        status &= (uint8_t)~LORAWAN_MAC_LINK_ADR_DR_ACK;
+    }
+    if (txPower != LORAWAN_MAC_KEEP_CURRENT && !LoRaWAN_RegionValidateTxPower(settings->Region, txPower))
+    {
+        status &= (uint8_t)~LORAWAN_MAC_LINK_ADR_POWER_ACK;
+    }
+
+    /* Nothing changes unless the whole block is acceptable */
+    if (status == LORAWAN_MAC_LINK_ADR_ALL_ACK)
+    {
+        settings->ChannelMask = channelMask;
+        if (dataRate != LORAWAN_MAC_KEEP_CURRENT)
+        {
+            settings->DataRate = dataRate;
+        }
+        if (txPower != LORAWAN_MAC_KEEP_CURRENT)
+        {
+            settings->TxPower = txPower;
+        }
+    }
+
+    uint8_t answer[2] = { LORAWAN_MAC_LINK_ADR, status };
+    for (uint8_t i = 0; i < count; i++)
+    {
+        LoRaWAN_Mac_Queue(&g_Answers, answer, sizeof(answer));
+    }
+}
+
+static void LoRaWAN_Mac_HandleDutyCycle(LoRaWANSettings_t *settings, const uint8_t *payload, uint8_t count, const LoRaWANMacRxInfo_t *rxInfo)
+{
+    (void)count;
+    (void)rxInfo;
+
+    settings->MaxDutyCycle = payload[0] & 0x0F;
+
+    uint8_t answer = LORAWAN_MAC_DUTY_CYCLE;
+    LoRaWAN_Mac_Queue(&g_Answers, &answer, 1);
+}
+
+static void LoRaWAN_Mac_HandleRxParamSetup(LoRaWANSettings_t *settings, const uint8_t *payload, uint8_t count, const LoRaWANMacRxInfo_t *rxInfo)
+{
+    (void)count;
+    (void)rxInfo;
+
+    uint8_t rx1DrOffset = (payload[0] >> 4) & 0x07;
+    uint8_t rx2DataRate = payload[0] & 0x0F;
+    uint32_t frequency = ((uint32_t)payload[1] | ((uint32_t)payload[2] << 8) | ((uint32_t)payload[3] << 16)) * 100UL;
+    uint8_t status = LORAWAN_MAC_RX_PARAM_ALL_ACK;
+
+    if (!LoRaWAN_RegionValidateRxFrequency(settings->Region, frequency))
+    {
+        status &= (uint8_t)~LORAWAN_MAC_RX_PARAM_CHANNEL_ACK;
+    }
+    if (!LoRaWAN_RegionValidateDownlinkDr(settings->Region, rx2DataRate))
+    {
+        status &= (uint8_t)~LORAWAN_MAC_RX_PARAM_RX2_DR_ACK;
+    }
+    if (!LoRaWAN_RegionValidateRx1DrOffset(settings->Region, rx1DrOffset))
+    {
+        status &= (uint8_t)~LORAWAN_MAC_RX_PARAM_OFFSET_ACK;
+    }
+
+    if (status == LORAWAN_MAC_RX_PARAM_ALL_ACK)
+    {
+        settings->Rx1DrOffset = rx1DrOffset;
+        settings->Rx2DataRate = rx2DataRate;
+        settings->Rx2Frequency = frequency;
+    }
+
+    uint8_t answer[2] = { LORAWAN_MAC_RX_PARAM_SETUP, status };
+    LoRaWAN_Mac_Queue(&g_StickyAnswers, answer, sizeof(answer));
+}
+
+static void LoRaWAN_Mac_HandleDevStatus(LoRaWANSettings_t *settings, const uint8_t *payload, uint8_t count, const LoRaWANMacRxInfo_t *rxInfo)
+{
+    (void)settings;
+    (void)payload;
+    (void)count;
+
+    int8_t margin = (rxInfo != NULL) ? rxInfo->Snr : 0;
+    if (margin < -32)
+    {
+        margin = -32;
+    }
+    if (margin > 31)
+    {
+        margin = 31;
+    }
+
+    uint8_t answer[3] = {
+        LORAWAN_MAC_DEV_STATUS,
+        (rxInfo != NULL) ? rxInfo->BatteryLevel : 255U,
+        (uint8_t)margin & 0x3F};
+    LoRaWAN_Mac_Queue(&g_Answers, answer, sizeof(answer));
+}
+
+static void LoRaWAN_Mac_HandleRxTimingSetup(LoRaWANSettings_t *settings, const uint8_t *payload, uint8_t count, const LoRaWANMacRxInfo_t *rxInfo)
+{
+    (void)count;
+    (void)rxInfo;
+
+    uint8_t delay = payload[0] & 0x0F;
+    if (delay == 0U)
+    {
+        delay = 1U;
+    }
+
+    settings->Rx1DelayMs = (uint32_t)delay * 1000UL;
+    settings->Rx2DelayMs = settings->Rx1DelayMs + 1000UL;
+
+    uint8_t answer = LORAWAN_MAC_RX_TIMING_SETUP;
+    LoRaWAN_Mac_Queue(&g_StickyAnswers, &answer, 1);
+}
+
+void LoRaWAN_Mac_Reset(void)
+{
+    g_Answers.Length = 0;
+    g_StickyAnswers.Length = 0;
+    g_AnswersInFlight = 0;
+}
+
+void LoRaWAN_Mac_ProcessCommands(LoRaWANSettings_t *settings, const uint8_t *cmds, uint8_t length, const LoRaWANMacRxInfo_t *rxInfo)
+{
+    if (settings == NULL || cmds == NULL)
+    {
+        return;
+    }
+
+    uint8_t idx = 0;
+    while (idx < length)
+    {
+        const LoRaWANMacCommand_t *cmd = LoRaWAN_Mac_FindCommand(cmds[idx]);
+        if (cmd == NULL || (uint8_t)(length - idx) < (uint8_t)(cmd->PayloadLen + 1U))
+        {
+            return;
+        }
+
+        uint8_t count = 1;
+        uint8_t stride = (uint8_t)(cmd->PayloadLen + 1U);
+        while (cmd->Block && (uint8_t)(idx + (count + 1U) * stride) <= length &&
+               cmds[idx + count * stride] == cmd->Cid)
+        {
+            count++;
+        }
+
+        if (cmd->Handler != NULL)
+        {
+            cmd->Handler(settings, &cmds[idx + 1U], count, rxInfo);
+        }
+
+        idx = (uint8_t)(idx + count * stride);
+    }
+}
+
+uint8_t LoRaWAN_Mac_GetAnswers(uint8_t *fOpts, uint8_t maxLen)
+{
+    const LoRaWANMacAnswers_t *queues[2] = { &g_StickyAnswers, &g_Answers };
+    uint8_t length = 0;
+
+    g_AnswersInFlight = 0;
+    if (fOpts == NULL)
+    {
+        return 0;
+    }
+
+    for (uint8_t q = 0; q < 2U; q++)
+    {
+        uint8_t idx = 0;
+        while (idx < queues[q]->Length)
+        {
+            uint8_t answerLen = LoRaWAN_Mac_AnswerLength(queues[q]->Buffer[idx]);
+            if ((uint8_t)(length + answerLen) > maxLen)
+            {
+                return length;
+            }
+
+            memcpy(&fOpts[length], &queues[q]->Buffer[idx], answerLen);
+            length += answerLen;
+            idx += answerLen;
+            if (queues[q] == &g_Answers)
+            {
+                g_AnswersInFlight = idx;
+            }
+        }
+    }
+
+    return length;
+}
+
+/* Answers that did not fit stay queued for the following uplink */
+void LoRaWAN_Mac_OnAnswersSent(void)
+{
+    g_Answers.Length -= g_AnswersInFlight;
+    memmove(g_Answers.Buffer, &g_Answers.Buffer[g_AnswersInFlight], g_Answers.Length);
+    g_AnswersInFlight = 0;
+}
+
+void LoRaWAN_Mac_OnDownlinkReceived(void)
+{
+    g_StickyAnswers.Length = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef LORAWAN_MAC_H
+#define LORAWAN_MAC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "lorawan_types.h"
+
+/* MAC command identifiers (LoRaWAN 1.0.x, same CID both directions) */
+#define LORAWAN_MAC_LINK_CHECK       0x02
+#define LORAWAN_MAC_LINK_ADR         0x03
+#define LORAWAN_MAC_DUTY_CYCLE       0x04
+#define LORAWAN_MAC_RX_PARAM_SETUP   0x05
+#define LORAWAN_MAC_DEV_STATUS       0x06
+#define LORAWAN_MAC_NEW_CHANNEL      0x07
+#define LORAWAN_MAC_RX_TIMING_SETUP  0x08
+#define LORAWAN_MAC_TX_PARAM_SETUP   0x09
+#define LORAWAN_MAC_DL_CHANNEL       0x0A
+#define LORAWAN_MAC_DEVICE_TIME      0x0D
+
+/* Conditions of the downlink that carried the commands, for DevStatusAns */
+typedef struct
+{
+    int8_t Snr;
+    uint8_t BatteryLevel; /* 0 = external power, 1..254, 255 = unknown */
+} LoRaWANMacRxInfo_t;
+
+/* Drops every queued answer (new session) */
+void LoRaWAN_Mac_Reset(void);
+
+/* Applies every command of a FOpts field or port-0 payload to settings and
+ * queues the answers; parsing stops at the first unknown CID since its
+ * length (and so the start of the next command) is unknown. */
+void LoRaWAN_Mac_ProcessCommands(LoRaWANSettings_t *settings, const uint8_t *cmds, uint8_t length, const LoRaWANMacRxInfo_t *rxInfo);
+
+/* Copies queued answers (whole commands only) for the next uplink's FOpts */
+uint8_t LoRaWAN_Mac_GetAnswers(uint8_t *fOpts, uint8_t maxLen);
+
+/* The uplink carrying the answers is on air: one-shot answers are done */
+void LoRaWAN_Mac_OnAnswersSent(void);
+
+/* A Class A downlink arrived: sticky answers (RXParamSetupAns,
+ * RXTimingSetupAns) have been seen by the network */
+void LoRaWAN_Mac_OnDownlinkReceived(void);
+
+#endif /* LORAWAN_MAC_H */
@@ -45,7 +45,7 @@ uint32_t LoRaWAN_RegionGetUplinkFrequency(LoRaWANRegion_t region, uint8_t channe
     return params->Channels[channel].Frequency;
 }
 
-uint8_t LoRaWAN_RegionGetNextChannel(LoRaWANRegion_t region, uint32_t *timeToNext)
+uint8_t LoRaWAN_RegionGetNextChannel(LoRaWANRegion_t region, uint16_t channelMask, uint32_t *timeToNext)
 {
     (void)timeToNext;
     const LoRaWANRegionParams_t *params = LoRaWAN_RegionGetParams(region);
@@ -55,6 +55,138 @@ uint8_t LoRaWAN_RegionGetNextChannel(LoRaWANRegion_t region, uint32_t *timeToNex
     }
     static uint8_t s_NextChannel = 0;
     uint8_t channel = s_NextChannel % params->ChannelCount;
-    s_NextChannel = (s_NextChannel + 1) % params->ChannelCount;
+    for (uint8_t i = 0; i < params->ChannelCount; i++)
+    {
+        if (channelMask == 0 || (channelMask & (1U << channel)) != 0)
+        {
+            break;
+        }
+        channel = (channel + 1) % params->ChannelCount;
+    }
+    s_NextChannel = (channel + 1) % params->ChannelCount;
     return channel;
 }
+
+uint16_t LoRaWAN_RegionDefaultChannelMask(LoRaWANRegion_t region)
+{
+    const LoRaWANRegionParams_t *params = LoRaWAN_RegionGetParams(region);
+    if (params == NULL || params->ChannelCount == 0)
+    {
+        return 0;
+    }
+    return (params->ChannelCount >= 16) ? 0xFFFF : (uint16_t)((1U << params->ChannelCount) - 1U);
+}
+
+/* AU915 ChMaskCntl: 0..3 address 125 kHz channels 16*n..16*n+15, 4 the
+ * 500 kHz channels 64..71, 6/7 switch all 125 kHz channels on/off. Only
+ * the sub-band in Channels[] exists here, so other bits are accepted as
+ * long as at least one of our channels stays enabled. */
+bool LoRaWAN_RegionApplyChMask(LoRaWANRegion_t region, uint8_t chMaskCntl, uint16_t chMask, uint16_t *channelMask)
+{
+    const LoRaWANRegionParams_t *params = LoRaWAN_RegionGetParams(region);
+    if (params == NULL || channelMask == NULL)
+    {
+        return false;
+    }
+
+    uint16_t mask = *channelMask;
+    for (uint8_t i = 0; i < params->ChannelCount && i < 16; i++)
+    {
+        uint8_t channel = params->FirstChannel + i;
+        bool enabled;
+
+        if (chMaskCntl <= 3)
+        {
+            if ((channel / 16) != chMaskCntl)
+            {
+                continue;
+            }
+            enabled = (chMask & (1U << (channel % 16))) != 0;
+        }
+        else if (chMaskCntl == 4)
+        {
+            continue;
+        }
+        else if (chMaskCntl == 6 || chMaskCntl == 7)
+        {
+            enabled = (chMaskCntl == 6);
+        }
+        else
+        {
+            return false;
+        }
+
+        if (enabled)
+        {
+            mask |= (uint16_t)(1U << i);
+        }
+        else
+        {
+            mask &= (uint16_t)~(1U << i);
+        }
+    }
+
+    if (mask == 0)
+    {
+        return false;
+    }
+
+    *channelMask = mask;
+    return true;
+}
+
+bool LoRaWAN_RegionValidateUplinkDr(LoRaWANRegion_t region, uint8_t dr)
+{
+    (void)region;
+    return dr <= 5;
+}
+
+bool LoRaWAN_RegionValidateDownlinkDr(LoRaWANRegion_t region, uint8_t dr)
+{
+    (void)region;
+    return dr >= 8 && dr <= 13;
+}
+
+/* AU915 downlink channels: 923.3 MHz + n * 600 kHz, n = 0..7 */
+bool LoRaWAN_RegionValidateRxFrequency(LoRaWANRegion_t region, uint32_t frequency)
+{
+    (void)region;
+    if (frequency < 923300000UL || frequency > 927500000UL)
+    {
+        return false;
+    }
+    return ((frequency - 923300000UL) % 600000UL) == 0;
+}
+
+bool LoRaWAN_RegionValidateRx1DrOffset(LoRaWANRegion_t region, uint8_t offset)
+{
+    (void)region;
+    return offset <= 5;
+}
+
+/* AU915 RX1 channel: 923.3 MHz + (uplink channel % 8) * 600 kHz */
+uint32_t LoRaWAN_RegionGetRx1Frequency(LoRaWANRegion_t region, uint8_t channel)
+{
+    const LoRaWANRegionParams_t *params = LoRaWAN_RegionGetParams(region);
+    if (params == NULL || channel >= params->ChannelCount)
+    {
+        return 0;
+    }
+    return 923300000UL + (uint32_t)((params->FirstChannel + channel) % 8U) * 600000UL;
+}
+
+/* AU915 RX1 data rate: DR8..DR13, 10 + uplink DR - offset */
+uint8_t LoRaWAN_RegionGetRx1DataRate(LoRaWANRegion_t region, uint8_t uplinkDr, uint8_t offset)
+{
+    (void)region;
+    int8_t dr = (int8_t)(10 + uplinkDr - offset);
+    if (dr < 8)
+    {
+        dr = 8;
+    }
+    if (dr > 13)
+    {
+        dr = 13;
+    }
+    return (uint8_t)dr;
+}
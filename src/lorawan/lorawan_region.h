@@ -20,6 +20,7 @@ typedef struct
     uint8_t Rx2DataRate;
     uint8_t MaxEirp;
     uint8_t NbJoinTrials;
+    uint8_t FirstChannel; /* Regional channel index of Channels[0] */
 } LoRaWANRegionParams_t;
 
 const LoRaWANRegionParams_t *LoRaWAN_RegionGetParams(LoRaWANRegion_t region);
@@ -27,6 +28,14 @@ bool LoRaWAN_RegionValidateDr(LoRaWANRegion_t region, uint8_t dr);
 bool LoRaWAN_RegionValidateTxPower(LoRaWANRegion_t region, uint8_t txPower);
 uint32_t LoRaWAN_RegionGetJoinFrequency(LoRaWANRegion_t region, uint8_t attempt);
 uint32_t LoRaWAN_RegionGetUplinkFrequency(LoRaWANRegion_t region, uint8_t channel);
-uint8_t LoRaWAN_RegionGetNextChannel(LoRaWANRegion_t region, uint32_t *timeToNext);
+uint8_t LoRaWAN_RegionGetNextChannel(LoRaWANRegion_t region, uint16_t channelMask, uint32_t *timeToNext);
+uint16_t LoRaWAN_RegionDefaultChannelMask(LoRaWANRegion_t region);
+bool LoRaWAN_RegionApplyChMask(LoRaWANRegion_t region, uint8_t chMaskCntl, uint16_t chMask, uint16_t *channelMask);
+bool LoRaWAN_RegionValidateUplinkDr(LoRaWANRegion_t region, uint8_t dr);
+bool LoRaWAN_RegionValidateDownlinkDr(LoRaWANRegion_t region, uint8_t dr);
+bool LoRaWAN_RegionValidateRxFrequency(LoRaWANRegion_t region, uint32_t frequency);
+bool LoRaWAN_RegionValidateRx1DrOffset(LoRaWANRegion_t region, uint8_t offset);
+uint32_t LoRaWAN_RegionGetRx1Frequency(LoRaWANRegion_t region, uint8_t channel);
+uint8_t LoRaWAN_RegionGetRx1DataRate(LoRaWANRegion_t region, uint8_t uplinkDr, uint8_t offset);
 
 #endif /* LORAWAN_REGION_H */
@@ -18,6 +18,7 @@ static const LoRaWANRegionParams_t s_Au915Params = {
     .Rx2DataRate = 8,
     .MaxEirp = 20,
     .NbJoinTrials = 3,
+    .FirstChannel = 8, /* Sub-band 2 */
 };
 
 const LoRaWANRegionParams_t *LoRaWAN_RegionAU915(void)
@@ -32,6 +32,7 @@ typedef enum
     LORAWAN_STATUS_NOT_JOINED,
     LORAWAN_STATUS_INVALID_PARAM,
     LORAWAN_STATUS_SEND_FAILED,
+    LORAWAN_STATUS_NO_ACK,
 } LoRaWANStatus_t;
 
 typedef enum
@@ -70,8 +71,11 @@ typedef struct
     LoRaWANAdrState_t AdrState;
     uint8_t DataRate;
     uint8_t TxPower;
+    uint8_t Rx1DrOffset;
     uint8_t Rx2DataRate;
     uint32_t Rx2Frequency;
+    uint16_t ChannelMask;  /* Bit n enables region Channels[n]; 0 = all */
+    uint8_t MaxDutyCycle;  /* DutyCycleReq: aggregated duty cycle 1 / 2^n */
     uint8_t SubBand;
     LoRaWANMsgType_t MsgType;
     uint8_t AppPort;
@@ -80,6 +84,9 @@ typedef struct
     uint32_t Rx2DelayMs;
     uint32_t JoinRx1DelayMs;
     uint32_t JoinRx2DelayMs;
+    uint8_t RetryCount;    /* Confirmed uplink retransmissions after the first attempt */
+    uint32_t RetryDelayMs; /* Mean backoff before a retransmission */
+    bool RetryDrStepDown;  /* Lower DR by one every second transmission */
 } LoRaWANSettings_t;
 
 typedef struct
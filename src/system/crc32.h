@@ -4,8 +4,21 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* CRC-32 (IEEE 802.3, reflected 0xEDB88320). Implementation variant, selected
+ * by the build (CRC32_IMPL in the Makefile):
+ *
+ *   CRC32_IMPL_NIBBLE  16-entry table, two lookups per byte (64 bytes)
+ *   default            256-entry table, one lookup per byte (1 KB)
+ *   CRC32_IMPL_SLICE4  four 256-entry tables, one word per step (4 KB)
+ */
+
+/* Incremental: Crc32Finalize(Crc32Update(Crc32Update(Crc32Init(), a), b))
+ * is the CRC of a followed by b */
 uint32_t Crc32Init(void);
 uint32_t Crc32Update(uint32_t crc, const void *buffer, size_t length);
 uint32_t Crc32Finalize(uint32_t crc);
 
+/* One-shot CRC of a buffer */
+uint32_t Crc32Calculate(const void *buffer, size_t length);
+
 #endif /* CRC32_H */
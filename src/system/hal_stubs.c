@@ -1,10 +1,11 @@
 #include "hal_stubs.h"
 #include "delay.h"
-#include "rtc-board.h"
+#include "timer.h"
 
 uint32_t HAL_GetTick(void)
 {
-    return RtcGetTimerValue();
+    /* Milliseconds, whatever the tick rate of the RTC back end */
+    return TimerGetCurrentTime();
 }
 
 void HAL_Delay(uint32_t delay)
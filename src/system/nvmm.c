@@ -50,22 +50,28 @@ uint16_t NvmmRead( uint8_t* dest, uint16_t size, uint16_t offset )
 
 bool NvmmCrc32Check( uint16_t size, uint16_t offset )
 {
-    uint8_t data = 0;
+    uint8_t data[32];
     uint32_t calculatedCrc32 = 0;
     uint32_t readCrc32 = 0;
 
     if( NvmmRead( ( uint8_t* ) &readCrc32, sizeof( readCrc32 ),
                   ( offset + ( size - sizeof( readCrc32 ) ) ) ) == sizeof( readCrc32 ) )
     {
-        // Calculate crc
+        // Calculate crc, a chunk at a time
         calculatedCrc32 = Crc32Init( );
-        for( uint16_t i = 0; i < ( size - sizeof( readCrc32 ) ); i++ )
+        for( uint16_t i = 0; i < ( size - sizeof( readCrc32 ) ); )
         {
-            if( NvmmRead( &data, 1, offset + i ) != 1 )
+            uint16_t chunk = ( size - sizeof( readCrc32 ) ) - i;
+            if( chunk > sizeof( data ) )
+            {
+                chunk = sizeof( data );
+            }
+            if( NvmmRead( data, chunk, offset + i ) != chunk )
             {
                 return false;
             }
-            calculatedCrc32 = Crc32Update( calculatedCrc32, &data, 1 );
+            calculatedCrc32 = Crc32Update( calculatedCrc32, data, chunk );
+            i += chunk;
         }
         calculatedCrc32 = Crc32Finalize( calculatedCrc32 );
 
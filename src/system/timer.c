@@ -42,56 +42,66 @@
     }while( 0 );
 
 /*!
- * Timers list head pointer
+ * Running timers, as a binary min-heap on their latest expiry (deadline +
+ * slack): TimerHeap[0] holds the RTC alarm
  */
-static TimerEvent_t *TimerListHead = NULL;
+static TimerEvent_t *TimerHeap[TIMER_MAX_COUNT];
 
 /*!
- * \brief Adds or replace the head timer of the list.
- *
- * \remark The list is automatically sorted. The list head always contains the
- *         next timer to expire.
- *
- * \param [IN]  obj Timer object to be become the new head
- * \param [IN]  remainingTime Remaining time of the previous head to be replaced
+ * Number of running timers
  */
-static void TimerInsertNewHeadTimer( TimerEvent_t *obj );
+static uint16_t TimerCount = 0;
 
 /*!
- * \brief Adds a timer to the list.
- *
- * \remark The list is automatically sorted. The list head always contains the
- *         next timer to expire.
+ * Time reference of the heap order. No running timer's latest expiry is
+ * before it, so they compare as unsigned tick offsets from it across the
+ * RTC wrap.
+ */
+static uint32_t TimerBase = 0;
+
+/*!
+ * \brief Heap order key: latest expiry as an offset from TimerBase
+ */
+#define TimerKey( obj ) ( ( obj )->Timestamp + ( obj )->Slack - TimerBase )
+
+/*!
+ * \brief Checks if a timer deadline is reached at a given time
  *
- * \param [IN]  obj Timer object to be added to the list
- * \param [IN]  remainingTime Remaining time of the running head after which the object may be added
+ * \param [IN] obj  Running timer object
+ * \param [IN] time RTC ticks, not before TimerBase
+ * \retval true if the deadline is at or before time
  */
-static void TimerInsertTimer( TimerEvent_t *obj );
+static bool TimerIsDue( TimerEvent_t *obj, uint32_t time );
 
 /*!
- * \brief Sets a timeout with the duration "timestamp"
+ * \brief Adds a timer to the heap
  *
- * \param [IN] timestamp Delay duration
+ * \param [IN] obj Timer object with its deadline set
  */
-static void TimerSetTimeout( TimerEvent_t *obj );
+static void TimerHeapInsert( TimerEvent_t *obj );
 
 /*!
- * \brief Check if the Object to be added is not already in the list
+ * \brief Removes a timer from anywhere in the heap
  *
- * \param [IN] timestamp Delay duration
- * \retval true (the object is already in the list) or false
+ * \param [IN] obj Running timer object
  */
-static bool TimerExists( TimerEvent_t *obj );
+static void TimerHeapRemove( TimerEvent_t *obj );
+
+/*!
+ * \brief Sets the RTC alarm for the deadline of the heap root
+ */
+static void TimerSetTimeout( void );
 
 void TimerInit( TimerEvent_t *obj, void ( *callback )( void *context ) )
 {
     obj->Timestamp = 0;
     obj->ReloadValue = 0;
+    obj->Slack = 0;
     obj->IsStarted = false;
-    obj->IsNext2Expire = false;
+    obj->IsPeriodic = false;
+    obj->HeapIndex = 0;
     obj->Callback = callback;
     obj->Context = NULL;
-    obj->Next = NULL;
 }
 
 void TimerSetContext( TimerEvent_t *obj, void* context )
@@ -101,78 +111,32 @@ void TimerSetContext( TimerEvent_t *obj, void* context )
 
 void TimerStart( TimerEvent_t *obj )
 {
-    uint32_t elapsedTime = 0;
-
     CRITICAL_SECTION_BEGIN( );
 
-    if( ( obj == NULL ) || ( TimerExists( obj ) == true ) )
+    if( ( obj == NULL ) || ( obj->IsStarted == true ) )
     {
         CRITICAL_SECTION_END( );
         return;
     }
 
-    obj->Timestamp = obj->ReloadValue;
-    obj->IsStarted = true;
-    obj->IsNext2Expire = false;
-
-    if( TimerListHead == NULL )
-    {
-        RtcSetTimerContext( );
-        // Inserts a timer at time now + obj->Timestamp
-        TimerInsertNewHeadTimer( obj );
-    }
-    else
-    {
-        elapsedTime = RtcGetTimerElapsedTime( );
-        obj->Timestamp += elapsedTime;
-
-        if( obj->Timestamp < TimerListHead->Timestamp )
-        {
-            TimerInsertNewHeadTimer( obj );
-        }
-        else
-        {
-            TimerInsertTimer( obj );
-        }
-    }
-    CRITICAL_SECTION_END( );
-}
-
-static void TimerInsertTimer( TimerEvent_t *obj )
-{
-    TimerEvent_t* cur = TimerListHead;
-    TimerEvent_t* next = TimerListHead->Next;
+    uint32_t now = RtcGetTimerValue( );
 
-    while( cur->Next != NULL )
+    // Move the reference up to now unless a timer is overdue and waits for
+    // TimerIrqHandler, so that long timeouts keep fitting in 32 bits
+    if( ( TimerCount == 0 ) || ( TimerKey( TimerHeap[0] ) >= ( now - TimerBase ) ) )
     {
-        if( obj->Timestamp > next->Timestamp )
-        {
-            cur = next;
-            next = next->Next;
-        }
-        else
-        {
-            cur->Next = obj;
-            obj->Next = next;
-            return;
-        }
+        TimerBase = now;
     }
-    cur->Next = obj;
-    obj->Next = NULL;
-}
 
-static void TimerInsertNewHeadTimer( TimerEvent_t *obj )
-{
-    TimerEvent_t* cur = TimerListHead;
+    obj->Timestamp = now + obj->ReloadValue;
+    obj->IsStarted = true;
+    TimerHeapInsert( obj );
 
-    if( cur != NULL )
+    if( TimerHeap[0] == obj )
     {
-        cur->IsNext2Expire = false;
+        TimerSetTimeout( );
     }
-
-    obj->Next = cur;
-    TimerListHead = obj;
-    TimerSetTimeout( TimerListHead );
+    CRITICAL_SECTION_END( );
 }
 
 bool TimerIsStarted( TimerEvent_t *obj )
@@ -183,52 +147,38 @@ bool TimerIsStarted( TimerEvent_t *obj )
 void TimerIrqHandler( void )
 {
     TimerEvent_t* cur;
-    TimerEvent_t* next;
-
-    uint32_t old =  RtcGetTimerContext( );
-    uint32_t now =  RtcSetTimerContext( );
-    uint32_t deltaContext = now - old; // intentional wrap around
 
-    // Update timeStamp based upon new Time Reference
-    // because delta context should never exceed 2^32
-    if( TimerListHead != NULL )
+    // The RTC may raise the alarm up to its minimum timeout early, and each
+    // callback may run long: read the time again before every deadline.
+    // Expiring in heap order, the wakeup serves every timer at the root whose
+    // deadline has passed, while the rest are still within their slack.
+    uint32_t now = RtcGetTimerValue( );
+    while( ( TimerCount > 0 ) && ( TimerIsDue( TimerHeap[0], now + RtcGetMinimumTimeout( ) ) == true ) )
     {
-        for( cur = TimerListHead; cur->Next != NULL; cur = cur->Next )
+        cur = TimerHeap[0];
+        TimerHeapRemove( cur );
+        if( ( cur->IsPeriodic == true ) && ( cur->ReloadValue > 0 ) )
         {
-            next = cur->Next;
-            if( next->Timestamp > deltaContext )
-            {
-                next->Timestamp -= deltaContext;
-            }
-            else
+            // Next period from the deadline, skipping any missed altogether
+            do
             {
-                next->Timestamp = 0;
-            }
+                cur->Timestamp += cur->ReloadValue;
+            }while( TimerIsDue( cur, now ) == true );
+            TimerHeapInsert( cur );
+        }
+        else
+        {
+            cur->IsStarted = false;
         }
-    }
-
-    // Execute immediately the alarm callback
-    if ( TimerListHead != NULL )
-    {
-        cur = TimerListHead;
-        TimerListHead = TimerListHead->Next;
-        cur->IsStarted = false;
-        ExecuteCallBack( cur->Callback, cur->Context );
-    }
-
-    // Remove all the expired object from the list
-    while( ( TimerListHead != NULL ) && ( TimerListHead->Timestamp < RtcGetTimerElapsedTime( ) ) )
-    {
-        cur = TimerListHead;
-        TimerListHead = TimerListHead->Next;
-        cur->IsStarted = false;
         ExecuteCallBack( cur->Callback, cur->Context );
+        now = RtcGetTimerValue( );
     }
 
-    // Start the next TimerListHead if it exists AND NOT running
-    if( ( TimerListHead != NULL ) && ( TimerListHead->IsNext2Expire == false ) )
+    // Only future latest expiries are left
+    TimerBase = now;
+    if( TimerCount > 0 )
     {
-        TimerSetTimeout( TimerListHead );
+        TimerSetTimeout( );
     }
 }
 
@@ -236,89 +186,31 @@ void TimerStop( TimerEvent_t *obj )
 {
     CRITICAL_SECTION_BEGIN( );
 
-    TimerEvent_t* prev = TimerListHead;
-    TimerEvent_t* cur = TimerListHead;
-
-    // List is empty or the obj to stop does not exist
-    if( ( TimerListHead == NULL ) || ( obj == NULL ) )
+    if( ( obj == NULL ) || ( obj->IsStarted == false ) )
     {
         CRITICAL_SECTION_END( );
         return;
     }
 
+    bool wasHead = ( TimerHeap[0] == obj );
+
+    TimerHeapRemove( obj );
     obj->IsStarted = false;
 
-    if( TimerListHead == obj ) // Stop the Head
+    if( wasHead == true )
     {
-        if( TimerListHead->IsNext2Expire == true ) // The head is already running
+        if( TimerCount > 0 )
         {
-            TimerListHead->IsNext2Expire = false;
-            if( TimerListHead->Next != NULL )
-            {
-                TimerListHead = TimerListHead->Next;
-                TimerSetTimeout( TimerListHead );
-            }
-            else
-            {
-                RtcStopAlarm( );
-                TimerListHead = NULL;
-            }
+            TimerSetTimeout( );
         }
-        else // Stop the head before it is started
-        {
-            if( TimerListHead->Next != NULL )
-            {
-                TimerListHead = TimerListHead->Next;
-            }
-            else
-            {
-                TimerListHead = NULL;
-            }
-        }
-    }
-    else // Stop an object within the list
-    {
-        while( cur != NULL )
+        else
         {
-            if( cur == obj )
-            {
-                if( cur->Next != NULL )
-                {
-                    cur = cur->Next;
-                    prev->Next = cur;
-                }
-                else
-                {
-                    cur = NULL;
-                    prev->Next = cur;
-                }
-                break;
-            }
-            else
-            {
-                prev = cur;
-                cur = cur->Next;
-            }
+            RtcStopAlarm( );
         }
     }
     CRITICAL_SECTION_END( );
 }
 
-static bool TimerExists( TimerEvent_t *obj )
-{
-    TimerEvent_t* cur = TimerListHead;
-
-    while( cur != NULL )
-    {
-        if( cur == obj )
-        {
-            return true;
-        }
-        cur = cur->Next;
-    }
-    return false;
-}
-
 void TimerReset( TimerEvent_t *obj )
 {
     TimerStop( obj );
@@ -339,14 +231,28 @@ void TimerSetValue( TimerEvent_t *obj, uint32_t value )
         ticks = minValue;
     }
 
-    obj->Timestamp = ticks;
     obj->ReloadValue = ticks;
 }
 
+void TimerSetPeriodic( TimerEvent_t *obj, bool periodic )
+{
+    obj->IsPeriodic = periodic;
+}
+
+void TimerSetSlack( TimerEvent_t *obj, uint32_t slack )
+{
+    TimerStop( obj );
+
+    obj->Slack = RtcMs2Tick( slack );
+}
+
 TimerTime_t TimerGetCurrentTime( void )
 {
-    uint32_t now = RtcGetTimerValue( );
-    return  RtcTick2Ms( now );
+    // From the calendar count rather than RtcTick2Ms( RtcGetTimerValue( ) ):
+    // 32-bit ticks wrap well before 2^32 ms, milliseconds wrap at 2^32
+    uint16_t milliseconds = 0;
+    uint32_t seconds = RtcGetCalendarTime( &milliseconds );
+    return ( seconds * 1000U ) + milliseconds;
 }
 
 TimerTime_t TimerGetElapsedTime( TimerTime_t past )
@@ -355,24 +261,151 @@ TimerTime_t TimerGetElapsedTime( TimerTime_t past )
     {
         return 0;
     }
-    uint32_t nowInTicks = RtcGetTimerValue( );
-    uint32_t pastInTicks = RtcMs2Tick( past );
+    // Intentional wrap around
+    return TimerGetCurrentTime( ) - past;
+}
+
+TimerTime_t TimerGetTimeToNextEvent( void )
+{
+    TimerTime_t timeToNext = ( TimerTime_t )-1;
 
-    // Intentional wrap around. Works Ok if tick duration below 1ms
-    return RtcTick2Ms( nowInTicks - pastInTicks );
+    CRITICAL_SECTION_BEGIN( );
+    if( TimerCount > 0 )
+    {
+        uint32_t now = RtcGetTimerValue( );
+
+        // Until the alarm, at the latest expiry of the root
+        timeToNext = 0;
+        if( TimerKey( TimerHeap[0] ) > ( now - TimerBase ) )
+        {
+            timeToNext = RtcTick2Ms( TimerKey( TimerHeap[0] ) - ( now - TimerBase ) );
+        }
+    }
+    CRITICAL_SECTION_END( );
+
+    return timeToNext;
+}
+
+static bool TimerIsDue( TimerEvent_t *obj, uint32_t time )
+{
+    // The deadline itself may lie before TimerBase, its latest expiry not
+    return TimerKey( obj ) <= ( ( time - TimerBase ) + obj->Slack );
+}
+
+/*!
+ * \brief Puts a timer at a heap position
+ */
+static void TimerHeapPlace( TimerEvent_t *obj, uint16_t index )
+{
+    TimerHeap[index] = obj;
+    obj->HeapIndex = index;
 }
 
-static void TimerSetTimeout( TimerEvent_t *obj )
+/*!
+ * \brief Moves the timer at index towards the root while it expires before
+ *        its parent
+ */
+static void TimerHeapSiftUp( uint16_t index )
 {
-    int32_t minTicks= RtcGetMinimumTimeout( );
-    obj->IsNext2Expire = true;
+    TimerEvent_t *obj = TimerHeap[index];
+    uint32_t key = TimerKey( obj );
+
+    while( index > 0 )
+    {
+        uint16_t parent = ( index - 1 ) / 2;
+        if( TimerKey( TimerHeap[parent] ) <= key )
+        {
+            break;
+        }
+        TimerHeapPlace( TimerHeap[parent], index );
+        index = parent;
+    }
+    TimerHeapPlace( obj, index );
+}
+
+/*!
+ * \brief Moves the timer at index towards the leaves while a child expires
+ *        before it
+ */
+static void TimerHeapSiftDown( uint16_t index )
+{
+    TimerEvent_t *obj = TimerHeap[index];
+    uint32_t key = TimerKey( obj );
+
+    for( ;; )
+    {
+        uint16_t child = ( 2 * index ) + 1;
+        if( child >= TimerCount )
+        {
+            break;
+        }
+        if( ( ( child + 1 ) < TimerCount ) &&
+            ( TimerKey( TimerHeap[child + 1] ) < TimerKey( TimerHeap[child] ) ) )
+        {
+            child++;
+        }
+        if( key <= TimerKey( TimerHeap[child] ) )
+        {
+            break;
+        }
+        TimerHeapPlace( TimerHeap[child], index );
+        index = child;
+    }
+    TimerHeapPlace( obj, index );
+}
+
+static void TimerHeapInsert( TimerEvent_t *obj )
+{
+    if( TimerCount >= TIMER_MAX_COUNT )
+    {
+        // A dropped timer would stall its owner for good: raise
+        // TIMER_MAX_COUNT instead
+        while( 1 );
+    }
+    TimerHeap[TimerCount] = obj;
+    TimerCount++;
+    TimerHeapSiftUp( TimerCount - 1 );
+}
+
+static void TimerHeapRemove( TimerEvent_t *obj )
+{
+    uint16_t index = obj->HeapIndex;
+    TimerEvent_t *last = TimerHeap[--TimerCount];
+
+    if( last == obj )
+    {
+        return;
+    }
+    TimerHeapPlace( last, index );
+    if( ( index > 0 ) && ( TimerKey( last ) < TimerKey( TimerHeap[( index - 1 ) / 2] ) ) )
+    {
+        TimerHeapSiftUp( index );
+    }
+    else
+    {
+        TimerHeapSiftDown( index );
+    }
+}
+
+static void TimerSetTimeout( void )
+{
+    uint32_t now = RtcSetTimerContext( );
+    uint32_t minTicks = RtcGetMinimumTimeout( );
+    uint32_t timeout = 0;
+
+    // Wake at the root's latest expiry: the last moment that suits every
+    // running timer
+    if( TimerKey( TimerHeap[0] ) > ( now - TimerBase ) )
+    {
+        timeout = TimerKey( TimerHeap[0] ) - ( now - TimerBase );
+    }
 
     // In case deadline too soon
-    if( obj->Timestamp  < ( RtcGetTimerElapsedTime( ) + minTicks ) )
+    if( timeout < minTicks )
     {
-        obj->Timestamp = RtcGetTimerElapsedTime( ) + minTicks;
+        timeout = minTicks;
     }
-    RtcSetAlarm( obj->Timestamp );
+    RtcSetAlarm( timeout );
 }
 
 TimerTime_t TimerTempCompensation( TimerTime_t period, float temperature )
@@ -32,18 +32,29 @@ extern "C"
 #include <stdbool.h>
 #include <stdint.h>
 
+/*!
+ * \brief Most timers that can run at once (size of the timer queue)
+ *
+ * \remark The firmware runs 9: TX, sensor wake and housekeeping, RX1, RX2,
+ *         retransmit and the three radio timeouts.
+ */
+#ifndef TIMER_MAX_COUNT
+#define TIMER_MAX_COUNT                             16
+#endif
+
 /*!
  * \brief Timer object description
  */
 typedef struct TimerEvent_s
 {
-    uint32_t Timestamp;                  //! Current timer value
+    uint32_t Timestamp;                  //! Deadline, absolute RTC ticks
     uint32_t ReloadValue;                //! Timer delay value
-    bool IsStarted;                      //! Is the timer currently running
-    bool IsNext2Expire;                  //! Is the next timer to expire
+    uint32_t Slack;                      //! Ticks the expiry may be late, to share a wakeup
+    bool IsStarted;                      //! Is the timer currently running (in the queue)
+    bool IsPeriodic;                     //! Restarts itself from its deadline on expiry
+    uint16_t HeapIndex;                  //! Position in the timer queue while started
     void ( *Callback )( void* context ); //! Timer IRQ callback function
     void *Context;                       //! User defined data object pointer to pass back
-    struct TimerEvent_s *Next;           //! Pointer to the next Timer object.
 }TimerEvent_t;
 
 /*!
@@ -79,7 +90,7 @@ void TimerSetContext( TimerEvent_t *obj, void* context );
 void TimerIrqHandler( void );
 
 /*!
- * \brief Starts and adds the timer object to the list of timer events
+ * \brief Starts and adds the timer object to the queue of timer events
  *
  * \param [IN] obj Structure containing the timer object parameters
  */
@@ -96,7 +107,7 @@ void TimerStart( TimerEvent_t *obj );
 bool TimerIsStarted( TimerEvent_t *obj );
 
 /*!
- * \brief Stops and removes the timer object from the list of timer events
+ * \brief Stops and removes the timer object from the queue of timer events
  *
  * \param [IN] obj Structure containing the timer object parameters
  */
@@ -117,6 +128,34 @@ void TimerReset( TimerEvent_t *obj );
  */
 void TimerSetValue( TimerEvent_t *obj, uint32_t value );
 
+/*!
+ * \brief Make the timer periodic or one-shot
+ *
+ * \remark A periodic timer stays started: on expiry, TimerIrqHandler moves
+ *         its deadline one period (the timer value) past the previous
+ *         deadline, not past the time it fired, so the period does not
+ *         drift with interrupt latency, callback time or slack. Periods
+ *         missed altogether are skipped. TimerStop ends it.
+ *
+ * \param [IN] obj      Structure containing the timer object parameters
+ * \param [IN] periodic true for periodic, false (default) for one-shot
+ */
+void TimerSetPeriodic( TimerEvent_t *obj, bool periodic );
+
+/*!
+ * \brief Set how late the timer may expire
+ *
+ * \remark The timer fires between its timeout and timeout + slack. The RTC
+ *         alarm is set for the earliest timeout + slack of the running
+ *         timers, and every timer whose timeout has passed by then fires in
+ *         the same wakeup. Keep 0 (the default) for timing-critical timers.
+ *         The timer is stopped, like for TimerSetValue.
+ *
+ * \param [IN] obj   Structure containing the timer object parameters
+ * \param [IN] slack Tolerated lateness in milliseconds
+ */
+void TimerSetSlack( TimerEvent_t *obj, uint32_t slack );
+
 /*!
  * \brief Read the current time
  *
@@ -134,6 +173,14 @@ TimerTime_t TimerGetCurrentTime( void );
  */
 TimerTime_t TimerGetElapsedTime( TimerTime_t past );
 
+/*!
+ * \brief Time until the earliest running timer expires
+ *
+ * \retval time             0 if it is already due, ( TimerTime_t )-1 if
+ *                          no timer is running
+ */
+TimerTime_t TimerGetTimeToNextEvent( void );
+
 /*!
  * \brief Computes the temperature compensation for a period of time on a
  *        specific temperature.
@@ -0,0 +1,40 @@
+/*!
+ * \file      bench.c
+ *
+ * \brief     Timing and check helpers shared by the host benches and sims
+ */
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "bench.h"
+
+#define BENCH_FAILURES_PRINTED 10U
+
+static uint32_t g_Failures = 0;
+
+uint64_t BenchNow(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void BenchCheck(bool ok, const char *what, uint64_t detail)
+{
+    if (!ok && g_Failures++ < BENCH_FAILURES_PRINTED)
+    {
+        printf("  FAIL %s (%llu)\r\n", what, (unsigned long long)detail);
+    }
+}
+
+uint32_t BenchFailures(void)
+{
+    return g_Failures;
+}
@@ -0,0 +1,28 @@
+/*!
+ * \file      bench.h
+ *
+ * \brief     Timing and check helpers shared by the host benches and sims
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* BenchNow counts TSC cycles on x86 hosts and nanoseconds elsewhere */
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_UNIT      "cycles"
+#define BENCH_RATE_UNIT "cycle"
+#else
+#define BENCH_UNIT      "ns"
+#define BENCH_RATE_UNIT "ns"
+#endif
+
+uint64_t BenchNow(void);
+
+/* Counts a failed check and prints the first few, with detail as context */
+void BenchCheck(bool ok, const char *what, uint64_t detail);
+
+uint32_t BenchFailures(void);
+
+#endif /* BENCH_H */
@@ -0,0 +1,211 @@
+/*!
+ * \file      bench_crypto.c
+ *
+ * \brief     Host benchmark for the LoRaWAN crypto path
+ *
+ * \details   Built and run by `make bench-crypto` once per AES_IMPL variant.
+ *            Reports AES key expansion and block encryption cost, and the
+ *            crypto cost of one uplink frame with per-call key expansion
+ *            versus the cached session context (with and without the
+ *            precomputed keystream).
+ *
+ *            Before timing anything, checks the variant against the FIPS-197
+ *            AES-128 and RFC 4493 AES-CMAC known-answer vectors, through the
+ *            per-call and prepared-key CMAC paths, whole and in split
+ *            updates. Any mismatch fails the benchmark with a non-zero exit.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "bench.h"
+#include "aes.h"
+#include "cmac.h"
+#include "lorawan_crypto.h"
+
+#if defined(AES_IMPL_TTABLE)
+#define BENCH_AES_IMPL "ttable"
+#elif defined(AES_IMPL_SMALL)
+#define BENCH_AES_IMPL "small"
+#else
+#define BENCH_AES_IMPL "compact"
+#endif
+
+#define BENCH_ITERATIONS   20000U
+#define BENCH_PAYLOAD_LEN  12U /* typical sensor frame */
+#define BENCH_FHDR_LEN     9U  /* MHDR + FHDR + FPort, no FOpts */
+
+static const uint8_t g_NwkSKey[16] = {0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+                                      0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C};
+static const uint8_t g_AppSKey[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                      0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+static volatile uint32_t g_Sink;
+
+/* FIPS-197 appendix C.1: AES-128 */
+static const uint8_t g_Fips197Key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                         0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+static const uint8_t g_Fips197Plain[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+                                           0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+static const uint8_t g_Fips197Cipher[16] = {0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30,
+                                            0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A};
+
+/* RFC 4493 section 4: AES-CMAC with the same key as g_NwkSKey */
+static const uint8_t g_Rfc4493Message[64] = {
+    0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+    0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51,
+    0x30, 0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11, 0xE5, 0xFB, 0xC1, 0x19, 0x1A, 0x0A, 0x52, 0xEF,
+    0xF6, 0x9F, 0x24, 0x45, 0xDF, 0x4F, 0x9B, 0x17, 0xAD, 0x2B, 0x41, 0x7B, 0xE6, 0x6C, 0x37, 0x10};
+
+static const struct
+{
+    uint32_t len;
+    uint8_t mac[16];
+} g_Rfc4493Cases[] = {
+    {0, {0xBB, 0x1D, 0x69, 0x29, 0xE9, 0x59, 0x37, 0x28, 0x7F, 0xA3, 0x7D, 0x12, 0x9B, 0x75, 0x67, 0x46}},
+    {16, {0x07, 0x0A, 0x16, 0xB4, 0x6B, 0x4D, 0x41, 0x44, 0xF7, 0x9B, 0xDD, 0x9D, 0xD0, 0x4A, 0x28, 0x7C}},
+    {40, {0xDF, 0xA6, 0x67, 0x47, 0xDE, 0x9A, 0xE6, 0x30, 0x30, 0xCA, 0x32, 0x61, 0x14, 0x97, 0xC8, 0x27}},
+    {64, {0x51, 0xF0, 0xBE, 0xBF, 0x7E, 0x3B, 0x9D, 0x92, 0xFC, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3C, 0xFE}},
+};
+
+static void BenchKnownAnswers(void)
+{
+    uint8_t block[16];
+    uint8_t mac[16];
+    aes_context aes;
+    AES_CMAC_CTX cmac;
+    AES_CMAC_KEY key;
+    AES_CMAC_KEYED_CTX keyed;
+
+    aes_set_key(g_Fips197Key, 16, &aes);
+    aes_encrypt(g_Fips197Plain, block, &aes);
+    BenchCheck(memcmp(block, g_Fips197Cipher, 16) == 0, "FIPS-197 C.1", 0);
+
+    AES_CMAC_PrepareKey(&key, g_NwkSKey);
+    for (uint32_t i = 0; i < sizeof(g_Rfc4493Cases) / sizeof(g_Rfc4493Cases[0]); i++)
+    {
+        uint32_t len = g_Rfc4493Cases[i].len;
+
+        AES_CMAC_Init(&cmac);
+        AES_CMAC_SetKey(&cmac, g_NwkSKey);
+        AES_CMAC_Update(&cmac, g_Rfc4493Message, len);
+        AES_CMAC_Final(mac, &cmac);
+        BenchCheck(memcmp(mac, g_Rfc4493Cases[i].mac, 16) == 0, "RFC 4493 CMAC", len);
+
+        AES_CMAC_KeyedInit(&keyed, &key);
+        AES_CMAC_KeyedUpdate(&keyed, g_Rfc4493Message, len);
+        AES_CMAC_KeyedFinal(mac, &keyed);
+        BenchCheck(memcmp(mac, g_Rfc4493Cases[i].mac, 16) == 0, "RFC 4493 CMAC, prepared key", len);
+
+        /* Updates split off block boundaries carry the partial block over */
+        AES_CMAC_KeyedInit(&keyed, &key);
+        AES_CMAC_KeyedUpdate(&keyed, g_Rfc4493Message, len / 3U);
+        AES_CMAC_KeyedUpdate(&keyed, &g_Rfc4493Message[len / 3U], len / 2U - len / 3U);
+        AES_CMAC_KeyedUpdate(&keyed, &g_Rfc4493Message[len / 2U], len - len / 2U);
+        AES_CMAC_KeyedFinal(mac, &keyed);
+        BenchCheck(memcmp(mac, g_Rfc4493Cases[i].mac, 16) == 0, "RFC 4493 CMAC, split updates", len);
+    }
+
+    printf("  known answers (FIPS-197, RFC 4493)  %s\r\n", (BenchFailures() == 0U) ? "pass" : "FAIL");
+}
+
+static void BenchReport(const char *name, uint64_t total, uint32_t count)
+{
+    printf("  %-34s %10.1f %s\r\n", name, (double)total / (double)count, BENCH_UNIT);
+}
+
+static void BenchFrame(uint8_t *frame, uint32_t fCnt)
+{
+    memset(frame, 0, BENCH_FHDR_LEN);
+    frame[0] = 0x40;
+    frame[6] = (uint8_t)(fCnt & 0xFF);
+    frame[7] = (uint8_t)((fCnt >> 8) & 0xFF);
+    frame[8] = 2;
+    for (uint8_t i = 0; i < BENCH_PAYLOAD_LEN; i++)
+    {
+        frame[BENCH_FHDR_LEN + i] = (uint8_t)(i * 7U + fCnt);
+    }
+}
+
+int main(void)
+{
+    const uint32_t devAddr = 0x26011234;
+    const uint8_t frameLen = BENCH_FHDR_LEN + BENCH_PAYLOAD_LEN;
+    uint8_t block[16] = {0};
+    uint8_t frame[64];
+    uint32_t mic = 0;
+    aes_context aes;
+    LoRaWANCryptoSession_t session;
+    LoRaWANKeystream_t keystream;
+    uint64_t start;
+    uint64_t total;
+
+    printf("AES_IMPL=%s\r\n", BENCH_AES_IMPL);
+
+    BenchKnownAnswers();
+    if (BenchFailures() != 0U)
+    {
+        return 1;
+    }
+
+    start = BenchNow();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        aes_set_key(g_AppSKey, 16, &aes);
+    }
+    BenchReport("aes_set_key", BenchNow() - start, BENCH_ITERATIONS);
+
+    start = BenchNow();
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        aes_encrypt(block, block, &aes);
+    }
+    g_Sink = block[0];
+    BenchReport("aes_encrypt per block", BenchNow() - start, BENCH_ITERATIONS);
+
+    /* Uplink before session caching: key schedules and subkeys per frame */
+    total = 0;
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        BenchFrame(frame, i);
+        start = BenchNow();
+        LoRaWAN_Crypto_EncryptPayload(g_AppSKey, &frame[BENCH_FHDR_LEN], BENCH_PAYLOAD_LEN,
+                                      devAddr, i, 0, &frame[BENCH_FHDR_LEN]);
+        LoRaWAN_Crypto_ComputeMic(g_NwkSKey, frame, frameLen, devAddr, i, 0, &mic);
+        total += BenchNow() - start;
+        g_Sink ^= mic;
+    }
+    BenchReport("uplink frame, per-call keys", total, BENCH_ITERATIONS);
+
+    LoRaWAN_Crypto_SessionInit(&session, g_NwkSKey, g_AppSKey);
+
+    total = 0;
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        BenchFrame(frame, i);
+        start = BenchNow();
+        LoRaWAN_Crypto_SessionEncryptPayload(&session, NULL, &frame[BENCH_FHDR_LEN], BENCH_PAYLOAD_LEN,
+                                             devAddr, i, 0, &frame[BENCH_FHDR_LEN]);
+        LoRaWAN_Crypto_SessionComputeMic(&session, frame, frameLen, devAddr, i, 0, &mic);
+        total += BenchNow() - start;
+        g_Sink ^= mic;
+    }
+    BenchReport("uplink frame, session context", total, BENCH_ITERATIONS);
+
+    /* Keystream is produced in idle time; only XOR + CMAC stay on the TX path */
+    total = 0;
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        BenchFrame(frame, i);
+        LoRaWAN_Crypto_SessionPrecomputeKeystream(&session, devAddr, i, 0, &keystream);
+        start = BenchNow();
+        LoRaWAN_Crypto_SessionEncryptPayload(&session, &keystream, &frame[BENCH_FHDR_LEN], BENCH_PAYLOAD_LEN,
+                                             devAddr, i, 0, &frame[BENCH_FHDR_LEN]);
+        LoRaWAN_Crypto_SessionComputeMic(&session, frame, frameLen, devAddr, i, 0, &mic);
+        total += BenchNow() - start;
+        g_Sink ^= mic;
+    }
+    BenchReport("uplink frame, session + keystream", total, BENCH_ITERATIONS);
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+/*!
+ * \file      bench_storage.c
+ *
+ * \brief     Host benchmark for the storage write path
+ *
+ * \details   Built and run by `make bench-storage` against a RAM model of
+ *            the data EEPROM that, like eeprom-board.c, programs aligned
+ *            words and skips unchanged ones. Reports the bytes written and
+ *            program cycles per operation and the longest single driver
+ *            call, which is how long a write blocks its caller (interrupts
+ *            are only masked for one cycle of it). Times use
+ *            BENCH_EEPROM_PROG_MS per cycle (STM32L0 data EEPROM program
+ *            time).
+ *
+ *            storage.c is included rather than linked so a reset can be
+ *            modelled: every static goes back to its power-on value and
+ *            Storage_Init runs on the EEPROM image as it was left. The
+ *            reset checks replay the log after the benchmark, after a
+ *            compaction, over a half-written record, from a damaged slot A
+ *            and over a stale log after a factory reset.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "bench.h"
+#include "storage.c"
+
+#define BENCH_EEPROM_PROG_MS 3.2
+#define BENCH_ITERATIONS     200U
+#define BENCH_UPLINKS        1000U
+
+static uint8_t g_Eeprom[EEPROM_SIZE];
+
+LmnStatus_t EepromMcuUpdateBuffer(uint16_t addr, const uint8_t *buffer, uint16_t size, uint16_t *programmed)
+{
+    uint16_t cycles = 0;
+
+    if (buffer == NULL || size == 0U || ((uint32_t)addr + size) > sizeof(g_Eeprom))
+    {
+        return LMN_STATUS_ERROR;
+    }
+
+    for (uint32_t i = addr; i < (uint32_t)addr + size;)
+    {
+        uint32_t width = (((i & 3U) == 0U) && ((uint32_t)addr + size - i) >= 4U) ? 4U : 1U;
+        if (memcmp(&g_Eeprom[i], &buffer[i - addr], width) != 0)
+        {
+            memcpy(&g_Eeprom[i], &buffer[i - addr], width);
+            cycles++;
+        }
+        i += width;
+    }
+
+    if (programmed != NULL)
+    {
+        *programmed = cycles;
+    }
+    return LMN_STATUS_OK;
+}
+
+LmnStatus_t EepromMcuReadBuffer(uint16_t addr, uint8_t *buffer, uint16_t size)
+{
+    if (buffer == NULL || size == 0U || ((uint32_t)addr + size) > sizeof(g_Eeprom))
+    {
+        return LMN_STATUS_ERROR;
+    }
+    memcpy(buffer, &g_Eeprom[addr], size);
+    return LMN_STATUS_OK;
+}
+
+static void BenchReport(const char *name, uint32_t count)
+{
+    StorageWriteStats_t stats;
+    Storage_GetWriteStats(&stats);
+    printf("  %-28s %7.1f bytes/op %6.2f cycles/op %8.1f ms longest write %3lu compactions\r\n", name,
+           (double)stats.BytesWritten / (double)count, (double)stats.ProgramCycles / (double)count,
+           stats.MaxCyclesPerCall * BENCH_EEPROM_PROG_MS, (unsigned long)stats.Compactions);
+    Storage_ResetWriteStats();
+}
+
+static uint8_t *BenchEeprom(uint32_t address)
+{
+    return &g_Eeprom[address - EEPROM_BASE_ADDRESS];
+}
+
+/* A reset: storage.c keeps nothing but what is in the EEPROM */
+static StorageStatus_t BenchReboot(void)
+{
+    memset(&g_StorageCache, 0, sizeof(g_StorageCache));
+    g_StorageInitialized = false;
+    g_BlockSlot = STORAGE_SLOT_NONE;
+    g_BlockSequence = 0;
+    g_JournalScanned = false;
+    g_JournalHasRecord = false;
+    g_JournalNext = 0;
+    g_JournalLast = 0;
+    g_LogSegment = STORAGE_LOG_NONE;
+    g_LogSequence = 0;
+    g_LogWritePos = 0;
+    memset(g_LogIndex, 0, sizeof(g_LogIndex));
+    g_LogCompactPending = false;
+    g_PendingKeys = 0;
+    g_JournalPending = false;
+    g_WriteGate = NULL;
+    memset(g_Listeners, 0, sizeof(g_Listeners));
+    g_ListenerCount = 0;
+    return Storage_Init();
+}
+
+/* Everything but the CRC, which is only meaningful next to its block */
+static bool BenchSameConfig(const StorageData_t *a, const StorageData_t *b)
+{
+    return memcmp(a, b, offsetof(StorageData_t, Crc)) == 0;
+}
+
+static void BenchWriteTdc(uint32_t value)
+{
+    Storage_Write(STORAGE_KEY_TDC, (const uint8_t *)&value, sizeof(value));
+    Storage_Flush();
+}
+
+static void BenchResetChecks(void)
+{
+    StorageData_t before;
+    StorageStatus_t status;
+
+    /* Everything the benchmark wrote, config and journal alike */
+    memcpy(&before, Storage_Get(), sizeof(before));
+    status = BenchReboot();
+    BenchCheck(status == STORAGE_OK, "reset: init", status);
+    BenchCheck(Storage_Get()->DataRate == (uint8_t)((BENCH_ITERATIONS - 1U) % 6U), "reset: DR from the log",
+               Storage_Get()->DataRate);
+    BenchCheck(Storage_Get()->AdrEnabled == (uint8_t)((BENCH_ITERATIONS - 1U) & 1U), "reset: ADR from the log",
+               Storage_Get()->AdrEnabled);
+    /* The journal commits every STORAGE_FCNT_COMMIT_INTERVAL uplinks, the
+     * session restore skips past the ones in between */
+    uint32_t fCntUp = Storage_Get()->FrameCounterUp;
+    BenchCheck(fCntUp <= BENCH_UPLINKS && (BENCH_UPLINKS - fCntUp) < STORAGE_FCNT_COMMIT_INTERVAL,
+               "reset: FCntUp from the journal", fCntUp);
+    before.FrameCounterUp = fCntUp;
+    BenchCheck(BenchSameConfig(&before, Storage_Get()), "reset: whole configuration", 0U);
+
+    /* Fill the segment until it compacts, then reset on the new segment */
+    StorageWriteStats_t stats;
+    Storage_GetWriteStats(&stats);
+    uint32_t compactions = stats.Compactions;
+    uint32_t tdc = LORAWAN_TDC_MINIMUM_MS;
+    while (stats.Compactions == compactions)
+    {
+        BenchWriteTdc(++tdc);
+        Storage_GetWriteStats(&stats);
+    }
+    BenchWriteTdc(++tdc);
+    uint8_t segment = g_LogSegment;
+    status = BenchReboot();
+    BenchCheck(status == STORAGE_OK && g_LogSegment == segment, "compacted: init on the new segment", status);
+    BenchCheck(Storage_Get()->TxDutyCycle == tdc, "compacted: TDC", Storage_Get()->TxDutyCycle);
+    BenchCheck(Storage_Get()->DataRate == before.DataRate, "compacted: DR carried over", Storage_Get()->DataRate);
+
+    /* Reset before the last word of a record was programmed: its CRC is
+     * still erased, so replay ends at the value before it */
+    BenchWriteTdc(tdc + 1U);
+    memset(BenchEeprom(Storage_LogSegmentAddress(g_LogSegment) + g_LogIndex[STORAGE_KEY_TDC] +
+                       STORAGE_LOG_RECORD_SIZE(sizeof(uint32_t)) - sizeof(uint32_t)),
+           0xFF, sizeof(uint32_t));
+    status = BenchReboot();
+    BenchCheck(status == STORAGE_OK && Storage_Get()->TxDutyCycle == tdc, "half-written: previous TDC",
+               Storage_Get()->TxDutyCycle);
+    BenchWriteTdc(tdc + 2U);
+    status = BenchReboot();
+    BenchCheck(status == STORAGE_OK && Storage_Get()->TxDutyCycle == tdc + 2U, "half-written: next record replaces it",
+               Storage_Get()->TxDutyCycle);
+
+    /* Slot A damaged: slot B and the log still hold everything */
+    memcpy(&before, Storage_Get(), sizeof(before));
+    BenchEeprom(STORAGE_SLOT_A_ADDRESS)[sizeof(StorageHeader_t) + offsetof(StorageData_t, AppKey)] ^= 0x01U;
+    status = BenchReboot();
+    BenchCheck(status == STORAGE_RESTORED_FROM_BACKUP, "slot A damaged: restored from slot B", status);
+    BenchCheck(BenchSameConfig(&before, Storage_Get()), "slot A damaged: whole configuration", 0U);
+    status = BenchReboot();
+    BenchCheck(status == STORAGE_OK, "slot A damaged: rewritten", status);
+
+    /* Both slots lost: defaults, and the surviving log must stay dead */
+    memset(BenchEeprom(STORAGE_SLOT_A_ADDRESS), 0x00, sizeof(StorageBlock_t));
+    memset(BenchEeprom(STORAGE_SLOT_B_ADDRESS), 0x00, sizeof(StorageBlock_t));
+    status = BenchReboot();
+    BenchCheck(status == STORAGE_FACTORY_RESET, "factory reset: init", status);
+    status = BenchReboot();
+    BenchCheck(status == STORAGE_OK, "factory reset: init after", status);
+    BenchCheck(Storage_Get()->TxDutyCycle == LORAWAN_DEFAULT_TDC, "factory reset: stale log not replayed",
+               Storage_Get()->TxDutyCycle);
+    BenchCheck(Storage_Get()->DataRate == LORAWAN_DEFAULT_DATARATE, "factory reset: DR default",
+               Storage_Get()->DataRate);
+
+    printf("  reset checks (replay, compacted, half-written, slot A, stale log)  %s\r\n",
+           (BenchFailures() == 0U) ? "pass" : "FAIL");
+}
+
+int main(void)
+{
+    StorageData_t data;
+    uint8_t value;
+
+    memset(g_Eeprom, 0xFF, sizeof(g_Eeprom));
+    Storage_ResetWriteStats();
+    if (Storage_Init() != STORAGE_FACTORY_RESET)
+    {
+        printf("storage init failed\r\n");
+        return 1;
+    }
+    BenchReport("first boot (defaults)", 1U);
+
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        value = (uint8_t)(i & 1U);
+        Storage_Write(STORAGE_KEY_ADR, &value, sizeof(value));
+        Storage_Process();
+    }
+    BenchReport("Storage_Write(ADR)", BENCH_ITERATIONS);
+
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        Storage_Load(&data);
+        data.DataRate = (uint8_t)(i % 6U);
+        Storage_Save(&data);
+        Storage_Process();
+    }
+    BenchReport("Load/Save (AT+DR)", BENCH_ITERATIONS);
+
+    for (uint32_t i = 1; i <= BENCH_UPLINKS; i++)
+    {
+        Storage_UpdateFrameCounters(i, 0U);
+        Storage_Process();
+    }
+    BenchReport("frame counters per uplink", BENCH_UPLINKS);
+
+    printf("  full block write for reference: %u bytes (one A/B slot)\r\n",
+           (unsigned)(sizeof(StorageHeader_t) + sizeof(StorageData_t)));
+
+    BenchResetChecks();
+    return (BenchFailures() == 0U) ? 0 : 1;
+}
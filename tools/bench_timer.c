@@ -0,0 +1,194 @@
+/*!
+ * \file      bench_timer.c
+ *
+ * \brief     Host benchmark for the timer queue in timer.c
+ *
+ * \details   Built and run by `make bench-timer`. timer.c runs against a
+ *            fake RTC (fake_rtc.c) whose time only moves when the benchmark
+ *            says so, with 8 to 512 timers running. Reports the cost of
+ *            TimerStart, of a TimerStop/TimerStart pair on a random running
+ *            timer, and of one expiry through TimerIrqHandler with its
+ *            callback restarting the timer. Also checks that timers fire in
+ *            deadline order and never before their deadline.
+ *
+ *            Then replays 24 h of the firmware's own timers (schedule.c: TX
+ *            at the default TDC with RX1/RX2 after each uplink, sensor wake
+ *            and housekeeping) and counts RTC wakeups per hour, without slack
+ *            and with the slack the firmware configures. The count includes
+ *            the LPTIM1 time base's own interrupts (autoreload and idle
+ *            compare, once per 16-bit period), which wake the MCU whether or
+ *            not a timer is due. Also counts the uplinks sent with the TX
+ *            timer restarted after each uplink (one-shot) and with it
+ *            periodic.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bench.h"
+#include "fake_rtc.h"
+#include "schedule.h"
+
+#include "timer.h"
+#include "config.h"
+
+#define BENCH_MIN_TIMEOUT 5U
+#define BENCH_CHURN       20000U
+#define BENCH_EXPIRIES    20000U
+
+#define BENCH_SCHEDULE_HOURS 24U
+
+/* rtc-board.c: 65536 ticks of LSE / 32 per period, two interrupts each */
+#define BENCH_LPTIM_PERIOD_MS       64000U
+#define BENCH_LPTIM_IRQS_PER_PERIOD 2U
+#define BENCH_TIMEBASE_IRQS \
+    (((BENCH_SCHEDULE_HOURS * 3600000UL) / BENCH_LPTIM_PERIOD_MS) * BENCH_LPTIM_IRQS_PER_PERIOD)
+
+static const uint16_t g_Sizes[] = { 8U, 32U, 128U, 512U };
+
+static TimerEvent_t g_Timers[TIMER_MAX_COUNT];
+static uint32_t g_Deadline[TIMER_MAX_COUNT];
+
+static uint32_t g_LastFired = 0;
+static uint32_t g_Expiries = 0;
+static uint32_t g_Seed = 12345U;
+
+static uint32_t BenchRandom(void)
+{
+    g_Seed = (g_Seed * 1103515245U) + 12345U;
+    return g_Seed >> 1;
+}
+
+/* Timeouts of 1 to 10 s in ms-equal ticks, spread so deadlines interleave */
+static void BenchStart(uint32_t index)
+{
+    TimerSetValue(&g_Timers[index], 1000U + (BenchRandom() % 9000U));
+    g_Deadline[index] = FakeRtcNow() + g_Timers[index].ReloadValue;
+    TimerStart(&g_Timers[index]);
+}
+
+static void BenchOnTimer(void *context)
+{
+    uint32_t index = (uint32_t)(uintptr_t)context;
+
+    BenchCheck((int32_t)(FakeRtcNow() + BENCH_MIN_TIMEOUT - g_Deadline[index]) >= 0, "fired before its deadline",
+               index);
+    BenchCheck((int32_t)(g_Deadline[index] - g_LastFired) >= 0, "fired out of deadline order", index);
+    g_LastFired = g_Deadline[index];
+    g_Expiries++;
+    BenchStart(index);
+}
+
+static void BenchRun(uint16_t count)
+{
+    uint64_t start;
+    double startCost;
+    double churnCost;
+    double expireCost;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        TimerInit(&g_Timers[i], BenchOnTimer);
+        TimerSetContext(&g_Timers[i], (void *)(uintptr_t)i);
+    }
+
+    /* Fill the queue several times over so small sizes time enough calls */
+    uint64_t total = 0;
+    uint32_t rounds = (BENCH_CHURN + count - 1U) / count;
+    for (uint32_t round = 0; round < rounds; round++)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            TimerStop(&g_Timers[i]);
+        }
+        start = BenchNow();
+        for (uint32_t i = 0; i < count; i++)
+        {
+            BenchStart(i);
+        }
+        total += BenchNow() - start;
+    }
+    startCost = (double)total / ((double)rounds * count);
+
+    start = BenchNow();
+    for (uint32_t i = 0; i < BENCH_CHURN; i++)
+    {
+        uint32_t index = BenchRandom() % count;
+        TimerStop(&g_Timers[index]);
+        BenchStart(index);
+    }
+    churnCost = (double)(BenchNow() - start) / BENCH_CHURN;
+
+    g_Expiries = 0;
+    g_LastFired = FakeRtcNow();
+    start = BenchNow();
+    while (g_Expiries < BENCH_EXPIRIES)
+    {
+        BenchCheck(FakeRtcAlarmSet(), "alarm armed while timers run", g_Expiries);
+        FakeRtcFireAlarm();
+    }
+    expireCost = (double)(BenchNow() - start) / g_Expiries;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        TimerStop(&g_Timers[i]);
+        BenchCheck(!TimerIsStarted(&g_Timers[i]), "stopped", i);
+    }
+    BenchCheck(!FakeRtcAlarmSet(), "alarm stopped with the last timer", count);
+
+    printf("  %4u timers %10.1f %s/start %10.1f %s/stop+start %10.1f %s/expiry\r\n", (unsigned)count, startCost,
+           BENCH_UNIT, churnCost, BENCH_UNIT, expireCost, BENCH_UNIT);
+}
+
+static uint32_t BenchSchedule(bool slack, bool periodic, uint32_t *uplinks)
+{
+    uint32_t end = FakeRtcNow() + (BENCH_SCHEDULE_HOURS * 3600000UL);
+    uint32_t wakeups = 0;
+
+    ScheduleStart(slack, periodic, NULL);
+    while ((int32_t)(end - FakeRtcAlarmAt()) > 0)
+    {
+        FakeRtcFireAlarm();
+        wakeups++;
+        ScheduleProcess();
+    }
+    *uplinks = ScheduleUplinks();
+    ScheduleStop();
+
+    return (wakeups + BENCH_TIMEBASE_IRQS) / BENCH_SCHEDULE_HOURS;
+}
+
+int main(void)
+{
+    /* Start close to the tick wrap so deadlines cross it */
+    FakeRtcSetMinimumTimeout(BENCH_MIN_TIMEOUT);
+    FakeRtcSetNow(0xFFFF0000UL);
+
+    for (uint32_t i = 0; i < sizeof(g_Sizes) / sizeof(g_Sizes[0]); i++)
+    {
+        if (g_Sizes[i] <= TIMER_MAX_COUNT)
+        {
+            BenchRun(g_Sizes[i]);
+        }
+    }
+
+    uint32_t oneShotUplinks;
+    uint32_t periodicUplinks;
+    uint32_t expected = (BENCH_SCHEDULE_HOURS * 3600000UL) / LORAWAN_DEFAULT_TDC;
+    uint32_t before = BenchSchedule(false, false, &oneShotUplinks);
+    uint32_t after = BenchSchedule(true, false, &oneShotUplinks);
+    uint32_t periodic = BenchSchedule(true, true, &periodicUplinks);
+    printf("  %u h schedule: %lu RTC wakeups/h without slack, %lu with (TX %lu ms, housekeeping %lu ms), %lu periodic\r\n",
+           BENCH_SCHEDULE_HOURS, (unsigned long)before, (unsigned long)after, (unsigned long)LORAWAN_TDC_SLACK_MS,
+           (unsigned long)SENSOR_HOUSEKEEPING_SLACK_MS, (unsigned long)periodic);
+    printf("  of which %lu/h are the LPTIM1 time base (%lu ms period)\r\n",
+           (unsigned long)(BENCH_TIMEBASE_IRQS / BENCH_SCHEDULE_HOURS), (unsigned long)BENCH_LPTIM_PERIOD_MS);
+    printf("  uplinks in %u h at TDC %lu ms: %lu one-shot, %lu periodic (%lu due)\r\n", BENCH_SCHEDULE_HOURS,
+           (unsigned long)LORAWAN_DEFAULT_TDC, (unsigned long)oneShotUplinks, (unsigned long)periodicUplinks,
+           (unsigned long)expected);
+    BenchCheck(periodicUplinks + 1U >= expected && periodicUplinks <= expected, "periodic TX keeps its cadence",
+               periodicUplinks);
+
+    printf("  %s\r\n", (BenchFailures() == 0U) ? "timer queue: all checks passed" : "timer queue: FAILED");
+    return (BenchFailures() == 0U) ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+/*!
+ * \file      fake_rtc.c
+ *
+ * \brief     Fake RTC for the host timer benches and sims
+ */
+#include <stddef.h>
+
+#include "fake_rtc.h"
+#include "rtc-board.h"
+#include "timer.h"
+#include "utilities.h"
+
+static uint32_t g_Now = 0;
+static uint32_t g_Context = 0;
+static uint32_t g_MinimumTimeout = 1U;
+static uint32_t g_AlarmAt = 0;
+static bool g_AlarmSet = false;
+
+void FakeRtcSetMinimumTimeout(uint32_t ticks)
+{
+    g_MinimumTimeout = ticks;
+}
+
+uint32_t FakeRtcNow(void)
+{
+    return g_Now;
+}
+
+void FakeRtcSetNow(uint32_t now)
+{
+    g_Now = now;
+}
+
+void FakeRtcAdvance(uint32_t ms)
+{
+    g_Now += ms;
+}
+
+bool FakeRtcAlarmSet(void)
+{
+    return g_AlarmSet;
+}
+
+uint32_t FakeRtcAlarmAt(void)
+{
+    return g_AlarmAt;
+}
+
+void FakeRtcFireAlarm(void)
+{
+    g_Now = g_AlarmAt;
+    TimerIrqHandler();
+}
+
+void RtcInit(void)
+{
+}
+
+uint32_t RtcSetTimerContext(void)
+{
+    g_Context = g_Now;
+    return g_Context;
+}
+
+uint32_t RtcGetTimerContext(void)
+{
+    return g_Context;
+}
+
+uint32_t RtcGetMinimumTimeout(void)
+{
+    return g_MinimumTimeout;
+}
+
+uint32_t RtcMs2Tick(uint32_t milliseconds)
+{
+    return milliseconds;
+}
+
+uint32_t RtcTick2Ms(uint32_t tick)
+{
+    return tick;
+}
+
+void RtcSetAlarm(uint32_t timeout)
+{
+    g_AlarmAt = g_Context + timeout;
+    g_AlarmSet = true;
+}
+
+void RtcStopAlarm(void)
+{
+    g_AlarmSet = false;
+}
+
+uint32_t RtcGetTimerValue(void)
+{
+    return g_Now;
+}
+
+uint32_t RtcGetTimerElapsedTime(void)
+{
+    return g_Now - g_Context;
+}
+
+uint32_t RtcGetCalendarTime(uint16_t *milliseconds)
+{
+    if (milliseconds != NULL)
+    {
+        *milliseconds = (uint16_t)(g_Now % 1000U);
+    }
+    return g_Now / 1000U;
+}
+
+/* Busy wait: time passes in RUN and the alarm interrupt lands in it */
+void RtcDelayMs(uint32_t delay)
+{
+    uint32_t until = g_Now + delay;
+
+    while (g_AlarmSet && (int32_t)(until - g_AlarmAt) >= 0)
+    {
+        g_AlarmSet = false;
+        FakeRtcFireAlarm();
+    }
+    g_Now = until;
+}
+
+void RtcProcess(void)
+{
+}
+
+TimerTime_t RtcTempCompensation(TimerTime_t period, float temperature)
+{
+    (void)temperature;
+    return period;
+}
+
+void BoardCriticalSectionBegin(uint32_t *mask)
+{
+    *mask = 0U;
+}
+
+void BoardCriticalSectionEnd(uint32_t *mask)
+{
+    (void)mask;
+}
@@ -0,0 +1,30 @@
+/*!
+ * \file      fake_rtc.h
+ *
+ * \brief     Fake RTC for the host timer benches and sims
+ *
+ * \details   Implements the rtc-board.h interface timer.c needs, one tick per
+ *            millisecond, with time that only moves when the tool says so.
+ *            The alarm timer.c programs is recorded rather than raised; the
+ *            tool fires it with FakeRtcFireAlarm.
+ */
+#ifndef FAKE_RTC_H
+#define FAKE_RTC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Ticks timer.c may not program an alarm below (1 unless set) */
+void FakeRtcSetMinimumTimeout(uint32_t ticks);
+
+uint32_t FakeRtcNow(void);
+void FakeRtcSetNow(uint32_t now);
+void FakeRtcAdvance(uint32_t ms);
+
+bool FakeRtcAlarmSet(void);
+uint32_t FakeRtcAlarmAt(void);
+
+/* Moves time to the alarm and runs its interrupt (TimerIrqHandler) */
+void FakeRtcFireAlarm(void);
+
+#endif /* FAKE_RTC_H */
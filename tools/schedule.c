@@ -0,0 +1,135 @@
+/*!
+ * \file      schedule.c
+ *
+ * \brief     The firmware's timers, for the host timer benches and sims
+ */
+#include <stddef.h>
+
+#include "fake_rtc.h"
+#include "schedule.h"
+#include "timer.h"
+#include "config.h"
+
+static TimerEvent_t g_TxTimer;
+static TimerEvent_t g_Rx1Timer;
+static TimerEvent_t g_Rx2Timer;
+static TimerEvent_t g_WakeTimer;
+static TimerEvent_t g_HousekeepingTimer;
+static void (*g_OnFire)(void);
+static bool g_TxDue;
+static bool g_CaptureDue;
+static bool g_Periodic;
+static uint32_t g_Uplinks;
+
+static void ScheduleFired(void)
+{
+    if (g_OnFire != NULL)
+    {
+        g_OnFire();
+    }
+}
+
+static void ScheduleOnTx(void *context)
+{
+    (void)context;
+    ScheduleFired();
+    g_TxDue = true;
+}
+
+static void ScheduleOnSensor(void *context)
+{
+    (void)context;
+    ScheduleFired();
+    g_CaptureDue = true;
+}
+
+static void ScheduleOnRx(void *context)
+{
+    (void)context;
+    ScheduleFired();
+}
+
+static void ScheduleArmSensor(void)
+{
+    if (g_Periodic)
+    {
+        if (!TimerIsStarted(&g_WakeTimer))
+        {
+            TimerSetValue(&g_WakeTimer, SENSOR_WAKEUP_DEFAULT_MS);
+            TimerStart(&g_WakeTimer);
+        }
+        TimerReset(&g_HousekeepingTimer);
+        return;
+    }
+
+    TimerStop(&g_WakeTimer);
+    TimerSetValue(&g_WakeTimer, SENSOR_WAKEUP_DEFAULT_MS);
+    TimerStart(&g_WakeTimer);
+    TimerStop(&g_HousekeepingTimer);
+    TimerSetValue(&g_HousekeepingTimer, SENSOR_HOUSEKEEPING_INTERVAL_MS);
+    TimerStart(&g_HousekeepingTimer);
+}
+
+void ScheduleStart(bool slack, bool periodic, void (*onFire)(void))
+{
+    g_OnFire = onFire;
+    g_Periodic = periodic;
+    g_TxDue = false;
+    g_CaptureDue = false;
+    g_Uplinks = 0;
+
+    TimerInit(&g_TxTimer, ScheduleOnTx);
+    TimerInit(&g_Rx1Timer, ScheduleOnRx);
+    TimerInit(&g_Rx2Timer, ScheduleOnRx);
+    TimerInit(&g_WakeTimer, ScheduleOnSensor);
+    TimerInit(&g_HousekeepingTimer, ScheduleOnSensor);
+    TimerSetValue(&g_Rx1Timer, LORAWAN_RX1_DELAY);
+    TimerSetValue(&g_Rx2Timer, LORAWAN_RX2_DELAY);
+    TimerSetValue(&g_TxTimer, LORAWAN_DEFAULT_TDC);
+    TimerSetValue(&g_HousekeepingTimer, SENSOR_HOUSEKEEPING_INTERVAL_MS);
+    TimerSetPeriodic(&g_TxTimer, periodic);
+    TimerSetPeriodic(&g_WakeTimer, periodic);
+    if (slack)
+    {
+        TimerSetSlack(&g_TxTimer, LORAWAN_TDC_SLACK_MS);
+        TimerSetSlack(&g_HousekeepingTimer, SENSOR_HOUSEKEEPING_SLACK_MS);
+    }
+    TimerStart(&g_TxTimer);
+    ScheduleArmSensor();
+}
+
+void ScheduleProcess(void)
+{
+    if (g_CaptureDue)
+    {
+        g_CaptureDue = false;
+        FakeRtcAdvance(SCHEDULE_CAPTURE_MS);
+        ScheduleArmSensor();
+    }
+    if (g_TxDue)
+    {
+        g_TxDue = false;
+        FakeRtcAdvance(SCHEDULE_UPLINK_MS);
+        g_Uplinks++;
+        if (!g_Periodic)
+        {
+            TimerStart(&g_TxTimer);
+        }
+        TimerStart(&g_Rx1Timer);
+        TimerStart(&g_Rx2Timer);
+    }
+}
+
+uint32_t ScheduleUplinks(void)
+{
+    return g_Uplinks;
+}
+
+void ScheduleStop(void)
+{
+    TimerStop(&g_TxTimer);
+    TimerStop(&g_Rx1Timer);
+    TimerStop(&g_Rx2Timer);
+    TimerStop(&g_WakeTimer);
+    TimerStop(&g_HousekeepingTimer);
+}
@@ -0,0 +1,32 @@
+/*!
+ * \file      schedule.h
+ *
+ * \brief     The firmware's timers, for the host timer benches and sims
+ *
+ * \details   TX at the default TDC with RX1/RX2 after each uplink, sensor
+ *            wake and housekeeping, set up and re-armed the way main.c,
+ *            lorawan.c and sensor.c do, against the fake RTC.
+ */
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHEDULE_CAPTURE_MS 30U /* sensor handshake before re-arming */
+#define SCHEDULE_UPLINK_MS  60U /* payload build and radio setup */
+
+/* Sets the timers up, with or without their slack and with the TX and sensor
+ * wake timers periodic or restarted, and starts them. onFire, if not NULL,
+ * runs in every timer callback */
+void ScheduleStart(bool slack, bool periodic, void (*onFire)(void));
+
+/* The main loop's work after a wake-up: a due capture re-arms the sensor
+ * timers, a due uplink starts RX1/RX2. Moves the fake RTC past the work */
+void ScheduleProcess(void);
+
+uint32_t ScheduleUplinks(void);
+
+void ScheduleStop(void);
+
+#endif /* SCHEDULE_H */
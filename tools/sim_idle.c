@@ -0,0 +1,193 @@
+/*!
+ * \file      sim_idle.c
+ *
+ * \brief     Host model check of the tickless idle in power.c
+ *
+ * \details   Built and run by `make sim-idle`. power.c, timer.c and
+ *            lpm-board.c run against a fake RTC (fake_rtc.c, one tick per
+ *            millisecond) and low power entries that jump to the next RTC
+ *            alarm. A main loop drives the firmware's timers (schedule.c) for
+ *            24 h: TX at the default TDC with RX1/RX2 after each uplink,
+ *            sensor wake and housekeeping. Every Power_Idle decision is read back from the
+ *            idle trace and checked: no sleep past a deadline or the
+ *            watchdog limit, STOP for every idle long enough (the RX delays
+ *            included), left before any application timer fires and its
+ *            clock lead run out in the same call, OFF only with nothing
+ *            pending. Prints the modes entered per hour and the last trace
+ *            entries.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bench.h"
+#include "fake_rtc.h"
+#include "schedule.h"
+#include "stm32l0xx.h"
+
+static RCC_TypeDef ModelRcc;
+static PWR_TypeDef ModelPwr;
+
+#undef RCC
+#undef PWR
+#define RCC (&ModelRcc)
+#define PWR (&ModelPwr)
+
+#include "power.c"
+
+#define SIM_HOURS 24U
+
+static PowerMode_t g_InMode = POWER_MODE_RUN;
+static uint32_t g_LastRefresh = 0;
+static uint32_t g_WorstRefreshGap = 0;
+static uint32_t g_FiredInStop = 0;
+
+void Watchdog_Refresh(void)
+{
+    uint32_t gap = FakeRtcNow() - g_LastRefresh;
+    g_WorstRefreshGap = (gap > g_WorstRefreshGap) ? gap : g_WorstRefreshGap;
+    g_LastRefresh = FakeRtcNow();
+}
+
+static void SimRadioNop(void)
+{
+}
+
+const struct Radio_s Radio = { .Sleep = SimRadioNop, .Standby = SimRadioNop };
+
+/* Any low power mode lasts until the RTC alarm, whose interrupt runs first */
+static void SimSleep(PowerMode_t mode)
+{
+    BenchCheck(FakeRtcAlarmSet(), "a wake-up is programmed", FakeRtcNow());
+    g_InMode = mode;
+    FakeRtcFireAlarm();
+    g_InMode = POWER_MODE_RUN;
+}
+
+void LpmEnterSleepMode(void)
+{
+    SimSleep(POWER_MODE_SLEEP);
+}
+
+void LpmEnterStopMode(void)
+{
+    SimSleep(POWER_MODE_STOP);
+}
+
+void LpmEnterOffMode(void)
+{
+    /* Wake-up from standby is a reset: nothing to run */
+}
+
+/* Application timers are left in RUN: STOP ends ahead of them */
+static void SimOnAppTimer(void)
+{
+    BenchCheck(g_InMode != POWER_MODE_STOP, "application timer fired straight out of STOP", FakeRtcNow());
+    g_FiredInStop += (g_InMode == POWER_MODE_STOP) ? 1U : 0U;
+}
+
+static const char *SimModeName(PowerMode_t mode)
+{
+    switch (mode)
+    {
+    case POWER_MODE_RUN:
+        return "RUN";
+    case POWER_MODE_SLEEP:
+        return "SLEEP";
+    case POWER_MODE_STOP:
+        return "STOP";
+    default:
+        return "OFF";
+    }
+}
+
+static PowerIdleTrace_t SimIdle(void)
+{
+    PowerIdleTrace_t trace[POWER_IDLE_TRACE_DEPTH];
+    bool stopAllowed = LpmGetMode() == LPM_STOP_MODE;
+
+    Power_Idle();
+    uint8_t count = Power_GetIdleTrace(trace, POWER_IDLE_TRACE_DEPTH);
+    PowerIdleTrace_t last = trace[count - 1U];
+
+    BenchCheck(!stopAllowed || last.NextEventMs < POWER_STOP_MIN_MS || last.Mode == POWER_MODE_STOP,
+               "STOP for an idle long enough", last.NextEventMs);
+    BenchCheck((last.Mode == POWER_MODE_RUN) == (last.NextEventMs == 0U), "RUN exactly when a timer is due",
+               last.TimeMs);
+    BenchCheck(last.Mode != POWER_MODE_STOP || last.NextEventMs >= POWER_STOP_MIN_MS, "STOP for a short idle",
+               last.NextEventMs);
+    if (last.Mode == POWER_MODE_STOP && last.NextEventMs != POWER_IDLE_FOREVER)
+    {
+        BenchCheck(last.PlannedMs + POWER_STOP_WAKEUP_MS <= last.NextEventMs, "STOP ends ahead of the deadline",
+                   last.PlannedMs);
+        if (last.PlannedMs + POWER_STOP_WAKEUP_MS == last.NextEventMs)
+        {
+            BenchCheck(FakeRtcNow() - last.TimeMs >= last.NextEventMs, "clock lead run out in the same idle call",
+                       FakeRtcNow() - last.TimeMs);
+        }
+    }
+    if (last.Mode != POWER_MODE_RUN && last.Mode != POWER_MODE_OFF)
+    {
+        BenchCheck(last.PlannedMs <= WATCHDOG_MAX_STOP_TIME_MS, "sleep within the watchdog limit", last.PlannedMs);
+        BenchCheck(last.SleptMs <= last.PlannedMs, "no sleep past the planned wake-up", last.SleptMs);
+    }
+    return last;
+}
+
+int main(void)
+{
+    uint32_t modes[POWER_MODE_OFF + 1] = { 0 };
+    uint32_t stopMs = 0;
+    uint32_t longestStop = 0;
+
+    ModelRcc.CSR = RCC_CSR_LSERDY;
+    Power_Init();
+    LpmSetOffMode(LPM_APPLI_ID, LPM_DISABLE); /* as board.c does */
+
+    ScheduleStart(true, true, SimOnAppTimer);
+
+    uint32_t end = FakeRtcNow() + (SIM_HOURS * 3600000UL);
+    while ((int32_t)(end - FakeRtcNow()) > 0)
+    {
+        Watchdog_Refresh();
+
+        ScheduleProcess();
+
+        PowerIdleTrace_t last = SimIdle();
+        modes[last.Mode]++;
+        if (last.Mode == POWER_MODE_STOP)
+        {
+            stopMs += last.SleptMs;
+            longestStop = (last.SleptMs > longestStop) ? last.SleptMs : longestStop;
+        }
+    }
+
+    printf("  %u h: per hour %lu STOP, %lu SLEEP, %lu RUN (timer already due)\r\n", SIM_HOURS,
+           (unsigned long)(modes[POWER_MODE_STOP] / SIM_HOURS), (unsigned long)(modes[POWER_MODE_SLEEP] / SIM_HOURS),
+           (unsigned long)(modes[POWER_MODE_RUN] / SIM_HOURS));
+    printf("  %.2f %% of the time in STOP, longest STOP %lu ms, longest watchdog gap %lu ms (limit %lu)\r\n",
+           (100.0 * stopMs) / (SIM_HOURS * 3600000.0), (unsigned long)longestStop, (unsigned long)g_WorstRefreshGap,
+           (unsigned long)WATCHDOG_MAX_STOP_TIME_MS);
+
+    PowerIdleTrace_t trace[POWER_IDLE_TRACE_DEPTH];
+    uint8_t count = Power_GetIdleTrace(trace, POWER_IDLE_TRACE_DEPTH);
+    printf("  last %u decisions (time, next event, planned, slept in ms):\r\n", (unsigned)count);
+    for (uint8_t i = 0; i < count; i++)
+    {
+        printf("    %10lu %10ld %10ld %8lu  %s\r\n", (unsigned long)trace[i].TimeMs, (long)trace[i].NextEventMs,
+               (long)trace[i].PlannedMs, (unsigned long)trace[i].SleptMs, SimModeName(trace[i].Mode));
+    }
+
+    /* Nothing pending: STOP with only the watchdog wake-up, or OFF once
+     * nobody vetoes it */
+    ScheduleStop();
+    PowerIdleTrace_t idle = SimIdle();
+    BenchCheck(idle.Mode == POWER_MODE_STOP && idle.PlannedMs == WATCHDOG_MAX_STOP_TIME_MS,
+               "no timer: STOP until the watchdog refresh", idle.PlannedMs);
+    LpmSetOffMode(LPM_APPLI_ID, LPM_ENABLE);
+    idle = SimIdle();
+    BenchCheck(idle.Mode == POWER_MODE_OFF, "no timer and no veto: OFF", idle.Mode);
+
+    printf("  %s\r\n", (BenchFailures() == 0U) ? "idle model: all checks passed" : "idle model: FAILED");
+    return (BenchFailures() == 0U) ? 0 : 1;
+}
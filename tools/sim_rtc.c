@@ -0,0 +1,261 @@
+/*!
+ * \file      sim_rtc.c
+ *
+ * \brief     Host model check of the LPTIM1 time base in rtc-board.c
+ *
+ * \details   Built and run by `make sim-rtc`. rtc-board.c is compiled
+ *            against RAM copies of the registers it touches, and a model of
+ *            LPTIM1 steps the counter one prescaled tick (32 LSE clocks) at a
+ *            time. The model raises ARRM/CMPM like the hardware, applies
+ *            compare writes one tick late (3 LSE clocks of domain sync,
+ *            rounded up) and dispatches the interrupt unless
+ *            a critical section holds it off. Checks the extended count
+ *            against a reference, alarm accuracy in ticks, the ms/tick
+ *            conversions and the calendar time, and reports the interrupts
+ *            per hour of an idle time base.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "bench.h"
+#include "stm32l0xx.h"
+
+static LPTIM_TypeDef ModelLptim;
+static RCC_TypeDef ModelRcc;
+static PWR_TypeDef ModelPwr;
+static EXTI_TypeDef ModelExti;
+static NVIC_Type ModelNvic;
+static SysTick_Type ModelSysTick;
+
+#undef LPTIM1
+#undef RCC
+#undef PWR
+#undef EXTI
+#undef NVIC
+#undef SysTick
+#define LPTIM1 (&ModelLptim)
+#define RCC (&ModelRcc)
+#define PWR (&ModelPwr)
+#define EXTI (&ModelExti)
+#define NVIC (&ModelNvic)
+#define SysTick (&ModelSysTick)
+/* The CMSIS NVIC helpers were compiled against the real NVIC address */
+#define NVIC_SetPriority(irq, priority) ((void)(irq), (void)(priority))
+#define NVIC_EnableIRQ(irq) (ModelNvic.ISER[0] |= (1UL << (irq)))
+#define NVIC_SetPendingIRQ(irq) (ModelNvic.ISPR[0] |= (1UL << (irq)))
+/* Register writes complete at once here (CMPOK/ARROK stay set); the compare
+ * sync delay is modelled on the counter side instead */
+#define RTC_LPTIM_CLEAR_FLAGS(flags) (ModelLptim.ISR &= ~((uint32_t)(flags) & (LPTIM_ISR_ARRM | LPTIM_ISR_CMPM)))
+
+#include "rtc-board.c"
+
+#define SIM_TICK_HZ 1024U /* LSE / 32 */
+#define SIM_CMP_SYNC_TICKS 1U
+#define SIM_ALARMS 2000U
+
+static uint32_t g_MaskDepth = 0;
+static uint64_t g_Ticks = 0;         /* reference: ticks since RtcInit */
+static uint32_t g_CmpShadow = 0;     /* compare value the counter sees */
+static uint32_t g_CmpWritten = 0;
+static uint32_t g_CmpSyncLeft = 0;
+static uint32_t g_Interrupts = 0;
+static uint64_t g_FiredAt = 0;
+static uint32_t g_Fired = 0;
+static uint32_t g_Seed = 12345U;
+
+void BoardCriticalSectionBegin(uint32_t *mask)
+{
+    *mask = g_MaskDepth++;
+}
+
+void BoardCriticalSectionEnd(uint32_t *mask)
+{
+    g_MaskDepth = *mask;
+}
+
+void TimerIrqHandler(void)
+{
+    g_Fired++;
+    g_FiredAt = g_Ticks;
+}
+
+static uint32_t SimRandom(void)
+{
+    g_Seed = (g_Seed * 1103515245U) + 12345U;
+    return g_Seed >> 1;
+}
+
+static void SimDispatch(void)
+{
+    bool enabled = ((ModelNvic.ISER[0] & (1UL << LPTIM1_IRQn)) != 0U) && ((ModelExti.IMR & EXTI_IMR_IM29) != 0U);
+    bool flagged = (ModelLptim.ISR & ModelLptim.IER & (LPTIM_ISR_ARRM | LPTIM_ISR_CMPM)) != 0U;
+    bool pended = (ModelNvic.ISPR[0] & (1UL << LPTIM1_IRQn)) != 0U;
+
+    /* NVIC_SetPendingIRQ writes ISPR, which latches until the handler runs */
+    if (enabled && g_MaskDepth == 0U && (flagged || pended))
+    {
+        ModelNvic.ISPR[0] = 0U;
+        g_Interrupts++;
+        RtcOnLptimIrq();
+    }
+}
+
+/* One tick: the counter moves, the compare shadow catches up with the
+ * last write, match flags are raised, then the interrupt may run */
+static void SimTick(void)
+{
+    if (ModelLptim.CMP != g_CmpWritten)
+    {
+        g_CmpWritten = ModelLptim.CMP;
+        g_CmpSyncLeft = SIM_CMP_SYNC_TICKS;
+    }
+    if (g_CmpSyncLeft > 0U && --g_CmpSyncLeft == 0U)
+    {
+        g_CmpShadow = g_CmpWritten;
+    }
+
+    ModelLptim.CNT = (ModelLptim.CNT >= ModelLptim.ARR) ? 0U : ModelLptim.CNT + 1U;
+    g_Ticks++;
+    if (ModelLptim.CNT == g_CmpShadow)
+    {
+        ModelLptim.ISR |= LPTIM_ISR_CMPM;
+    }
+    if (ModelLptim.CNT == ModelLptim.ARR)
+    {
+        ModelLptim.ISR |= LPTIM_ISR_ARRM;
+    }
+    SimDispatch();
+}
+
+static void SimRun(uint32_t ticks)
+{
+    while (ticks-- > 0U)
+    {
+        SimTick();
+    }
+}
+
+static void SimInit(void)
+{
+    /* Registers read back as the hardware would after the writes */
+    ModelRcc.CSR = RCC_CSR_LSERDY;
+    ModelLptim.ISR = LPTIM_ISR_ARROK | LPTIM_ISR_CMPOK;
+    RtcInit();
+    ModelLptim.ISR |= LPTIM_ISR_ARROK | LPTIM_ISR_CMPOK;
+    g_CmpWritten = ModelLptim.CMP;
+    g_CmpShadow = ModelLptim.CMP;
+
+    BenchCheck((ModelRcc.CCIPR & RCC_CCIPR_LPTIM1SEL) == RCC_CCIPR_LPTIM1SEL, "LPTIM1 kernel clock is LSE",
+               ModelRcc.CCIPR);
+    BenchCheck((ModelLptim.CFGR & LPTIM_CFGR_PRESC) == (LPTIM_CFGR_PRESC_2 | LPTIM_CFGR_PRESC_0), "LSE / 32 prescaler",
+               ModelLptim.CFGR);
+    BenchCheck(ModelLptim.ARR == 0xFFFFU, "free-running 16-bit period", ModelLptim.ARR);
+    BenchCheck((ModelLptim.CR & LPTIM_CR_CNTSTRT) != 0U, "counter started", ModelLptim.CR);
+    BenchCheck((ModelExti.IMR & EXTI_IMR_IM29) != 0U, "EXTI line 29 wakeup", ModelExti.IMR);
+}
+
+/* Offset between the reference and RtcGetTimerValue, fixed at start */
+static uint32_t g_Offset = 0;
+
+static void SimCheckCount(void)
+{
+    uint32_t value = RtcGetTimerValue();
+    BenchCheck(value - (uint32_t)g_Ticks == g_Offset, "extended count tracks the counter", g_Ticks);
+}
+
+int main(void)
+{
+    SimInit();
+    g_Offset = RtcGetTimerValue() - (uint32_t)g_Ticks;
+
+    /* Extended count, also read inside long critical sections */
+    for (uint32_t i = 0; i < 40U * 0x10000U; i++)
+    {
+        if ((i % 0x10000U) == 0xFFF0U)
+        {
+            CRITICAL_SECTION_BEGIN();
+            for (uint32_t j = 0; j < 200U; j++)
+            {
+                SimTick();
+                SimCheckCount();
+            }
+            CRITICAL_SECTION_END();
+            SimDispatch();
+        }
+        SimTick();
+        if ((i & 7U) == 0U || (ModelLptim.CNT >= 0xFFFEU || ModelLptim.CNT <= 1U))
+        {
+            SimCheckCount();
+        }
+    }
+
+    /* Alarms from the minimum timeout to three periods out, some on the
+     * autoreload phase, some stopped before they fire */
+    uint32_t worst = 0;
+    uint32_t late = 0;
+    for (uint32_t n = 0; n < SIM_ALARMS; n++)
+    {
+        uint32_t timeout = RtcGetMinimumTimeout() + (SimRandom() % (3U * 0x10000U));
+        if ((n % 10U) == 0U)
+        {
+            timeout = 0x10000U - ((RtcGetTimerValue() + 0U) & 0xFFFFU);
+            timeout += (timeout < RtcGetMinimumTimeout()) ? 0x10000U : 0U;
+        }
+        bool stop = (n % 7U) == 3U;
+
+        RtcSetTimerContext();
+        uint64_t due = g_Ticks + timeout;
+        g_Fired = 0;
+        RtcSetAlarm(timeout);
+        if (stop)
+        {
+            SimRun(timeout / 2U);
+            RtcStopAlarm();
+            SimRun(timeout);
+            BenchCheck(g_Fired == 0U, "stopped alarm stays quiet", n);
+            continue;
+        }
+
+        while (g_Fired == 0U && g_Ticks < due + 0x30000U)
+        {
+            SimTick();
+        }
+        BenchCheck(g_Fired == 1U, "alarm fires once", n);
+        uint32_t error = (uint32_t)((g_FiredAt > due) ? (g_FiredAt - due) : (due - g_FiredAt));
+        BenchCheck(g_FiredAt >= due, "alarm never early", due - g_FiredAt);
+        worst = (error > worst) ? error : worst;
+        late += (error > 0U) ? 1U : 0U;
+        SimRun(SimRandom() % 5000U);
+    }
+
+    /* Conversions against 64-bit reference arithmetic */
+    for (uint32_t n = 0; n < 1000000U; n++)
+    {
+        uint32_t ms = (n < 500000U) ? n : SimRandom();
+        uint32_t tick = SimRandom();
+        BenchCheck(RtcMs2Tick(ms) == (uint32_t)(((uint64_t)ms * SIM_TICK_HZ) / 1000U), "RtcMs2Tick", ms);
+        BenchCheck(RtcTick2Ms(tick) == (uint32_t)(((uint64_t)tick * 1000U) / SIM_TICK_HZ), "RtcTick2Ms", tick);
+    }
+
+    /* Calendar time from the 48-bit count */
+    uint16_t milliseconds;
+    uint32_t seconds = RtcGetCalendarTime(&milliseconds);
+    uint64_t total = ((uint64_t)RtcOverflows << 16) + ((ModelLptim.CNT + 1U) & 0xFFFFU);
+    BenchCheck(seconds == (uint32_t)(total / SIM_TICK_HZ), "calendar seconds", seconds);
+    BenchCheck(milliseconds == (uint32_t)(((total % SIM_TICK_HZ) * 1000U) / SIM_TICK_HZ), "calendar ms", milliseconds);
+
+    /* Idle cost: interrupts in one hour with no alarm armed */
+    RtcStopAlarm();
+    g_Interrupts = 0;
+    SimRun(3600U * SIM_TICK_HZ);
+    SimCheckCount();
+
+    printf("  alarms: %u set, worst error %u ticks (%u late), none early\r\n", SIM_ALARMS, (unsigned)worst,
+           (unsigned)late);
+    printf("  idle LPTIM interrupts: %lu per hour (SysTick back end: 3600000, and none in STOP)\r\n",
+           (unsigned long)g_Interrupts);
+    printf("  %s\r\n", (BenchFailures() == 0U) ? "rtc model: all checks passed" : "rtc model: FAILED");
+    return (BenchFailures() == 0U) ? 0 : 1;
+}
@@ -0,0 +1,441 @@
+/*!
+ * \file      sim_session.c
+ *
+ * \brief     Host model check of the OTAA session restore
+ *
+ * \details   Built and run by `make sim-session`. storage.c, the LoRaWAN
+ *            stack and timer.c run against a RAM model of the data EEPROM,
+ *            a fake RTC and a radio that only records what it is asked to
+ *            do. A session is installed and rebooted into, an uplink gets a
+ *            downlink whose FOpts carry LinkADRReq, RXParamSetupReq,
+ *            RXTimingSetupReq and DutyCycleReq, and the device reboots again:
+ *            the restored session must come back with every negotiated
+ *            setting, a new join must drop them, and a block written before
+ *            the MAC state was stored must still load with the configured
+ *            settings. LoRaWAN_Send must commit the FCnt, and only the
+ *            FCnt, before it transmits, and must not transmit when that
+ *            fails. A reboot resets every storage.c static and rebuilds the
+ *            context from storage the way lorawan_app.c does.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "bench.h"
+#include "storage.c"
+
+#include "lorawan.h"
+#include "lorawan_crypto.h"
+#include "lorawan_mac.h"
+#include "radio.h"
+#include "timer.h"
+
+#define SIM_DEVADDR       0x26011BDAUL
+#define SIM_DOWNLINK_FCNT 1U
+#define SIM_RX2_FREQUENCY 923900000UL
+#define SIM_MHDR_UNCONFIRMED_DOWN 0x60U
+#define SIM_FCTRL_ADR     0x80U
+#define SIM_DIR_DOWN      1U
+
+static const uint8_t g_NwkSKey[16] = {0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+                                      0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C};
+static const uint8_t g_AppSKey[16] = {0x3C, 0x4F, 0xCF, 0x09, 0x88, 0x15, 0xF7, 0xAB,
+                                      0xA6, 0xD2, 0xAE, 0x28, 0x16, 0x15, 0x7E, 0x2B};
+
+static uint8_t g_Eeprom[EEPROM_SIZE];
+static uint32_t g_Now = 0;
+static uint32_t g_Context = 0;
+static RadioEvents_t *g_Events = NULL;
+static uint32_t g_Transmissions = 0;
+static bool g_EepromFails = false;
+
+static LoRaWANSession_t g_Session;
+static LoRaWANContext_t g_Ctx;
+static uint8_t g_RadioBuffer[LORAWAN_RADIO_BUFFER_SIZE];
+
+LmnStatus_t EepromMcuUpdateBuffer(uint16_t addr, const uint8_t *buffer, uint16_t size, uint16_t *programmed)
+{
+    if (g_EepromFails || buffer == NULL || size == 0U || ((uint32_t)addr + size) > sizeof(g_Eeprom))
+    {
+        return LMN_STATUS_ERROR;
+    }
+    memcpy(&g_Eeprom[addr], buffer, size);
+    if (programmed != NULL)
+    {
+        *programmed = size;
+    }
+    return LMN_STATUS_OK;
+}
+
+LmnStatus_t EepromMcuReadBuffer(uint16_t addr, uint8_t *buffer, uint16_t size)
+{
+    if (buffer == NULL || size == 0U || ((uint32_t)addr + size) > sizeof(g_Eeprom))
+    {
+        return LMN_STATUS_ERROR;
+    }
+    memcpy(buffer, &g_Eeprom[addr], size);
+    return LMN_STATUS_OK;
+}
+
+/* Fake RTC: one tick per millisecond, time only moves when the sim says so */
+uint32_t RtcSetTimerContext(void)
+{
+    g_Context = g_Now;
+    return g_Context;
+}
+
+uint32_t RtcGetMinimumTimeout(void)
+{
+    return 1U;
+}
+
+uint32_t RtcMs2Tick(uint32_t milliseconds)
+{
+    return milliseconds;
+}
+
+uint32_t RtcTick2Ms(uint32_t tick)
+{
+    return tick;
+}
+
+void RtcSetAlarm(uint32_t timeout)
+{
+    (void)timeout;
+}
+
+void RtcStopAlarm(void)
+{
+}
+
+uint32_t RtcGetTimerValue(void)
+{
+    return g_Now;
+}
+
+uint32_t RtcGetCalendarTime(uint16_t *milliseconds)
+{
+    if (milliseconds != NULL)
+    {
+        *milliseconds = (uint16_t)(g_Now % 1000U);
+    }
+    return g_Now / 1000U;
+}
+
+void RtcProcess(void)
+{
+}
+
+TimerTime_t RtcTempCompensation(TimerTime_t period, float temperature)
+{
+    (void)temperature;
+    return period;
+}
+
+void BoardCriticalSectionBegin(uint32_t *mask)
+{
+    *mask = 0U;
+}
+
+void BoardCriticalSectionEnd(uint32_t *mask)
+{
+    (void)mask;
+}
+
+uint32_t BoardGetRandomSeed(void)
+{
+    return 0x5EED5EEDUL;
+}
+
+/* Radio: remembers its events and counts transmissions */
+static void SimRadioInit(RadioEvents_t *events)
+{
+    g_Events = events;
+}
+
+static void SimRadioSetModem(RadioModems_t modem)
+{
+    (void)modem;
+}
+
+static void SimRadioSetChannel(uint32_t freq)
+{
+    (void)freq;
+}
+
+static void SimRadioSetRxConfig(RadioModems_t modem, uint32_t bandwidth, uint32_t datarate, uint8_t coderate,
+                                uint32_t bandwidthAfc, uint16_t preambleLen, uint16_t symbTimeout, bool fixLen,
+                                uint8_t payloadLen, bool crcOn, bool freqHopOn, uint8_t hopPeriod, bool iqInverted,
+                                bool rxContinuous)
+{
+    (void)modem, (void)bandwidth, (void)datarate, (void)coderate, (void)bandwidthAfc, (void)preambleLen;
+    (void)symbTimeout, (void)fixLen, (void)payloadLen, (void)crcOn, (void)freqHopOn, (void)hopPeriod;
+    (void)iqInverted, (void)rxContinuous;
+}
+
+static void SimRadioSetTxConfig(RadioModems_t modem, int8_t power, uint32_t fdev, uint32_t bandwidth,
+                                uint32_t datarate, uint8_t coderate, uint16_t preambleLen, bool fixLen, bool crcOn,
+                                bool freqHopOn, uint8_t hopPeriod, bool iqInverted, uint32_t timeout)
+{
+    (void)modem, (void)power, (void)fdev, (void)bandwidth, (void)datarate, (void)coderate, (void)preambleLen;
+    (void)fixLen, (void)crcOn, (void)freqHopOn, (void)hopPeriod, (void)iqInverted, (void)timeout;
+}
+
+static void SimRadioSend(uint8_t *buffer, uint8_t size)
+{
+    (void)buffer;
+    (void)size;
+    g_Transmissions++;
+}
+
+static void SimRadioRx(uint32_t timeout)
+{
+    (void)timeout;
+}
+
+static void SimRadioNop(void)
+{
+}
+
+static void SimRadioSetPublicNetwork(bool enable)
+{
+    (void)enable;
+}
+
+static uint32_t SimRadioGetWakeupTime(void)
+{
+    return 1U;
+}
+
+const struct Radio_s Radio = {
+    .Init = SimRadioInit,
+    .SetModem = SimRadioSetModem,
+    .SetChannel = SimRadioSetChannel,
+    .SetRxConfig = SimRadioSetRxConfig,
+    .SetTxConfig = SimRadioSetTxConfig,
+    .Send = SimRadioSend,
+    .Sleep = SimRadioNop,
+    .Standby = SimRadioNop,
+    .Rx = SimRadioRx,
+    .SetPublicNetwork = SimRadioSetPublicNetwork,
+    .GetWakeupTime = SimRadioGetWakeupTime,
+};
+
+/* A reset: storage.c forgets everything but the EEPROM, then main.c and
+ * LoRaWANApp_Init start over. Returns whether a session was restored. */
+static bool SimReboot(void)
+{
+    memset(&g_StorageCache, 0, sizeof(g_StorageCache));
+    g_StorageInitialized = false;
+    g_BlockSlot = STORAGE_SLOT_NONE;
+    g_BlockSequence = 0;
+    g_JournalScanned = false;
+    g_JournalHasRecord = false;
+    g_JournalNext = 0;
+    g_JournalLast = 0;
+    g_LogSegment = STORAGE_LOG_NONE;
+    g_LogSequence = 0;
+    g_LogWritePos = 0;
+    memset(g_LogIndex, 0, sizeof(g_LogIndex));
+    g_LogCompactPending = false;
+    g_PendingKeys = 0;
+    g_JournalPending = false;
+    g_WriteGate = NULL;
+    g_ListenerCount = 0;
+
+    StorageStatus_t status = Storage_Init();
+    BenchCheck(status == STORAGE_OK || status == STORAGE_FACTORY_RESET, "storage init", (uint32_t)status);
+    const StorageData_t *storage = Storage_Get();
+
+    memset(&g_Session, 0, sizeof(g_Session));
+    memcpy(g_Session.NwkSKey, storage->NwkSKey, sizeof(g_Session.NwkSKey));
+    memcpy(g_Session.AppSKey, storage->AppSKey, sizeof(g_Session.AppSKey));
+    g_Session.DevAddr = storage->DevAddr;
+    g_Session.FCntUp = storage->FrameCounterUp;
+    g_Session.FCntDown = storage->FrameCounterDown;
+    g_Session.JoinMode = LORAWAN_JOIN_MODE_OTAA;
+
+    memset(&g_Ctx, 0, sizeof(g_Ctx));
+    g_Ctx.Session = &g_Session;
+    g_Ctx.Settings.Region = LORAWAN_REGION_AU915;
+    g_Ctx.Settings.DeviceClass = LORAWAN_DEVICE_CLASS_A;
+    g_Ctx.Settings.AdrState = storage->AdrEnabled ? LORAWAN_ADR_ON : LORAWAN_ADR_OFF;
+    g_Ctx.Settings.DataRate = storage->DataRate;
+    g_Ctx.Settings.TxPower = storage->TxPower;
+    g_Ctx.Settings.Rx2DataRate = storage->Rx2DataRate;
+    g_Ctx.Settings.Rx2Frequency = storage->Rx2Frequency;
+    g_Ctx.Settings.Rx1DelayMs = storage->Rx1Delay;
+    g_Ctx.Settings.Rx2DelayMs = storage->Rx2Delay;
+    g_Ctx.Settings.JoinRx1DelayMs = storage->JoinRx1Delay;
+    g_Ctx.Settings.JoinRx2DelayMs = storage->JoinRx2Delay;
+    g_Ctx.Settings.MsgType = LORAWAN_MSG_UNCONFIRMED;
+    g_Ctx.Settings.AppPort = storage->AppPort;
+    g_Ctx.Settings.TxDutyCycleMs = storage->TxDutyCycle;
+    g_Ctx.RadioBuffer = g_RadioBuffer;
+    g_Ctx.RadioBufferSize = sizeof(g_RadioBuffer);
+
+    BenchCheck(LoRaWAN_Init(&g_Ctx) == LORAWAN_STATUS_SUCCESS, "LoRaWAN init", 0U);
+    if (storage->SessionValid == 0U)
+    {
+        return false;
+    }
+    return LoRaWAN_RestoreSession(&g_Ctx) == LORAWAN_STATUS_SUCCESS;
+}
+
+/* The settings a session restore may change, compared field by field */
+static void SimCheckMacSettings(const LoRaWANSettings_t *expected, const char *when)
+{
+    const LoRaWANSettings_t *actual = &g_Ctx.Settings;
+    char what[80];
+
+#define SIM_CHECK_FIELD(field)                                                      \
+    snprintf(what, sizeof(what), "%s: " #field " %lu, expected %lu", when,           \
+             (unsigned long)actual->field, (unsigned long)expected->field);         \
+    BenchCheck(actual->field == expected->field, what, (uint32_t)actual->field)
+
+    SIM_CHECK_FIELD(DataRate);
+    SIM_CHECK_FIELD(TxPower);
+    SIM_CHECK_FIELD(ChannelMask);
+    SIM_CHECK_FIELD(Rx1DrOffset);
+    SIM_CHECK_FIELD(Rx2DataRate);
+    SIM_CHECK_FIELD(Rx2Frequency);
+    SIM_CHECK_FIELD(Rx1DelayMs);
+    SIM_CHECK_FIELD(Rx2DelayMs);
+    SIM_CHECK_FIELD(MaxDutyCycle);
+
+#undef SIM_CHECK_FIELD
+}
+
+/* The network's answer to an uplink: MAC commands in FOpts, no payload */
+static void SimDeliverMacCommands(void)
+{
+    uint32_t rx2 = SIM_RX2_FREQUENCY / 100UL;
+    const uint8_t fopts[] = {
+        LORAWAN_MAC_LINK_ADR, 0x32, 0x00, 0x0F, 0x01,     /* DR3, TXPower 2, channels 8-11 */
+        LORAWAN_MAC_RX_PARAM_SETUP, 0x2A, (uint8_t)rx2, (uint8_t)(rx2 >> 8), (uint8_t)(rx2 >> 16), /* RX1 offset 2, RX2 DR10 */
+        LORAWAN_MAC_RX_TIMING_SETUP, 0x03,                /* RX1 after 3 s */
+        LORAWAN_MAC_DUTY_CYCLE, 0x02,                     /* 1/4 duty cycle */
+    };
+    uint8_t frame[32];
+    uint8_t size = 0;
+
+    frame[size++] = SIM_MHDR_UNCONFIRMED_DOWN;
+    frame[size++] = (uint8_t)SIM_DEVADDR;
+    frame[size++] = (uint8_t)(SIM_DEVADDR >> 8);
+    frame[size++] = (uint8_t)(SIM_DEVADDR >> 16);
+    frame[size++] = (uint8_t)(SIM_DEVADDR >> 24);
+    frame[size++] = (uint8_t)(SIM_FCTRL_ADR | sizeof(fopts));
+    frame[size++] = (uint8_t)SIM_DOWNLINK_FCNT;
+    frame[size++] = (uint8_t)(SIM_DOWNLINK_FCNT >> 8);
+    memcpy(&frame[size], fopts, sizeof(fopts));
+    size += sizeof(fopts);
+
+    uint32_t mic = 0;
+    LoRaWAN_Crypto_ComputeMic(g_NwkSKey, frame, size, SIM_DEVADDR, SIM_DOWNLINK_FCNT, SIM_DIR_DOWN, &mic);
+    frame[size++] = (uint8_t)mic;
+    frame[size++] = (uint8_t)(mic >> 8);
+    frame[size++] = (uint8_t)(mic >> 16);
+    frame[size++] = (uint8_t)(mic >> 24);
+
+    g_Events->RxDone(frame, size, -60, 5);
+}
+
+/* A block from before SessionMac was added: its CRC sits where SessionMac
+ * starts now, and whatever follows in the slot is not part of it */
+static void SimWriteShortBlock(void)
+{
+    StorageBlock_t block;
+
+    memset(g_Eeprom, 0xFF, sizeof(g_Eeprom));
+    memset(&block, 0xA5, sizeof(block));
+    Storage_SetDefaults(&block.Data);
+    memset(&block.Data.SessionMac, 0xA5, sizeof(block.Data.SessionMac));
+    block.Data.DevAddr = SIM_DEVADDR;
+    memcpy(block.Data.NwkSKey, g_NwkSKey, sizeof(g_NwkSKey));
+    memcpy(block.Data.AppSKey, g_AppSKey, sizeof(g_AppSKey));
+    block.Data.SessionValid = 1U;
+    block.Header.Magic = STORAGE_MAGIC;
+    block.Header.Version = STORAGE_VERSION;
+    block.Header.Length = STORAGE_DATA_MIN_LENGTH;
+    block.Header.Sequence = 1U;
+
+    uint32_t crc = Storage_CalculateCrc(&block.Data, &block.Header);
+    memcpy((uint8_t *)&block.Data + STORAGE_DATA_MIN_LENGTH - sizeof(crc), &crc, sizeof(crc));
+    Storage_FlashWrite(Storage_SlotAddress(0U), (const uint8_t *)&block, sizeof(block));
+}
+
+int main(void)
+{
+    memset(g_Eeprom, 0xFF, sizeof(g_Eeprom));
+    BenchCheck(!SimReboot(), "first boot has no session", 0U);
+    LoRaWANSettings_t configured = g_Ctx.Settings;
+
+    /* What a join leaves behind: LoRaWANApp_Join, then the join accept */
+    Storage_InvalidateSession();
+    Storage_UpdateJoinKeys(SIM_DEVADDR, g_NwkSKey, g_AppSKey);
+    Storage_Flush();
+
+    BenchCheck(SimReboot(), "session restored after the join", 0U);
+    SimCheckMacSettings(&configured, "restored, nothing negotiated");
+
+    /* The restore committed a new FCntUp; a config change is queued too */
+    uint8_t port = 3U;
+    Storage_Write(STORAGE_KEY_PORT, &port, sizeof(port));
+    uint8_t payload = 0x42;
+    g_Now += 1000U;
+    BenchCheck(LoRaWAN_Send(&g_Ctx, &payload, sizeof(payload), 2U, LORAWAN_MSG_UNCONFIRMED) == LORAWAN_STATUS_SUCCESS,
+               "uplink accepted", 0U);
+    BenchCheck(g_Transmissions == 1U, "uplink transmitted", g_Transmissions);
+    BenchCheck(!g_JournalPending, "FCnt committed before the uplink", 0U);
+    BenchCheck((g_PendingKeys & (1UL << STORAGE_KEY_PORT)) != 0U, "config record left to Storage_Process",
+               g_PendingKeys);
+    g_Now += 50U;
+    g_Events->TxDone();
+    g_Now += configured.Rx1DelayMs;
+    SimDeliverMacCommands();
+    Storage_Flush();
+
+    LoRaWANSettings_t negotiated = configured;
+    negotiated.DataRate = 3U;
+    negotiated.TxPower = 2U;
+    negotiated.ChannelMask = 0x000FU;
+    negotiated.Rx1DrOffset = 2U;
+    negotiated.Rx2DataRate = 10U;
+    negotiated.Rx2Frequency = SIM_RX2_FREQUENCY;
+    negotiated.Rx1DelayMs = 3000U;
+    negotiated.Rx2DelayMs = 4000U;
+    negotiated.MaxDutyCycle = 2U;
+    SimCheckMacSettings(&negotiated, "after the downlink");
+
+    BenchCheck(SimReboot(), "session restored after the downlink", 0U);
+    SimCheckMacSettings(&negotiated, "restored after the downlink");
+    printf("  save, reset, restore: DR%u TXPower %u mask 0x%04X RX1 offset %u RX2 DR%u %lu Hz RX1 %lu ms duty 1/%u\r\n",
+           g_Ctx.Settings.DataRate, g_Ctx.Settings.TxPower, g_Ctx.Settings.ChannelMask, g_Ctx.Settings.Rx1DrOffset,
+           g_Ctx.Settings.Rx2DataRate, (unsigned long)g_Ctx.Settings.Rx2Frequency,
+           (unsigned long)g_Ctx.Settings.Rx1DelayMs, 1U << g_Ctx.Settings.MaxDutyCycle);
+
+    /* A new join starts from the configuration again */
+    Storage_InvalidateSession();
+    Storage_UpdateJoinKeys(SIM_DEVADDR, g_NwkSKey, g_AppSKey);
+    Storage_Flush();
+    BenchCheck(SimReboot(), "session restored after a rejoin", 0U);
+    SimCheckMacSettings(&configured, "restored after a rejoin");
+
+    SimWriteShortBlock();
+    BenchCheck(SimReboot(), "session restored from a block without MAC state", 0U);
+    BenchCheck(Storage_Get()->SessionMac.Valid == 0U, "missing MAC state loads as zero",
+               Storage_Get()->SessionMac.Valid);
+    SimCheckMacSettings(&configured, "restored from a block without MAC state");
+
+    /* No FCnt commit, no frame */
+    g_EepromFails = true;
+    g_Now += 1000U;
+    BenchCheck(LoRaWAN_Send(&g_Ctx, &payload, sizeof(payload), 2U, LORAWAN_MSG_UNCONFIRMED) == LORAWAN_STATUS_ERROR,
+               "uplink refused when the FCnt commit fails", 0U);
+    BenchCheck(g_Transmissions == 1U, "nothing transmitted without the FCnt commit", g_Transmissions);
+    g_EepromFails = false;
+
+    printf("  %s\r\n", (BenchFailures() == 0U) ? "session model: all checks passed" : "session model: FAILED");
+    return (BenchFailures() == 0U) ? 0 : 1;
+}